@@ -48,4 +48,8 @@ build_qemu branch
 mv "./qemu-trace" "../build/qemu-trace-branch-x86" || exit 1
 echo "[+] Successfully created 'qemu-trace-branch-x86'."
 
+build_qemu bbcount
+mv "./qemu-trace" "../build/qemu-trace-bbcount-x86" || exit 1
+echo "[+] Successfully created 'qemu-trace-bbcount-x86'."
+
 exit 0
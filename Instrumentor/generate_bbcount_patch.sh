@@ -0,0 +1,21 @@
+#!/bin/bash
+
+VERSION="2.10.0"
+
+cp -r qemu-${VERSION}-bbcount-x64 qemu-${VERSION}-bbcount
+
+cp qemu-${VERSION}-bbcount/accel/tcg/eclipser.c ./patches-bbcount/
+
+cp qemu-${VERSION}/accel/tcg/Makefile.objs \
+   qemu-${VERSION}-bbcount/accel/tcg/Makefile.objs.orig
+diff -Naur qemu-${VERSION}-bbcount/accel/tcg/Makefile.objs.orig \
+           qemu-${VERSION}-bbcount/accel/tcg/Makefile.objs \
+           > patches-bbcount/makefile-objs.diff
+
+cp qemu-${VERSION}/target/i386/translate.c \
+   qemu-${VERSION}-bbcount/target/i386/translate.c.orig
+diff -Naur qemu-${VERSION}-bbcount/target/i386/translate.c.orig \
+           qemu-${VERSION}-bbcount/target/i386/translate.c \
+           > patches-bbcount/target-translate.diff
+
+rm -rf qemu-${VERSION}-bbcount
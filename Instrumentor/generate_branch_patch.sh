@@ -6,6 +6,9 @@ cp -r qemu-${VERSION}-branch-x64 qemu-${VERSION}-branch
 
 cp qemu-${VERSION}-branch/afl-qemu-cpu-inl.h ./patches-branch/afl-qemu-cpu-inl.h
 
+# The snapshot mode is shared with the coverage tracer.
+cp qemu-${VERSION}-branch/afl-qemu-snapshot.h ./patches-common/afl-qemu-snapshot.h
+
 cp qemu-${VERSION}-branch/tcg/eclipser.c ./patches-branch/eclipser.c
 
 cp qemu-${VERSION}/Makefile.target \
@@ -44,4 +47,10 @@ diff -Naur qemu-${VERSION}-branch/target/i386/translate.c.orig \
            qemu-${VERSION}-branch/target/i386/translate.c \
            > patches-branch/target-translate.diff
 
+cp qemu-${VERSION}/target/i386/helper.h \
+   qemu-${VERSION}-branch/target/i386/helper.h.orig
+diff -Naur qemu-${VERSION}-branch/target/i386/helper.h.orig \
+           qemu-${VERSION}-branch/target/i386/helper.h \
+           > patches-branch/target-helper.diff
+
 rm -rf qemu-${VERSION}-branch
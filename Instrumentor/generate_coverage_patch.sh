@@ -6,6 +6,9 @@ cp -r qemu-${VERSION}-coverage-x64 qemu-${VERSION}-coverage
 
 cp qemu-${VERSION}-coverage/accel/tcg/afl-qemu-cpu-inl.h ./patches-coverage/
 
+# The snapshot mode is shared with the branch tracer.
+cp qemu-${VERSION}-coverage/accel/tcg/afl-qemu-snapshot.h ./patches-common/
+
 cp qemu-${VERSION}-coverage/accel/tcg/eclipser.c ./patches-coverage/
 
 cp qemu-${VERSION}/accel/tcg/Makefile.objs \
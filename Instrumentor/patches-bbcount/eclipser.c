@@ -0,0 +1,203 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "qemu/osdep.h"
+
+#ifdef TARGET_X86_64
+typedef uint64_t abi_ulong;
+#else
+typedef uint32_t abi_ulong;
+#endif
+
+extern unsigned int afl_forksrv_pid;
+#define FORKSRV_FD 198
+#define TSL_FD (FORKSRV_FD - 1)
+
+/* Table of the execution counts, shared with Eclipser through the file given
+ * with ECL_BBCOUNT_LOG. It consists of a header, BLOCK_SLOTS entries for the
+ * basic blocks, and LOOP_SLOTS entries for the back edges of loops (i.e. the
+ * transitions to a block at a lower or the same address). Both are open
+ * addressing hash tables keyed by the addresses, where a zero address marks
+ * an empty slot. Should be updated along with Executor.fs.
+ */
+#define BLOCK_SLOTS (1 << 16)
+#define LOOP_SLOTS (1 << 14)
+#define PROBE_MAX 64
+
+struct bbcount_header {
+  uint64_t executed; /* Number of executed blocks */
+  uint64_t dropped;  /* Number of blocks or back edges not recorded */
+};
+
+struct block_entry {
+  uint64_t addr;
+  uint64_t count;
+};
+
+struct loop_entry {
+  uint64_t head; /* Target of the back edge */
+  uint64_t tail; /* Block that jumps back to the head */
+  uint64_t count;
+};
+
+#define BBCOUNT_LOG_SIZE (sizeof(struct bbcount_header) + \
+                          BLOCK_SLOTS * sizeof(struct block_entry) + \
+                          LOOP_SLOTS * sizeof(struct loop_entry))
+
+void eclipser_setup_before_forkserver(void);
+void eclipser_setup_after_forkserver(void);
+void eclipser_detach(void);
+void eclipser_exit(void);
+void helper_eclipser_log_bb(abi_ulong addr);
+
+abi_ulong eclipser_entry_point; /* ELF entry point (_start) */
+
+/* This tracer does not report statistics, but the fork server refers to them
+ * (cf. afl-qemu-cpu-inl.h).
+ */
+uint64_t * eclipser_stats = NULL;
+uint64_t eclipser_tb_translated = 0;
+
+static __thread abi_ulong prev_addr = 0;
+static void * bbcount_log = NULL;
+static struct bbcount_header * header = NULL;
+static struct block_entry * blocks = NULL;
+static struct loop_entry * loops = NULL;
+
+void eclipser_setup_before_forkserver(void) {
+  char * bbcount_path = getenv("ECL_BBCOUNT_LOG");
+  int bbcount_fd;
+
+  if (bbcount_path == NULL)
+    return;
+
+  bbcount_fd = open(bbcount_path, O_RDWR);
+  assert(bbcount_fd >= 0);
+  bbcount_log = mmap(NULL, BBCOUNT_LOG_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, bbcount_fd, 0);
+  assert(bbcount_log != (void *) -1);
+  close(bbcount_fd);
+
+  header = (struct bbcount_header *) bbcount_log;
+  blocks = (struct block_entry *) (header + 1);
+  loops = (struct loop_entry *) (blocks + BLOCK_SLOTS);
+}
+
+void eclipser_setup_after_forkserver(void) {
+  prev_addr = 0;
+}
+
+static void unmap_bbcount_log(void) {
+  if (bbcount_log) {
+    munmap(bbcount_log, BBCOUNT_LOG_SIZE);
+    bbcount_log = NULL;
+    header = NULL;
+    blocks = NULL;
+    loops = NULL;
+  }
+}
+
+// When fork() syscall is encountered, child process should call this function
+// to detach from Eclipser.
+void eclipser_detach(void) {
+  unmap_bbcount_log();
+
+  if (afl_forksrv_pid)
+    close(TSL_FD);
+}
+
+void eclipser_exit(void) {
+  sigset_t mask;
+
+  // Block signals, since we register signal handler that calls eclipser_exit()/
+  if (sigfillset(&mask) < 0)
+    return;
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+    return;
+
+  unmap_bbcount_log();
+}
+
+static uint64_t hash_addr(uint64_t addr) {
+  return (addr * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+/* Find the slot of 'key' with linear probing, claiming an empty slot if the
+ * key is not found. Returns -1 if no slot is left within PROBE_MAX probes.
+ * Slots are claimed atomically, since guest threads share the table.
+ */
+static int find_slot(uint64_t * keys, size_t stride, unsigned int slots,
+                     uint64_t key) {
+  unsigned int i, idx;
+  uint64_t * key_ptr;
+  uint64_t old_key;
+
+  for (i = 0; i < PROBE_MAX; i++) {
+    idx = (hash_addr(key) + i) & (slots - 1);
+    key_ptr = keys + idx * stride;
+    old_key = *key_ptr;
+    if (old_key == 0)
+      old_key = __sync_val_compare_and_swap(key_ptr, 0, key);
+    if (old_key == 0 || old_key == key)
+      return idx;
+  }
+  return -1;
+}
+
+static void count_block(abi_ulong addr) {
+  int idx = find_slot(&blocks[0].addr, 2, BLOCK_SLOTS, addr);
+
+  if (idx < 0)
+    __sync_add_and_fetch(&header->dropped, 1);
+  else
+    __sync_add_and_fetch(&blocks[idx].count, 1);
+}
+
+/* Loops are keyed by the pair of the head and the tail. Different tails of the
+ * same head may collide in the hash, so also compare the tail.
+ */
+static void count_loop(abi_ulong head, abi_ulong tail) {
+  uint64_t key = ((uint64_t) head << 20) ^ tail;
+  unsigned int i, idx;
+  struct loop_entry * entry;
+
+  for (i = 0; i < PROBE_MAX; i++) {
+    idx = (hash_addr(key) + i) & (LOOP_SLOTS - 1);
+    entry = &loops[idx];
+    if (entry->head == 0 &&
+        __sync_bool_compare_and_swap(&entry->head, 0, head)) {
+      entry->tail = tail;
+      __sync_add_and_fetch(&entry->count, 1);
+      return;
+    }
+    /* A concurrently claimed slot may not have its tail written yet, in which
+     * case the count goes to another slot of the same loop.
+     */
+    if (entry->head == head && entry->tail == tail) {
+      __sync_add_and_fetch(&entry->count, 1);
+      return;
+    }
+  }
+  __sync_add_and_fetch(&header->dropped, 1);
+}
+
+void helper_eclipser_log_bb(abi_ulong addr) {
+  abi_ulong prev_addr_local;
+
+  prev_addr_local = prev_addr;
+  prev_addr = addr;
+
+  if (!bbcount_log)
+    return;
+
+  __sync_add_and_fetch(&header->executed, 1);
+  count_block(addr);
+  if (prev_addr_local != 0 && addr <= prev_addr_local)
+    count_loop(addr, prev_addr_local);
+}
@@ -23,6 +23,18 @@
 #define FORKSRV_FD 194
 #define TSL_FD (FORKSRV_FD - 1)
 
+/* Counters of the shared tracer stats page updated by the fork server. The
+ * others are updated by the forked children (cf. eclipser.c). */
+
+#define STAT_EXECS 0
+#define STAT_FORK_NS 1
+#define STAT_EXEC_NS 2
+#define STAT_TSL_REQUESTS 3
+#define STAT_TSL_MIRRORED 4
+
+extern uint64_t * eclipser_stats;
+extern uint64_t eclipser_tb_translated;
+
 extern abi_ulong eclipser_targ_addr;
 extern uint32_t eclipser_targ_index;
 extern int measure_coverage;
@@ -38,7 +50,10 @@ static void afl_forkserver(CPUState*);
 
 static void afl_wait_tsl(CPUState*, int);
 static void afl_request_tsl(target_ulong, target_ulong, uint64_t,
-                            TranslationBlock*, int);
+                            TranslationBlock*, int, int);
+static uint64_t afl_now_ns(void);
+static int afl_read_command(int);
+static int afl_write_command(int);
 
 /* Data structure passed around by the translate handlers: */
 
@@ -60,14 +75,58 @@ struct afl_chain {
  * ACTUAL IMPLEMENTATION *
  *************************/
 
+static uint64_t afl_now_ns(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+}
+
+/* Read the configuration of the next execution, sent by Eclipser. */
+
+static int afl_read_command(int fd) {
+
+  uint64_t tmp_input;
+
+  if (read(fd, &tmp_input, 8) != 8) return 0;
+  eclipser_targ_addr = (abi_ulong)tmp_input;
+  if (read(fd, &eclipser_targ_index, 4) != 4) return 0;
+  if (read(fd, &measure_coverage, 4) != 4) return 0;
+  return 1;
+
+}
+
+/* Relay the configuration of the next execution to the snapshot child. */
+
+static int afl_write_command(int fd) {
+
+  uint64_t tmp_input = eclipser_targ_addr;
+
+  if (write(fd, &tmp_input, 8) != 8) return 0;
+  if (write(fd, &eclipser_targ_index, 4) != 4) return 0;
+  if (write(fd, &measure_coverage, 4) != 4) return 0;
+  return 1;
+
+}
+
+/* Snapshot mode, shared by the tracers (cf. patches-common/). */
+
+#include "afl-qemu-snapshot.h"
+
 /* Fork server logic, invoked once we hit _start. */
 
 static void afl_forkserver(CPUState *cpu) {
 
   static unsigned char tmp[4];
-  uint64_t tmp_input;
+
+  /* The snapshot child resumed from the entry point. */
+  if (afl_snapshot_pid) return;
 
   if (atoi(getenv("ECL_FORK_SERVER")) != 1) return;
+  afl_snapshot_mode = getenv("ECL_SNAPSHOT") != NULL &&
+                      atoi(getenv("ECL_SNAPSHOT")) == 1;
 
   /* Tell the parent that we're alive. If the parent doesn't want
      to talk, assume that we're not running in forkserver mode. */
@@ -76,19 +135,22 @@ static void afl_forkserver(CPUState *cpu) {
 
   afl_forksrv_pid = getpid();
 
+  if (afl_snapshot_mode) {
+    afl_snapshot_server(cpu);
+    return;
+  }
+
   /* All right, let's await orders... */
 
   while (1) {
 
     pid_t child_pid;
     int status, t_fd[2];
+    uint64_t fork_start, fork_end;
 
     /* Whoops, parent dead? */
 
-    if (read(FORKSRV_FD, &tmp_input, 8) != 8) exit(2);
-    eclipser_targ_addr = (abi_ulong)tmp_input;
-    if (read(FORKSRV_FD, &eclipser_targ_index, 4) != 4) exit(2);
-    if (read(FORKSRV_FD, &measure_coverage, 4) != 4) exit(2);
+    if (!afl_read_command(FORKSRV_FD)) exit(2);
 
     /* Establish a channel with child to grab translation commands. We'll
        read from t_fd[0], child will write to TSL_FD. */
@@ -96,6 +158,7 @@ static void afl_forkserver(CPUState *cpu) {
     if (pipe(t_fd) || dup2(t_fd[1], TSL_FD) < 0) exit(3);
     close(t_fd[1]);
 
+    fork_start = afl_now_ns();
     child_pid = fork();
     if (child_pid < 0) exit(4);
 
@@ -104,6 +167,7 @@ static void afl_forkserver(CPUState *cpu) {
       /* Child process. Close descriptors and run free. */
 
       afl_fork_child = 1;
+      eclipser_tb_translated = 0; /* Do not count the fork server's. */
       close(FORKSRV_FD);
       close(FORKSRV_FD + 1);
       close(t_fd[0]);
@@ -113,6 +177,7 @@ static void afl_forkserver(CPUState *cpu) {
 
     /* Parent. */
 
+    fork_end = afl_now_ns();
     close(TSL_FD);
 
     if (write(FORKSRV_FD + 1, &child_pid, 4) != 4) exit(5);
@@ -124,6 +189,15 @@ static void afl_forkserver(CPUState *cpu) {
     /* Get and relay exit status to parent. */
 
     if (waitpid(child_pid, &status, 0) < 0) exit(6);
+
+    if (eclipser_stats) {
+      __sync_fetch_and_add(&eclipser_stats[STAT_EXECS], 1);
+      __sync_fetch_and_add(&eclipser_stats[STAT_FORK_NS],
+                           fork_end - fork_start);
+      __sync_fetch_and_add(&eclipser_stats[STAT_EXEC_NS],
+                           afl_now_ns() - fork_end);
+    }
+
     if (write(FORKSRV_FD + 1, &status, 4) != 4) exit(7);
 
   }
@@ -133,13 +207,17 @@ static void afl_forkserver(CPUState *cpu) {
 /* This code is invoked whenever QEMU decides that it doesn't have a
    translation of a particular block and needs to compute it. When this happens,
    we tell the parent to mirror the operation, so that the next fork() has a
-   cached copy. */
+   cached copy. The translations in the child are counted, since they are the
+   translations that the fork server failed to cache. */
 
 static void afl_request_tsl(target_ulong pc, target_ulong cb, uint64_t flags,
-                            TranslationBlock* last_tb, int tb_exit)  {
+                            TranslationBlock* last_tb, int tb_exit,
+                            int translated)  {
   struct afl_tsl t;
   struct afl_chain c;
 
+  if (translated) eclipser_tb_translated++;
+
   if (!afl_fork_child) return;
 
   t.pc      = pc;
@@ -169,6 +247,7 @@ static void afl_wait_tsl(CPUState *cpu, int fd) {
   struct afl_tsl t;
   struct afl_chain c;
   TranslationBlock *tb, *last_tb;
+  uint64_t requests = 0, mirrored = 0;
 
   while (1) {
 
@@ -178,8 +257,10 @@ static void afl_wait_tsl(CPUState *cpu, int fd) {
       break;
 
     tb = tb_htable_lookup(cpu, t.pc, t.cs_base, t.flags);
+    requests++;
 
     if(!tb) {
+      mirrored++;
       mmap_lock();
       tb_lock();
       tb = tb_gen_code(cpu, t.pc, t.cs_base, t.flags, 0);
@@ -204,4 +285,9 @@ static void afl_wait_tsl(CPUState *cpu, int fd) {
 
   close(fd);
 
+  if (eclipser_stats) {
+    __sync_fetch_and_add(&eclipser_stats[STAT_TSL_REQUESTS], requests);
+    __sync_fetch_and_add(&eclipser_stats[STAT_TSL_MIRRORED], mirrored);
+  }
+
 }
@@ -1,12 +1,14 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <unistd.h>
 #include <signal.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include "qemu/osdep.h"
+#include "elf.h"
 #include "qemu-common.h"
 #include "exec/cpu-common.h"
 #include "tcg/tcg.h"
@@ -19,13 +21,148 @@ typedef uint32_t abi_ulong;
 #endif
 
 extern unsigned int afl_forksrv_pid;
+extern void eclipser_snapshot_abort(int code);
+extern unsigned long guest_base;
+extern int page_check_range(abi_ulong start, abi_ulong len, int flags);
+#ifndef PAGE_READ
+#define PAGE_READ 0x0001 /* Cf. exec/cpu-all.h */
+#endif
+#define GUEST_PAGE_SIZE 4096
 #define FORKSRV_FD 198
 #define TSL_FD (FORKSRV_FD - 1)
 
 #define BITMAP_SIZE (0x10000)
 #define BITMAP_MASK (BITMAP_SIZE - 1)
+#define PATH_HASH_INIT 0xcbf29ce484222325ULL
 #define MAX_TRACE_LEN (100000)
 
+/* Counters in the shared tracer stats page (cf. ECL_TRACER_STATS). Each tracer
+ * owns a slot of STAT_COUNT counters, and the remaining counters of the slot
+ * are updated by the fork server (cf. afl-qemu-cpu-inl.h). Should be updated
+ * along with Executor.fs.
+ */
+#define STAT_COUNT 8
+#define STATS_PAGE_SIZE (2 * STAT_COUNT * sizeof(uint64_t))
+#define STAT_SLOT 1
+#define STAT_TB_TRANSLATED 5
+#define STAT_CMP_LOGGED 6
+#define STAT_TRACE_ABORTS 7
+
+/* Target points to probe in a single execution, when the target address is
+ * MULTI_TARGET_ADDR. Eclipser writes the table sorted by the address, and the
+ * tracer fills in the operands of each target point hit (cf. ECL_BRANCH_TARGETS
+ * and Executor.fs).
+ */
+#define MAX_BRANCH_TARGETS 16
+#define MULTI_TARGET_ADDR ((abi_ulong) -1)
+
+struct branch_target {
+  uint64_t addr;
+  uint64_t index;
+  uint64_t hit;
+  uint64_t type;
+  uint64_t oprnd1;
+  uint64_t oprnd2;
+};
+
+struct branch_target_table {
+  uint64_t count;
+  struct branch_target targets[MAX_BRANCH_TARGETS];
+};
+
+/* In the differential trace mode, where the target address is DIFF_TRACE_ADDR,
+ * the tracer compares the trace with a reference trace written by Eclipser (cf.
+ * ECL_REFERENCE_TRACE), and logs only the records that differ. Each logged
+ * record is preceded by its index in the trace, and the log ends with
+ * DIFF_TRAILER, the length of the trace and the index where the address
+ * sequence diverged from the reference. After the divergence, all the records
+ * are logged.
+ */
+#define DIFF_TRACE_ADDR ((abi_ulong) -2)
+#define DIFF_TRAILER 0xffffffff
+#define REF_RECORD_MAX (sizeof(abi_ulong) + 1 + 2 * sizeof(abi_ulong))
+#define REF_TRACE_SIZE (sizeof(uint64_t) + MAX_TRACE_LEN * REF_RECORD_MAX)
+
+/* Guest threads run as host threads, so each thread logs cmp/test records to
+ * its own trace buffer, and the buffers are merged into the branch log at exit:
+ * the buffer of the main thread (i.e. the one that passed the entry point)
+ * first, and the others in the order they started tracing. Threads beyond
+ * MAX_TRACED_THREADS abort tracing, as the trace limit does.
+ */
+#define MAX_TRACED_THREADS 64
+
+struct thread_trace {
+  uint32_t gen; /* Execution that this buffer belongs to */
+  uint32_t count; /* Number of cmp/test instructions met by the thread */
+  unsigned char * buf;
+  unsigned char * ptr;
+};
+
+/* In the full trace mode and the differential trace mode, each cmp/test site
+ * is logged at most MAX_SITE_LOGS times per execution, so that a hot loop does
+ * not fill up the trace. Since the first visits are logged, the visit index of
+ * a logged record is the same as the hit count used by the targeted modes (cf.
+ * BranchPoint.Idx). In the full trace mode, the total visits of the sites that
+ * exceeded the limit are appended to the log after the trace, as pairs of the
+ * address and a 32-bit count terminated by a zero address. Sites that do not
+ * fit in the table are logged at every visit.
+ */
+#define MAX_SITE_LOGS 256
+#define SITE_SLOTS (1 << 14)
+#define SITE_PROBE_MAX 32
+
+struct site_count {
+  abi_ulong addr;
+  uint32_t visits;
+};
+
+/* Calls to the string comparison functions below are logged as a whole, with
+ * both operands of up to MAX_STRCMP_LEN bytes, so that Eclipser can fill in an
+ * operand at once instead of solving the cmp instructions inside the function
+ * byte by byte. The functions are found by their PLT stubs, or by their symbols
+ * if the binary defines them, when the binary is loaded (cf. elfload.c). Each
+ * call is logged with its return address as the call site. In the full trace
+ * mode and the differential trace mode, the records are appended to the log
+ * after the trace (and the total visits of the sites), terminated by a zero
+ * address. Should be updated along with Executor.fs.
+ */
+#define MAX_STRCMP_HOOKS 64
+#define MAX_STRCMP_LOGS 1024
+#define MAX_STRCMP_LEN 32
+
+#define STRCMP_MEM 0  /* memcmp(s1, s2, n): compare n bytes */
+#define STRCMP_STR 1  /* strcmp(s1, s2): compare up to the NUL */
+#define STRCMP_STRN 2 /* strncmp(s1, s2, n): compare up to the NUL or n bytes */
+
+struct strcmp_func {
+  const char * name;
+  unsigned char kind;
+};
+
+static const struct strcmp_func strcmp_funcs[] = {
+  { "memcmp", STRCMP_MEM },
+  { "bcmp", STRCMP_MEM },
+  { "strcmp", STRCMP_STR },
+  { "strcasecmp", STRCMP_STR },
+  { "strncmp", STRCMP_STRN },
+  { "strncasecmp", STRCMP_STRN },
+};
+
+#define STRCMP_FUNC_COUNT (sizeof(strcmp_funcs) / sizeof(strcmp_funcs[0]))
+
+struct strcmp_hook {
+  abi_ulong addr;
+  unsigned char kind;
+};
+
+struct strcmp_record {
+  abi_ulong site;
+  unsigned char len1;
+  unsigned char len2;
+  unsigned char buf1[MAX_STRCMP_LEN];
+  unsigned char buf2[MAX_STRCMP_LEN];
+};
+
 #define IGNORE_COVERAGE 1
 #define NOCMULATIVE_COVERAGE 2
 #define CUMULATIVE_COVERAGE 3
@@ -37,39 +174,316 @@ void eclipser_detach(void);
 void eclipser_exit(void);
 void eclipser_log_branch(abi_ulong oprnd1, abi_ulong oprnd2, unsigned char type);
 void helper_eclipser_log_bb(abi_ulong addr);
+void helper_eclipser_log_strcmp(abi_ulong sp, abi_ulong arg1, abi_ulong arg2,
+                                abi_ulong arg3);
+void eclipser_load_symbols(int fd, abi_ulong load_bias);
+int eclipser_is_strcmp_hook(abi_ulong addr);
 
 abi_ulong eclipser_entry_point = 0; /* ELF entry point (_start) */
-abi_ulong eclipser_curr_addr = 0;
+__thread abi_ulong eclipser_curr_addr = 0;
 abi_ulong eclipser_targ_addr = 0;
 uint32_t eclipser_targ_index = 0;
 int measure_coverage = 0;
 int eclipser_EP_passed = 0;
 
 static int found_new_edge = 0;
-static int found_new_path = 0; // TODO. Extend to measure path coverage, too.
-static abi_ulong prev_addr = 0;
+/* Hash of the executed block sequence, along with the operands of the cmp/test
+ * instructions and the string comparison calls. Thus, two executions with the
+ * same hash have the same branch trace.
+ */
+static uint64_t path_hash = 0;
+static __thread abi_ulong prev_addr = 0;
 static char * coverage_path = NULL;
 static char * branch_path = NULL;
 static FILE * coverage_fp = NULL;
 static FILE * branch_fp = NULL;
 static unsigned char * edge_bitmap = NULL;
+static uint64_t * stats_page = NULL;
+uint64_t * eclipser_stats = NULL; /* Slot of this tracer in 'stats_page' */
+uint64_t eclipser_tb_translated = 0;
+static int trace_aborted = 0;
 
-unsigned char trace_buffer[MAX_TRACE_LEN * (sizeof(abi_ulong) + sizeof(unsigned char) + 2 * sizeof(abi_ulong)) + 64];
-unsigned char * buf_ptr = trace_buffer;
+unsigned char trace_buffer[MAX_TRACE_LEN * (sizeof(uint32_t) + sizeof(abi_ulong) + sizeof(unsigned char) + 2 * sizeof(abi_ulong)) + 64];
+
+static struct thread_trace thread_traces[MAX_TRACED_THREADS];
+static uint32_t thread_count = 0;
+static uint32_t trace_gen = 0;
+static __thread struct thread_trace * cur_trace = NULL;
 
 static uint32_t targ_hit_count = 0;
-static uint32_t trace_count = 0;
+static uint32_t trace_count = 0; /* Length of the merged trace */
+
+static struct site_count site_counts[SITE_SLOTS];
+static uint32_t site_used[SITE_SLOTS]; /* Indices of the claimed slots */
+static uint32_t site_used_count = 0;
+
+static struct branch_target_table * targ_table = NULL;
+static uint32_t targ_hit_counts[MAX_BRANCH_TARGETS];
+static uint32_t targ_count = 0;
+static uint32_t targ_resolved = 0;
+
+static struct strcmp_hook strcmp_hooks[MAX_STRCMP_HOOKS];
+static uint32_t strcmp_hook_count = 0;
+static struct strcmp_record strcmp_records[MAX_STRCMP_LOGS];
+static uint32_t strcmp_count = 0;
+
+static unsigned char * ref_trace = NULL;
+static unsigned char * ref_ptr = NULL;
+static unsigned char * ref_end = NULL;
+static int diverged = 0;
+static uint32_t diverge_idx = 0;
+static uint32_t diff_logged = 0;
+
+/* Mix 'val' into the path hash. The hash depends on the order of the values, so
+ * that it identifies the sequence of the logged events. Should be kept the same
+ * as the one of the coverage tracer.
+ */
+static void mix_path_hash(uint64_t val) {
+  path_hash = (path_hash ^ val) * 0x9E3779B97F4A7C15ULL;
+  path_hash ^= path_hash >> 32;
+}
+
+/* Return the trace buffer of the current thread, which is allocated when the
+ * thread logs its first cmp/test in this execution. Return NULL if there are
+ * too many threads to trace.
+ */
+static struct thread_trace * get_thread_trace(void) {
+  struct thread_trace * t = cur_trace;
+  uint32_t idx;
 
+  if (t && t->gen == trace_gen)
+    return t;
+
+  idx = __sync_fetch_and_add(&thread_count, 1);
+  if (idx >= MAX_TRACED_THREADS)
+    return NULL;
+
+  t = &thread_traces[idx];
+  if (!t->buf) {
+    if (idx == 0) {
+      t->buf = trace_buffer;
+    } else {
+      t->buf = mmap(NULL, sizeof(trace_buffer), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (t->buf == (void *) -1) {
+        t->buf = NULL;
+        return NULL;
+      }
+    }
+  }
+  t->ptr = t->buf;
+  t->count = 0;
+  __sync_synchronize();
+  t->gen = trace_gen;
+  cur_trace = t;
+  return t;
+}
+
+static size_t get_record_len(unsigned char * record) {
+  return sizeof(abi_ulong) + 1 + 2 * (record[sizeof(abi_ulong)] & 0x3f);
+}
+
+/* Append the records of a thread to the branch log, up to MAX_TRACE_LEN records
+ * in total. In the differential trace mode, the records of the other threads
+ * than the main thread are not compared with the reference trace, so they are
+ * all logged with their indices in the merged trace.
+ */
+static void flush_thread_trace(struct thread_trace * t, int is_main) {
+  int is_diff = eclipser_targ_addr == DIFF_TRACE_ADDR;
+  unsigned char * p = t->buf, * record;
+  uint32_t count = t->count < MAX_TRACE_LEN ? t->count : MAX_TRACE_LEN;
+  uint32_t i;
+  size_t len;
+
+  if (is_main) {
+    fwrite(t->buf, t->ptr - t->buf, 1, branch_fp);
+    trace_count = count;
+    return;
+  }
+
+  for (i = 0; i < count && p < t->ptr; i++) {
+    if (trace_count >= MAX_TRACE_LEN) {
+      trace_aborted = 1;
+      break;
+    }
+    record = is_diff ? p + sizeof(uint32_t) : p;
+    len = (record - p) + get_record_len(record);
+    if (is_diff)
+      * (uint32_t*) p = trace_count;
+    fwrite(p, len, 1, branch_fp);
+    p += len;
+    trace_count++;
+  }
+
+  if (is_diff && i > 0 && !diverged) {
+    diverged = 1;
+    diverge_idx = thread_traces[0].count;
+  }
+}
+
+/* Merge the trace buffers of the threads into the branch log. */
 void flush_trace_buffer(void) {
-  size_t len = buf_ptr - trace_buffer;
-  fwrite(trace_buffer, len, 1, branch_fp);
+  uint32_t i, n = thread_count;
+  struct thread_trace * t;
+
+  trace_count = 0;
+  if (n > MAX_TRACED_THREADS) {
+    n = MAX_TRACED_THREADS;
+    trace_aborted = 1;
+  }
+
+  for (i = 0; i < n; i++) {
+    t = &thread_traces[i];
+    if (t->gen == trace_gen && t->buf)
+      flush_thread_trace(t, i == 0);
+  }
+}
+
+static uint32_t hash_site(abi_ulong addr) {
+  return (uint32_t) (addr ^ (addr >> 15)) * 2654435761U;
+}
+
+/* Find the visit counter of a site, claiming a slot on its first visit. The
+ * slots are shared by the guest threads, so claim them atomically.
+ */
+static struct site_count * find_site(abi_ulong addr) {
+  uint32_t i, idx;
+  abi_ulong old_addr;
+
+  for (i = 0; i < SITE_PROBE_MAX; i++) {
+    idx = (hash_site(addr) + i) & (SITE_SLOTS - 1);
+    old_addr = site_counts[idx].addr;
+    if (old_addr == 0) {
+      old_addr = __sync_val_compare_and_swap(&site_counts[idx].addr, 0, addr);
+      if (old_addr == 0) {
+        site_used[__sync_fetch_and_add(&site_used_count, 1)] = idx;
+        return &site_counts[idx];
+      }
+    }
+    if (old_addr == addr)
+      return &site_counts[idx];
+  }
+  return NULL;
+}
+
+/* Count a visit to the current site, and check if it should be logged. */
+static int sample_site(void) {
+  struct site_count * site = find_site(eclipser_curr_addr);
+
+  return !site || __sync_add_and_fetch(&site->visits, 1) <= MAX_SITE_LOGS;
+}
+
+static void reset_site_counts(void) {
+  uint32_t i;
+
+  for (i = 0; i < site_used_count; i++) {
+    site_counts[site_used[i]].addr = 0;
+    site_counts[site_used[i]].visits = 0;
+  }
+  site_used_count = 0;
+}
+
+static void write_site_visits(void) {
+  abi_ulong nil = 0;
+  struct site_count * site;
+  uint32_t i;
+
+  for (i = 0; i < site_used_count; i++) {
+    site = &site_counts[site_used[i]];
+    if (site->visits > MAX_SITE_LOGS) {
+      fwrite(&site->addr, sizeof(abi_ulong), 1, branch_fp);
+      fwrite(&site->visits, sizeof(uint32_t), 1, branch_fp);
+    }
+  }
+  fwrite(&nil, sizeof(abi_ulong), 1, branch_fp);
+}
+
+static void write_strcmp_records(void) {
+  abi_ulong nil = 0;
+  struct strcmp_record * record;
+  uint32_t i, n = strcmp_count;
+
+  if (n > MAX_STRCMP_LOGS)
+    n = MAX_STRCMP_LOGS;
+
+  for (i = 0; i < n; i++) {
+    record = &strcmp_records[i];
+    fwrite(&record->site, sizeof(abi_ulong), 1, branch_fp);
+    fwrite(&record->len1, 1, 1, branch_fp);
+    fwrite(&record->len2, 1, 1, branch_fp);
+    fwrite(record->buf1, record->len1, 1, branch_fp);
+    fwrite(record->buf2, record->len2, 1, branch_fp);
+  }
+  fwrite(&nil, sizeof(abi_ulong), 1, branch_fp);
+}
+
+/* Accumulate the counters of this execution to the shared stats page. Called
+ * once per execution, to avoid contention on the page between the tracers.
+ */
+static void flush_stats(void) {
+  uint64_t cmp_logged;
+
+  if (!eclipser_stats)
+    return;
+
+  if (eclipser_targ_addr == MULTI_TARGET_ADDR)
+    cmp_logged = targ_resolved;
+  else if (eclipser_targ_addr == DIFF_TRACE_ADDR)
+    cmp_logged = diff_logged;
+  else if (eclipser_targ_addr)
+    cmp_logged = (targ_hit_count >= eclipser_targ_index);
+  else
+    cmp_logged = trace_count < MAX_TRACE_LEN ? trace_count : MAX_TRACE_LEN;
+
+  __sync_fetch_and_add(&eclipser_stats[STAT_TB_TRANSLATED],
+                       eclipser_tb_translated);
+  __sync_fetch_and_add(&eclipser_stats[STAT_CMP_LOGGED], cmp_logged);
+  __sync_fetch_and_add(&eclipser_stats[STAT_TRACE_ABORTS], trace_aborted);
+  eclipser_tb_translated = 0;
 }
 
 void eclipser_setup_before_forkserver(void) {
   char * bitmap_path = getenv("ECL_BITMAP_LOG");
+  char * stats_path;
+  char * targets_path, * ref_path;
+  int stats_fd, targets_fd, ref_fd;
   int bitmap_fd = open(bitmap_path, O_RDWR | O_CREAT, 0644);
   edge_bitmap = (unsigned char*) mmap(NULL, BITMAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, bitmap_fd, 0);
   assert(edge_bitmap != (void *) -1);
+  close(bitmap_fd);
+
+  /* Tracer statistics are optional, so just ignore the failure. */
+  stats_path = getenv("ECL_TRACER_STATS");
+  if (stats_path != NULL && (stats_fd = open(stats_path, O_RDWR)) >= 0) {
+    stats_page = (uint64_t*) mmap(NULL, STATS_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, stats_fd, 0);
+    if (stats_page == (void *) -1)
+      stats_page = NULL;
+    else
+      eclipser_stats = stats_page + STAT_SLOT * STAT_COUNT;
+    close(stats_fd);
+  }
+
+  /* Without the target table, multi-target probing does not observe any. */
+  targets_path = getenv("ECL_BRANCH_TARGETS");
+  if (targets_path != NULL && (targets_fd = open(targets_path, O_RDWR)) >= 0) {
+    targ_table = (struct branch_target_table*)
+      mmap(NULL, sizeof(struct branch_target_table), PROT_READ | PROT_WRITE,
+           MAP_SHARED, targets_fd, 0);
+    if (targ_table == (void *) -1)
+      targ_table = NULL;
+    close(targets_fd);
+  }
+
+  /* Without the reference trace, the differential trace mode logs all. */
+  ref_path = getenv("ECL_REFERENCE_TRACE");
+  if (ref_path != NULL && (ref_fd = open(ref_path, O_RDONLY)) >= 0) {
+    ref_trace = (unsigned char*) mmap(NULL, REF_TRACE_SIZE, PROT_READ,
+                                      MAP_SHARED, ref_fd, 0);
+    if (ref_trace == (void *) -1)
+      ref_trace = NULL;
+    close(ref_fd);
+  }
 
   coverage_path = getenv("ECL_COVERAGE_LOG");
   branch_path = getenv("ECL_BRANCH_LOG");
@@ -78,15 +492,61 @@ void eclipser_setup_before_forkserver(void) {
 }
 
 void eclipser_setup_after_forkserver(void) {
+  uint32_t i;
+  uint64_t ref_len;
+
+  // Reset the states of the previous execution, in the snapshot mode where a
+  // process runs multiple executions (cf. afl-qemu-cpu-inl.h).
+  found_new_edge = 0;
+  path_hash = PATH_HASH_INIT;
+  prev_addr = 0;
+  targ_hit_count = 0;
+  trace_count = 0;
+  trace_aborted = 0;
+  targ_count = 0;
+  targ_resolved = 0;
+  diverged = 0;
+  diverge_idx = 0;
+  diff_logged = 0;
+  strcmp_count = 0;
+  reset_site_counts();
+
+  // Start a new generation of trace buffers, and register the main thread
+  // first. Only this thread survives from the previous execution.
+  trace_gen++;
+  thread_count = 0;
+  cur_trace = NULL;
+  get_thread_trace();
 
   assert(getenv("ECL_FORK_SERVER") != NULL);
   // If fork server is enabled, the following data are set during the handshake.
   if (atoi(getenv("ECL_FORK_SERVER")) == 0) {
-    eclipser_targ_addr = strtol(getenv("ECL_BRANCH_ADDR"), NULL, 16);
+    eclipser_targ_addr = strtoull(getenv("ECL_BRANCH_ADDR"), NULL, 16);
     eclipser_targ_index = strtol(getenv("ECL_BRANCH_IDX"), NULL, 16);
     measure_coverage = atoi(getenv("ECL_MEASURE_COV"));
   }
 
+  if (eclipser_targ_addr == MULTI_TARGET_ADDR && targ_table) {
+    targ_count = targ_table->count;
+    if (targ_count > MAX_BRANCH_TARGETS)
+      targ_count = MAX_BRANCH_TARGETS;
+    memset(targ_hit_counts, 0, sizeof(targ_hit_counts));
+    for (i = 0; i < targ_count; i++)
+      targ_table->targets[i].hit = 0;
+  }
+
+  if (eclipser_targ_addr == DIFF_TRACE_ADDR) {
+    if (ref_trace) {
+      ref_len = *(uint64_t *) ref_trace;
+      if (ref_len > REF_TRACE_SIZE - sizeof(uint64_t))
+        ref_len = REF_TRACE_SIZE - sizeof(uint64_t);
+      ref_ptr = ref_trace + sizeof(uint64_t);
+      ref_end = ref_ptr + ref_len;
+    } else {
+      diverged = 1;
+    }
+  }
+
   if (measure_coverage != IGNORE_COVERAGE) {
     coverage_fp = fopen(coverage_path, "w");
     assert(coverage_fp != NULL);
@@ -117,10 +577,27 @@ void eclipser_detach(void) {
     munmap(edge_bitmap, BITMAP_SIZE);
     edge_bitmap = NULL;
   }
+
+  if (stats_page) {
+    munmap(stats_page, STATS_PAGE_SIZE);
+    stats_page = NULL;
+    eclipser_stats = NULL;
+  }
+
+  if (targ_table) {
+    munmap(targ_table, sizeof(struct branch_target_table));
+    targ_table = NULL;
+  }
+
+  if (ref_trace) {
+    munmap(ref_trace, REF_TRACE_SIZE);
+    ref_trace = NULL;
+  }
 }
 
 void eclipser_exit(void) {
   abi_ulong nil = 0;
+  uint32_t trailer[3];
   sigset_t mask;
 
   // Block signals, since we register signal handler that calls eclipser_exit()
@@ -130,14 +607,27 @@ void eclipser_exit(void) {
     return;
 
   if (coverage_fp) {
-    fprintf(coverage_fp, "%d\n%d\n", found_new_edge, found_new_path);
+    fprintf(coverage_fp, "%d\n%016llx\n", found_new_edge,
+            (unsigned long long) path_hash);
     fclose(coverage_fp);
     coverage_fp = NULL;
   }
 
   if (branch_fp) {
     flush_trace_buffer();
-    fwrite(&nil, sizeof(abi_ulong), 1, branch_fp);
+    if (eclipser_targ_addr == DIFF_TRACE_ADDR) {
+      trailer[0] = DIFF_TRAILER;
+      trailer[1] = trace_count < MAX_TRACE_LEN ? trace_count : MAX_TRACE_LEN;
+      trailer[2] = diverged ? diverge_idx : trailer[1];
+      fwrite(trailer, sizeof(trailer), 1, branch_fp);
+      write_strcmp_records();
+    } else {
+      fwrite(&nil, sizeof(abi_ulong), 1, branch_fp);
+      if (!eclipser_targ_addr) {
+        write_site_visits();
+        write_strcmp_records();
+      }
+    }
     fclose(branch_fp);
     branch_fp = NULL;
   }
@@ -146,6 +636,23 @@ void eclipser_exit(void) {
     munmap(edge_bitmap, BITMAP_SIZE);
     edge_bitmap = NULL;
   }
+
+  flush_stats();
+  if (stats_page) {
+    munmap(stats_page, STATS_PAGE_SIZE);
+    stats_page = NULL;
+    eclipser_stats = NULL;
+  }
+
+  if (targ_table) {
+    munmap(targ_table, sizeof(struct branch_target_table));
+    targ_table = NULL;
+  }
+
+  if (ref_trace) {
+    munmap(ref_trace, REF_TRACE_SIZE);
+    ref_trace = NULL;
+  }
 }
 
 /* Recall that in 64bit we already pushed rdi/rsi/rdx before calling
@@ -171,50 +678,188 @@ asm (".global eclipser_trampoline                         \t\n\
       .size eclipser_trampoline, . - eclipser_trampoline  \t\n\
       ");
 
+/* Truncate the operands of a cmp/test to its operand size, and return the size
+ * in bytes.
+ */
+static unsigned char truncate_operands(unsigned char operand_type,
+                                       abi_ulong * oprnd1, abi_ulong * oprnd2)
+{
+  if (operand_type == MO_8) {
+    *oprnd1 &= 0xff;
+    *oprnd2 &= 0xff;
+    return 1;
+  } else if (operand_type == MO_16) {
+    *oprnd1 &= 0xffff;
+    *oprnd2 &= 0xffff;
+    return 2;
+  }
+#ifdef TARGET_X86_64
+  else if (operand_type == MO_32) {
+    *oprnd1 &= 0xffffffff;
+    *oprnd2 &= 0xffffffff;
+    return 4;
+  } else if (operand_type == MO_64) {
+    return 8;
+  }
+#else
+  else if (operand_type == MO_32) {
+    return 4;
+  }
+#endif
+  assert(0);
+  return 0;
+}
+
+/* Return the index of the first target point at 'addr' in the target table,
+ * which is sorted by the address.
+ */
+static uint32_t find_branch_target(abi_ulong addr) {
+  uint32_t lo = 0, hi = targ_count, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (targ_table->targets[mid].addr < addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Record the operands to the target points at the current address, if this is
+ * the hit of the target index. Once all the target points are observed and the
+ * coverage is not measured, halt the execution as in the single target mode.
+ */
+static void log_branch_targets(abi_ulong oprnd1, abi_ulong oprnd2,
+                               unsigned char type)
+{
+  struct branch_target * targ;
+  unsigned char operand_size;
+  uint32_t i, resolved = 0;
+
+  if (!targ_count ||
+      eclipser_curr_addr < targ_table->targets[0].addr ||
+      eclipser_curr_addr > targ_table->targets[targ_count - 1].addr)
+    return;
+
+  for (i = find_branch_target(eclipser_curr_addr); i < targ_count; i++) {
+    targ = &targ_table->targets[i];
+    if (targ->addr != eclipser_curr_addr)
+      break;
+    // Index starts from 1.
+    if (__sync_add_and_fetch(&targ_hit_counts[i], 1) != targ->index)
+      continue;
+    operand_size = truncate_operands(type & 0x3f, &oprnd1, &oprnd2);
+    targ->type = (type & 0xc0) | operand_size;
+    targ->oprnd1 = oprnd1;
+    targ->oprnd2 = oprnd2;
+    targ->hit = 1;
+    resolved++;
+  }
+
+  if (resolved &&
+      __sync_add_and_fetch(&targ_resolved, resolved) == targ_count &&
+      !coverage_fp) {
+    eclipser_exit();
+    eclipser_snapshot_abort(0);
+    exit(0);
+  }
+}
+
+/* Compare the record of the current cmp/test with the next record of the
+ * reference trace, and log it with its index only if it differs. Once the
+ * address differs, the traces cannot be aligned anymore, so stop comparing.
+ */
+static void log_branch_diff(abi_ulong oprnd1, abi_ulong oprnd2,
+                            unsigned char type)
+{
+  struct thread_trace * t = get_thread_trace();
+  unsigned char * record;
+  unsigned char operand_size;
+  size_t record_len, ref_record_len;
+  int same = 0;
+
+  if (!sample_site())
+    return;
+
+  if (!t || t->count >= MAX_TRACE_LEN) {
+    /* Trace limit has exceeded, stop logging as in the full trace mode. */
+    trace_aborted = 1;
+    return;
+  }
+
+  record = t->ptr + sizeof(uint32_t);
+  operand_size = truncate_operands(type & 0x3f, &oprnd1, &oprnd2);
+  * (abi_ulong*) record = eclipser_curr_addr;
+  record[sizeof(abi_ulong)] = (type & 0xc0) | operand_size;
+  memcpy(record + sizeof(abi_ulong) + 1, &oprnd1, operand_size);
+  memcpy(record + sizeof(abi_ulong) + 1 + operand_size, &oprnd2, operand_size);
+  record_len = sizeof(abi_ulong) + 1 + 2 * operand_size;
+
+  /* The reference trace is compared with the main thread only. */
+  if (t != &thread_traces[0]) {
+    t->ptr += sizeof(uint32_t) + record_len;
+    t->count++;
+    return;
+  }
+
+  if (!diverged) {
+    if (ref_ptr + sizeof(abi_ulong) < ref_end &&
+        * (abi_ulong*) ref_ptr == eclipser_curr_addr) {
+      ref_record_len = get_record_len(ref_ptr);
+      same = ref_record_len == record_len &&
+             ref_ptr + ref_record_len <= ref_end &&
+             memcmp(ref_ptr, record, record_len) == 0;
+      ref_ptr += ref_record_len;
+    } else {
+      diverged = 1;
+      diverge_idx = t->count;
+    }
+  }
+
+  if (!same) {
+    * (uint32_t*) t->ptr = t->count;
+    t->ptr += sizeof(uint32_t) + record_len;
+    diff_logged++;
+  }
+  t->count++;
+}
+
 void eclipser_log_branch(abi_ulong oprnd1, abi_ulong oprnd2, unsigned char type) 
 {
   abi_ulong oprnd1_truncated, oprnd2_truncated;
   unsigned char operand_type = type & 0x3f;
   unsigned char compare_type = type & 0xc0;
   unsigned char operand_size;
+  unsigned char * buf_ptr;
+  struct thread_trace * t;
+  uint64_t mask;
 
   if (!branch_fp)
     return;
 
-  if (eclipser_targ_addr) {
-    /* We're in the mode that traces cmp/test at a specific address */
-    if (eclipser_curr_addr == eclipser_targ_addr &&
-        ++targ_hit_count == eclipser_targ_index) { // Index starts from 1.
-      if (operand_type == MO_8) {
-        oprnd1_truncated = oprnd1 & 0xff;
-        oprnd2_truncated = oprnd2 & 0xff;
-        operand_size = 1;
-      } else if (operand_type == MO_16) {
-        oprnd1_truncated = oprnd1 & 0xffff;
-        oprnd2_truncated = oprnd2 & 0xffff;
-        operand_size = 2;
-      }
-#ifdef TARGET_X86_64
-      else if (operand_type == MO_32) {
-        oprnd1_truncated = oprnd1 & 0xffffffff;
-        oprnd2_truncated = oprnd2 & 0xffffffff;
-        operand_size = 4;
-      } else if (operand_type == MO_64) {
-        oprnd1_truncated = oprnd1;
-        oprnd2_truncated = oprnd2;
-        operand_size = 8;
-      }
-#else
-      else if (operand_type == MO_32) {
-        oprnd1_truncated = oprnd1;
-        oprnd2_truncated = oprnd2;
-        operand_size = 4;
-      }
-#endif
-      else {
-        assert(0);
-      }
+  if (coverage_fp) {
+    /* Only the bits within the operand size are logged in the trace. */
+    mask = operand_type == MO_64 ? ~0ULL : (1ULL << (8 << operand_type)) - 1;
+    mix_path_hash(((uint64_t) eclipser_curr_addr << 8) ^ type);
+    mix_path_hash(oprnd1 & mask);
+    mix_path_hash(oprnd2 & mask);
+  }
 
+  if (eclipser_targ_addr == MULTI_TARGET_ADDR) {
+    /* We're in the mode that traces cmp/test at multiple target points */
+    log_branch_targets(oprnd1, oprnd2, type);
+  } else if (eclipser_targ_addr == DIFF_TRACE_ADDR) {
+    /* We're in the mode that traces the difference from a reference trace */
+    log_branch_diff(oprnd1, oprnd2, type);
+  } else if (eclipser_targ_addr) {
+    /* We're in the mode that traces cmp/test at a specific address */
+    if (eclipser_curr_addr == eclipser_targ_addr && // Index starts from 1.
+        __sync_add_and_fetch(&targ_hit_count, 1) == eclipser_targ_index) {
+      oprnd1_truncated = oprnd1;
+      oprnd2_truncated = oprnd2;
+      operand_size = truncate_operands(operand_type, &oprnd1_truncated,
+                                       &oprnd2_truncated);
       type = compare_type | operand_size;
       fwrite(&eclipser_curr_addr, sizeof(abi_ulong), 1, branch_fp);
       fwrite(&type, sizeof(unsigned char), 1, branch_fp);
@@ -227,12 +872,19 @@ void eclipser_log_branch(abi_ulong oprnd1, abi_ulong oprnd2, unsigned char type)
          * coverage gain. In these case, halt the execution here to save time.
          */
         eclipser_exit();
+        eclipser_snapshot_abort(0);
         exit(0);
       }
     }
-  } else if (trace_count++ < MAX_TRACE_LEN) {
+  } else if (!sample_site()) {
+    /* We're in the mode that traces all the cmp/test instructions, and this
+     * site has been logged enough. */
+    return;
+  } else if ((t = get_thread_trace()) && t->count < MAX_TRACE_LEN) {
     /* We're in the mode that traces all the cmp/test instructions */
+    t->count++;
     // First log the current address.
+    buf_ptr = t->ptr;
     * (abi_ulong*) buf_ptr = eclipser_curr_addr;
     buf_ptr += sizeof(abi_ulong);
     if (operand_type == MO_8) {
@@ -299,12 +951,12 @@ void eclipser_log_branch(abi_ulong oprnd1, abi_ulong oprnd2, unsigned char type)
     else {
       assert(0);
     }
-
+    t->ptr = buf_ptr;
   } else {
     /* We're in the mode that traces all the cmp/test instructions, and trace
-     * limit has exceeded. Abort tracing. */
-    eclipser_exit();
-    exit(0);
+     * limit has exceeded (or too many threads to trace). Stop logging, but let
+     * the execution finish for its exit signal and coverage. */
+    trace_aborted = 1;
   }
 }
 
@@ -323,6 +975,8 @@ void helper_eclipser_log_bb(abi_ulong addr) {
   if (!coverage_fp || !edge_bitmap)
     return;
 
+  mix_path_hash(addr);
+
 #ifdef TARGET_X86_64
   edge = (prev_addr_local << 16) ^ addr;
 #else
@@ -336,9 +990,329 @@ void helper_eclipser_log_bb(abi_ulong addr) {
   old_byte = edge_bitmap[byte_idx];
   new_byte = old_byte | byte_mask;
   if (old_byte != new_byte) {
-    found_new_edge = 1;
     if (measure_coverage == CUMULATIVE_COVERAGE) {
-      edge_bitmap[byte_idx] = new_byte;
+      // The bitmap is shared by the tracers of all the fuzzing workers, so set
+      // the bit atomically and claim the edge only if this process set it.
+      old_byte = __sync_fetch_and_or(&edge_bitmap[byte_idx], byte_mask);
+      if (!(old_byte & byte_mask))
+        found_new_edge = 1;
+    } else {
+      found_new_edge = 1;
     }
   }
 }
+
+/* Functions to find the string comparison functions in the binary. */
+
+#ifdef TARGET_X86_64
+typedef Elf64_Ehdr elf_ehdr;
+typedef Elf64_Shdr elf_shdr;
+typedef Elf64_Sym elf_sym;
+#define REL_SYM(info) ((info) >> 32)
+#define REL_TYPE(info) ((info) & 0xffffffff)
+#define ENDBR_LAST 0xfa /* endbr64 */
+#else
+typedef Elf32_Ehdr elf_ehdr;
+typedef Elf32_Shdr elf_shdr;
+typedef Elf32_Sym elf_sym;
+#define REL_SYM(info) ((info) >> 8)
+#define REL_TYPE(info) ((info) & 0xff)
+#define ENDBR_LAST 0xfb /* endbr32 */
+#endif
+#define JUMP_SLOT 7 /* R_X86_64_JUMP_SLOT and R_386_JMP_SLOT */
+
+/* GOT slot of a string comparison function, to find its PLT stub. */
+struct strcmp_slot {
+  abi_ulong got_addr;
+  unsigned char kind;
+};
+
+static void * read_at(int fd, off_t offset, size_t size) {
+  void * buf = malloc(size);
+
+  if (buf && pread(fd, buf, size, offset) != (ssize_t) size) {
+    free(buf);
+    buf = NULL;
+  }
+  return buf;
+}
+
+static int find_strcmp_func(const char * strtab, size_t strtab_size,
+                            uint32_t name) {
+  unsigned int i;
+
+  if (name >= strtab_size)
+    return -1;
+  for (i = 0; i < STRCMP_FUNC_COUNT; i++) {
+    if (strncmp(strtab + name, strcmp_funcs[i].name, strtab_size - name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+static void add_strcmp_hook(abi_ulong addr, unsigned char kind) {
+  if (strcmp_hook_count < MAX_STRCMP_HOOKS) {
+    strcmp_hooks[strcmp_hook_count].addr = addr;
+    strcmp_hooks[strcmp_hook_count].kind = kind;
+    strcmp_hook_count++;
+  }
+}
+
+/* Hook the functions defined in the binary. IFUNC symbols are not hooked, since
+ * they point to the resolver.
+ */
+static void hook_symbols(int fd, elf_shdr * symtab, elf_shdr * strtab_hdr,
+                         abi_ulong load_bias) {
+  elf_sym * syms = read_at(fd, symtab->sh_offset, symtab->sh_size);
+  char * strtab = read_at(fd, strtab_hdr->sh_offset, strtab_hdr->sh_size);
+  size_t i, n = symtab->sh_size / sizeof(elf_sym);
+  int func;
+
+  for (i = 0; syms && strtab && i < n; i++) {
+    if ((syms[i].st_info & 0xf) != STT_FUNC ||
+        syms[i].st_shndx == SHN_UNDEF || syms[i].st_value == 0)
+      continue;
+    func = find_strcmp_func(strtab, strtab_hdr->sh_size, syms[i].st_name);
+    if (func >= 0)
+      add_strcmp_hook(syms[i].st_value + load_bias, strcmp_funcs[func].kind);
+  }
+  free(syms);
+  free(strtab);
+}
+
+/* Collect the GOT slots of the functions from the PLT relocations, which refer
+ * to the dynamic symbol table. Returns the number of slots found.
+ */
+static uint32_t find_strcmp_slots(int fd, elf_shdr * rel, elf_shdr * shdrs,
+                                  struct strcmp_slot * slots) {
+  elf_shdr * dynsym = &shdrs[rel->sh_link];
+  elf_shdr * strtab_hdr = &shdrs[dynsym->sh_link];
+  size_t entsize;
+  elf_sym * syms = read_at(fd, dynsym->sh_offset, dynsym->sh_size);
+  char * strtab = read_at(fd, strtab_hdr->sh_offset, strtab_hdr->sh_size);
+  unsigned char * rels = read_at(fd, rel->sh_offset, rel->sh_size);
+  size_t i, n, sym;
+  abi_ulong offset, info;
+  uint32_t count = 0;
+  int func;
+
+#ifdef TARGET_X86_64
+  entsize = rel->sh_type == SHT_RELA ? sizeof(Elf64_Rela) : sizeof(Elf64_Rel);
+#else
+  entsize = rel->sh_type == SHT_RELA ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel);
+#endif
+  n = rel->sh_size / entsize;
+
+  for (i = 0; syms && strtab && rels && i < n; i++) {
+    /* Both Rel and Rela start with the offset and the info. */
+    offset = * (abi_ulong *) (rels + i * entsize);
+    info = * (abi_ulong *) (rels + i * entsize + sizeof(abi_ulong));
+    sym = REL_SYM(info);
+    if (REL_TYPE(info) != JUMP_SLOT ||
+        sym >= dynsym->sh_size / sizeof(elf_sym) ||
+        count >= MAX_STRCMP_HOOKS)
+      continue;
+    func = find_strcmp_func(strtab, strtab_hdr->sh_size, syms[sym].st_name);
+    if (func >= 0) {
+      slots[count].got_addr = offset;
+      slots[count].kind = strcmp_funcs[func].kind;
+      count++;
+    }
+  }
+  free(syms);
+  free(strtab);
+  free(rels);
+  return count;
+}
+
+/* Find the PLT stubs that jump through the GOT slots. A stub jumps with 'jmp
+ * *slot(%rip)' in x86-64, and with 'jmp *slot' or 'jmp *offset(%ebx)' (where
+ * %ebx holds the address of .got.plt) in x86. The jump may have a 'bnd' prefix
+ * and be preceded by 'endbr', in which case the stub starts at 'endbr'.
+ */
+static void hook_plt_stubs(int fd, elf_shdr * plt, abi_ulong got_plt,
+                           struct strcmp_slot * slots, uint32_t slot_count,
+                           abi_ulong load_bias) {
+  unsigned char * code = read_at(fd, plt->sh_offset, plt->sh_size);
+  size_t i, start;
+  abi_ulong target;
+  int32_t disp;
+  uint32_t j;
+
+  for (i = 0; code && i + 6 <= plt->sh_size; i++) {
+    if (code[i] != 0xff)
+      continue;
+    memcpy(&disp, code + i + 2, sizeof(disp));
+#ifdef TARGET_X86_64
+    if (code[i + 1] != 0x25)
+      continue;
+    target = plt->sh_addr + i + 6 + disp;
+#else
+    if (code[i + 1] == 0x25)
+      target = (abi_ulong) disp;
+    else if (code[i + 1] == 0xa3)
+      target = got_plt + disp;
+    else
+      continue;
+#endif
+    start = i > 0 && code[i - 1] == 0xf2 ? i - 1 : i;
+    if (start >= 4 && code[start - 4] == 0xf3 && code[start - 3] == 0x0f &&
+        code[start - 2] == 0x1e && code[start - 1] == ENDBR_LAST)
+      start -= 4;
+    for (j = 0; j < slot_count; j++) {
+      if (slots[j].got_addr == target)
+        add_strcmp_hook(plt->sh_addr + start + load_bias, slots[j].kind);
+    }
+  }
+  free(code);
+}
+
+/* Called by elfload.c when the binary (not the interpreter) is loaded. */
+void eclipser_load_symbols(int fd, abi_ulong load_bias) {
+  elf_ehdr ehdr;
+  elf_shdr * shdrs, * names_hdr;
+  char * names = NULL;
+  struct strcmp_slot slots[MAX_STRCMP_HOOKS];
+  uint32_t slot_count = 0;
+  abi_ulong got_plt = 0;
+  unsigned int i;
+
+  if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+      ehdr.e_shentsize != sizeof(elf_shdr) || ehdr.e_shstrndx >= ehdr.e_shnum)
+    return;
+  shdrs = read_at(fd, ehdr.e_shoff, ehdr.e_shnum * sizeof(elf_shdr));
+  if (!shdrs)
+    return;
+
+  names_hdr = &shdrs[ehdr.e_shstrndx];
+  names = read_at(fd, names_hdr->sh_offset, names_hdr->sh_size);
+
+  for (i = 0; i < ehdr.e_shnum; i++) {
+    if (shdrs[i].sh_link >= ehdr.e_shnum)
+      continue;
+    if (shdrs[i].sh_type == SHT_SYMTAB || shdrs[i].sh_type == SHT_DYNSYM)
+      hook_symbols(fd, &shdrs[i], &shdrs[shdrs[i].sh_link], load_bias);
+    else if ((shdrs[i].sh_type == SHT_RELA || shdrs[i].sh_type == SHT_REL) &&
+             shdrs[shdrs[i].sh_link].sh_type == SHT_DYNSYM &&
+             shdrs[shdrs[shdrs[i].sh_link].sh_link].sh_type == SHT_STRTAB)
+      slot_count += find_strcmp_slots(fd, &shdrs[i], shdrs,
+                                      slots + slot_count);
+    if (names && shdrs[i].sh_name < names_hdr->sh_size &&
+        strcmp(names + shdrs[i].sh_name, ".got.plt") == 0)
+      got_plt = shdrs[i].sh_addr;
+  }
+
+  for (i = 0; names && slot_count && i < ehdr.e_shnum; i++) {
+    if ((shdrs[i].sh_flags & SHF_EXECINSTR) &&
+        shdrs[i].sh_name < names_hdr->sh_size &&
+        strncmp(names + shdrs[i].sh_name, ".plt", 4) == 0)
+      hook_plt_stubs(fd, &shdrs[i], got_plt, slots, slot_count, load_bias);
+  }
+
+  free(names);
+  free(shdrs);
+}
+
+/* Called by translate.c, to instrument the entry of the hooked functions. */
+int eclipser_is_strcmp_hook(abi_ulong addr) {
+  uint32_t i;
+
+  for (i = 0; i < strcmp_hook_count; i++) {
+    if (strcmp_hooks[i].addr == addr)
+      return 1;
+  }
+  return 0;
+}
+
+/* Return the length of the readable prefix of the guest buffer at 'addr', up to
+ * 'n' bytes. The arguments of a comparison call are not validated by the guest
+ * yet, and a buffer may run into an unmapped page.
+ */
+static size_t readable_len(abi_ulong addr, size_t n) {
+  size_t len = 0, chunk;
+
+  while (len < n) {
+    chunk = GUEST_PAGE_SIZE - ((addr + len) & (GUEST_PAGE_SIZE - 1));
+    if (chunk > n - len)
+      chunk = n - len;
+    if (page_check_range(addr + len, chunk, PAGE_READ) != 0)
+      break;
+    len += chunk;
+  }
+  return len;
+}
+
+/* Log the operands of the call at the beginning of the hooked function, where
+ * the return address is on the top of the stack. In x86, the arguments are on
+ * the stack as well, instead of the registers.
+ */
+void helper_eclipser_log_strcmp(abi_ulong sp, abi_ulong arg1, abi_ulong arg2,
+                                abi_ulong arg3) {
+  abi_ulong * stack = (abi_ulong *) (uintptr_t) (sp + guest_base);
+  struct strcmp_record * record;
+  unsigned char kind = STRCMP_MEM;
+  const char * s1, * s2;
+  size_t n = MAX_STRCMP_LEN, n1, n2;
+  uint32_t i, idx;
+#ifdef TARGET_X86_64
+  size_t stack_len = sizeof(abi_ulong); /* Return address */
+#else
+  size_t stack_len = 4 * sizeof(abi_ulong); /* Also the arguments */
+#endif
+
+  if (!branch_fp ||
+      (eclipser_targ_addr && eclipser_targ_addr != DIFF_TRACE_ADDR))
+    return;
+
+  if (readable_len(sp, stack_len) < stack_len)
+    return;
+
+  for (i = 0; i < strcmp_hook_count; i++) {
+    if (strcmp_hooks[i].addr == eclipser_curr_addr)
+      kind = strcmp_hooks[i].kind;
+  }
+
+#ifndef TARGET_X86_64
+  arg1 = stack[1];
+  arg2 = stack[2];
+  arg3 = stack[3];
+#endif
+  if (kind != STRCMP_STR && arg3 < n)
+    n = arg3;
+  if (n == 0 || !arg1 || !arg2)
+    return;
+
+  /* Log only the readable prefix of each buffer. */
+  n1 = readable_len(arg1, n);
+  n2 = readable_len(arg2, n);
+  if (n1 == 0 || n2 == 0)
+    return;
+
+  idx = __sync_fetch_and_add(&strcmp_count, 1);
+  if (idx >= MAX_STRCMP_LOGS)
+    return;
+
+  record = &strcmp_records[idx];
+  s1 = (const char *) (uintptr_t) (arg1 + guest_base);
+  s2 = (const char *) (uintptr_t) (arg2 + guest_base);
+  record->site = stack[0];
+  if (kind == STRCMP_MEM) {
+    record->len1 = n1;
+    record->len2 = n2;
+  } else {
+    /* Include the NUL, if it is within the limit. */
+    record->len1 = strnlen(s1, n1) < n1 ? strnlen(s1, n1) + 1 : n1;
+    record->len2 = strnlen(s2, n2) < n2 ? strnlen(s2, n2) + 1 : n2;
+  }
+  memcpy(record->buf1, s1, record->len1);
+  memcpy(record->buf2, s2, record->len2);
+
+  if (coverage_fp) {
+    mix_path_hash(((uint64_t) record->site << 16) ^ (record->len1 << 8) ^
+                  record->len2);
+    for (i = 0; i < record->len1; i++)
+      mix_path_hash(record->buf1[i]);
+    for (i = 0; i < record->len2; i++)
+      mix_path_hash((uint64_t) record->buf2[i] << 8);
+  }
+}
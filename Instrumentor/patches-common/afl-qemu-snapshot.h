@@ -0,0 +1,474 @@
+/*
+    Snapshot mode of the fork server, shared by the coverage tracer and the
+    branch tracer. This file is included by afl-qemu-cpu-inl.h, which provides
+    FORKSRV_FD, the tracer stats counters, afl_now_ns(), and the reading and
+    relaying of the tracer-specific commands (afl_read_command() and
+    afl_write_command()).
+*/
+
+#include <dirent.h>
+
+/*********************
+ * SNAPSHOT SETTINGS *
+ *********************/
+
+/* Snapshot mode (cf. afl_snapshot_server()). */
+
+#define PAGEMAP_SOFT_DIRTY (1ULL << 55)
+#define SNAPSHOT_MAX_FD 1024
+#define SNAPSHOT_PROT_MASK (PAGE_READ | PAGE_EXEC | PAGE_WRITE_ORG)
+
+#define afl_g2h(x) ((void *)((uintptr_t)(x) + guest_base))
+
+extern abi_long do_brk(abi_ulong new_brk);
+extern void target_set_brk(abi_ulong new_brk);
+extern int target_munmap(abi_ulong start, abi_ulong len);
+
+struct afl_region {
+  abi_ulong start;
+  abi_ulong end;
+  unsigned long prot;
+  unsigned char *copy; /* Content at the snapshot, only if writable */
+};
+
+struct afl_region_list {
+  struct afl_region *regions;
+  int count;
+  int capacity;
+};
+
+struct afl_snapshot_reply {
+  int status;
+  int alive; /* Zero if the snapshot child could not restore the snapshot */
+};
+
+static int afl_snapshot_mode;
+static pid_t afl_snapshot_pid; /* Set in the snapshot child */
+static int afl_snapshot_ctl_fd = -1, afl_snapshot_st_fd = -1;
+static CPUArchState afl_snapshot_env;
+static CPUArchState *afl_snapshot_cpu_env;
+static abi_ulong afl_snapshot_brk;
+static sigset_t afl_snapshot_sigmask;
+static int afl_snapshot_threads;
+static unsigned char afl_snapshot_fds[SNAPSHOT_MAX_FD];
+static off_t afl_snapshot_offsets[SNAPSHOT_MAX_FD];
+static struct afl_region_list afl_snapshot_regions, afl_current_regions;
+static int afl_pagemap_fd = -1, afl_clear_refs_fd = -1;
+static uint64_t *afl_pagemap_buf;
+static size_t afl_pagemap_buf_len;
+
+int eclipser_snapshot_restart(int);
+void eclipser_snapshot_abort(int);
+
+/*****************
+ * SNAPSHOT MODE *
+ *****************/
+
+/* In snapshot mode (ECL_SNAPSHOT=1), the fork server forks a single snapshot
+   child, which records the guest memory, CPU state, program break and file
+   descriptors at the entry point, and runs many executions. At the end of an
+   execution, the child restores only the guest pages dirtied since the
+   snapshot (tracked with soft-dirty bits of /proc/self/pagemap), and resumes
+   from the entry point, where cpu_tb_exec() sets up the logs again.
+
+   If the child crashes or times out, or the snapshot cannot be restored (e.g.
+   the guest created a thread or unmapped a snapshot page), the child dies and
+   the fork server forks a new one for the next execution. Note that the signal
+   handlers installed by the guest are not restored. */
+
+static int afl_add_region(void *priv, target_ulong start, target_ulong end,
+                          unsigned long prot) {
+
+  struct afl_region_list *list = priv;
+  struct afl_region *r;
+
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 64;
+    list->regions = realloc(list->regions,
+                            list->capacity * sizeof(struct afl_region));
+    if (!list->regions) return -1;
+  }
+
+  r = &list->regions[list->count++];
+  r->start = start;
+  r->end = end;
+  r->prot = prot;
+  r->copy = NULL;
+  return 0;
+
+}
+
+static int afl_collect_regions(struct afl_region_list *list) {
+
+  list->count = 0;
+  return walk_memory_regions(list, afl_add_region);
+
+}
+
+/* Count the entries of a /proc directory, or return -1 on failure. */
+
+static int afl_count_entries(const char *path) {
+
+  DIR *dir = opendir(path);
+  struct dirent *ent;
+  int count = 0;
+
+  if (!dir) return -1;
+  while ((ent = readdir(dir)) != NULL)
+    if (ent->d_name[0] != '.') count++;
+  closedir(dir);
+  return count;
+
+}
+
+/* Mark the open file descriptors in 'fds', excluding the one used for the
+   scan itself. Return the number of descriptors that do not fit in 'fds'. */
+
+static int afl_scan_fds(unsigned char *fds) {
+
+  DIR *dir = opendir("/proc/self/fd");
+  struct dirent *ent;
+  int fd, overflow = 0;
+
+  memset(fds, 0, SNAPSHOT_MAX_FD);
+  if (!dir) return -1;
+
+  while ((ent = readdir(dir)) != NULL) {
+    if (ent->d_name[0] == '.') continue;
+    fd = atoi(ent->d_name);
+    if (fd == dirfd(dir)) continue;
+    if (fd < SNAPSHOT_MAX_FD) fds[fd] = 1;
+    else overflow++;
+  }
+
+  closedir(dir);
+  return overflow;
+
+}
+
+static void afl_clear_soft_dirty(void) {
+
+  if (afl_clear_refs_fd >= 0 && write(afl_clear_refs_fd, "4", 1) != 1) {
+    /* Without clearing, every page is considered dirty. Still correct. */
+  }
+
+}
+
+/* Check if the kernel tracks soft-dirty bits, by writing to a probe page. If
+   not, stop using the pagemap so that every page is considered dirty. */
+
+static void afl_check_soft_dirty(void) {
+
+  static volatile unsigned char probe[2 * TARGET_PAGE_SIZE];
+  uintptr_t page = ((uintptr_t)probe + TARGET_PAGE_SIZE - 1) /
+                   TARGET_PAGE_SIZE;
+  uint64_t entry;
+
+  afl_clear_soft_dirty();
+  probe[page * TARGET_PAGE_SIZE - (uintptr_t)probe] = 1;
+
+  if (pread(afl_pagemap_fd, &entry, sizeof(entry), page * sizeof(entry)) !=
+      sizeof(entry) || !(entry & PAGEMAP_SOFT_DIRTY)) {
+    close(afl_pagemap_fd);
+    afl_pagemap_fd = -1;
+  }
+
+}
+
+/* Record the snapshot in the snapshot child. On failure, the child just runs
+   a single execution, as in the normal fork server mode. */
+
+static void afl_snapshot_take(CPUState *cpu) {
+
+  struct afl_region *r;
+  int i, fd;
+
+  afl_snapshot_cpu_env = cpu->env_ptr;
+  memcpy(&afl_snapshot_env, afl_snapshot_cpu_env,
+         offsetof(CPUArchState, end_reset_fields));
+  afl_snapshot_brk = do_brk(0);
+  sigprocmask(SIG_SETMASK, NULL, &afl_snapshot_sigmask);
+
+  afl_pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+  afl_clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY);
+  if (afl_pagemap_fd >= 0) afl_check_soft_dirty();
+
+  afl_snapshot_threads = afl_count_entries("/proc/self/task");
+  if (afl_snapshot_threads < 0) return;
+
+  if (afl_scan_fds(afl_snapshot_fds) != 0) return;
+  for (fd = 0; fd < SNAPSHOT_MAX_FD; fd++)
+    if (afl_snapshot_fds[fd])
+      afl_snapshot_offsets[fd] = lseek(fd, 0, SEEK_CUR);
+
+  if (afl_collect_regions(&afl_snapshot_regions) != 0) return;
+  for (i = 0; i < afl_snapshot_regions.count; i++) {
+    r = &afl_snapshot_regions.regions[i];
+    if (!(r->prot & PAGE_WRITE_ORG)) continue;
+    r->copy = malloc(r->end - r->start);
+    if (!r->copy) return;
+    memcpy(r->copy, afl_g2h(r->start), r->end - r->start);
+  }
+
+  afl_clear_soft_dirty();
+  afl_snapshot_pid = getpid();
+
+}
+
+/* Check if the pages of snapshot region 'r' are still mapped with the same
+   protection. Pages write-protected for translated code are allowed. */
+
+static int afl_region_intact(struct afl_region *r) {
+
+  struct afl_region *c;
+  abi_ulong pos = r->start;
+  int i;
+
+  for (i = 0; i < afl_current_regions.count; i++) {
+    c = &afl_current_regions.regions[i];
+    if (c->end <= pos) continue;
+    if (c->start > pos) return 0;
+    if ((c->prot & SNAPSHOT_PROT_MASK) != (r->prot & SNAPSHOT_PROT_MASK))
+      return 0;
+    pos = c->end;
+    if (pos >= r->end) return 1;
+  }
+
+  return 0;
+
+}
+
+/* Unmap the guest pages mapped after the snapshot, including the ones for the
+   program break. Both region lists are sorted by address. */
+
+static void afl_unmap_new_regions(void) {
+
+  struct afl_region *c, *r;
+  abi_ulong pos;
+  int i, j = 0;
+
+  for (i = 0; i < afl_current_regions.count; i++) {
+    c = &afl_current_regions.regions[i];
+    pos = c->start;
+    while (pos < c->end) {
+      while (j < afl_snapshot_regions.count &&
+             afl_snapshot_regions.regions[j].end <= pos)
+        j++;
+      r = j < afl_snapshot_regions.count ? &afl_snapshot_regions.regions[j]
+                                         : NULL;
+      if (r && r->start <= pos) {
+        pos = r->end < c->end ? r->end : c->end;
+      } else {
+        abi_ulong end = (r && r->start < c->end) ? r->start : c->end;
+        target_munmap(pos, end - pos);
+        pos = end;
+      }
+    }
+  }
+
+}
+
+/* Copy back the dirty pages of a writable snapshot region. If the pagemap is
+   not available, every page is considered dirty. */
+
+static int afl_restore_region(struct afl_region *r) {
+
+  size_t i, npages = (r->end - r->start) / TARGET_PAGE_SIZE;
+  size_t len = npages * sizeof(uint64_t);
+  off_t offset;
+  int all_dirty = 1;
+  abi_ulong addr;
+
+  if (afl_pagemap_fd >= 0) {
+    if (afl_pagemap_buf_len < len) {
+      free(afl_pagemap_buf);
+      afl_pagemap_buf = malloc(len);
+      afl_pagemap_buf_len = afl_pagemap_buf ? len : 0;
+    }
+    offset = ((uintptr_t)afl_g2h(r->start) / TARGET_PAGE_SIZE) *
+             sizeof(uint64_t);
+    if (afl_pagemap_buf &&
+        pread(afl_pagemap_fd, afl_pagemap_buf, len, offset) == (ssize_t)len)
+      all_dirty = 0;
+  }
+
+  for (i = 0; i < npages; i++) {
+    if (!all_dirty && !(afl_pagemap_buf[i] & PAGEMAP_SOFT_DIRTY)) continue;
+    addr = r->start + i * TARGET_PAGE_SIZE;
+    /* A page write-protected for translated code cannot be written here. */
+    if (!(page_get_flags(addr) & PAGE_WRITE)) return -1;
+    memcpy(afl_g2h(addr), r->copy + i * TARGET_PAGE_SIZE, TARGET_PAGE_SIZE);
+  }
+
+  return 0;
+
+}
+
+/* Close the descriptors opened after the snapshot, and rewind the others. */
+
+static int afl_restore_fds(void) {
+
+  static unsigned char fds[SNAPSHOT_MAX_FD];
+  int fd;
+
+  if (afl_scan_fds(fds) != 0) return -1;
+
+  for (fd = 0; fd < SNAPSHOT_MAX_FD; fd++) {
+    if (fds[fd] && !afl_snapshot_fds[fd]) close(fd);
+    else if (!fds[fd] && afl_snapshot_fds[fd]) return -1;
+    else if (fds[fd] && afl_snapshot_offsets[fd] >= 0)
+      lseek(fd, afl_snapshot_offsets[fd], SEEK_SET);
+  }
+
+  return 0;
+
+}
+
+static int afl_snapshot_restore(void) {
+
+  int i;
+
+  if (afl_count_entries("/proc/self/task") != afl_snapshot_threads) return -1;
+
+  if (afl_collect_regions(&afl_current_regions) != 0) return -1;
+  for (i = 0; i < afl_snapshot_regions.count; i++)
+    if (!afl_region_intact(&afl_snapshot_regions.regions[i])) return -1;
+
+  afl_unmap_new_regions();
+  target_set_brk(afl_snapshot_brk);
+
+  for (i = 0; i < afl_snapshot_regions.count; i++)
+    if (afl_snapshot_regions.regions[i].copy &&
+        afl_restore_region(&afl_snapshot_regions.regions[i]) != 0)
+      return -1;
+
+  afl_clear_soft_dirty();
+  if (afl_restore_fds() != 0) return -1;
+
+  memcpy(afl_snapshot_cpu_env, &afl_snapshot_env,
+         offsetof(CPUArchState, end_reset_fields));
+  sigprocmask(SIG_SETMASK, &afl_snapshot_sigmask, NULL);
+  return 0;
+
+}
+
+/* Called at the exit syscalls, after eclipser_exit(). In the snapshot child,
+   report the exit status to the fork server, restore the snapshot and wait for
+   the next execution, then return 1 so that the guest resumes from the entry
+   point. Otherwise, return 0 to let the process exit. */
+
+int eclipser_snapshot_restart(int code) {
+
+  struct afl_snapshot_reply reply;
+
+  if (!afl_snapshot_pid || getpid() != afl_snapshot_pid) return 0;
+
+  reply.status = (code & 0xff) << 8; /* As in waitpid() */
+  reply.alive = (afl_snapshot_restore() == 0);
+
+  if (write(afl_snapshot_st_fd, &reply, sizeof(reply)) != sizeof(reply) ||
+      !reply.alive)
+    _exit(code);
+
+  if (!afl_read_command(afl_snapshot_ctl_fd)) _exit(code);
+
+  return 1;
+
+}
+
+/* Same as above, but called from a helper in the middle of translated code,
+   instead of exit(). Returns only if not in the snapshot child. */
+
+void eclipser_snapshot_abort(int code) {
+
+  if (eclipser_snapshot_restart(code)) cpu_loop_exit(current_cpu);
+
+}
+
+/* Fork server logic of snapshot mode. Returns only in the snapshot child. */
+
+static void afl_snapshot_server(CPUState *cpu) {
+
+  pid_t child_pid = 0;
+  int status, forked, ctl_pipe[2], st_pipe[2];
+  uint64_t fork_start = 0, exec_start;
+  struct afl_snapshot_reply reply;
+
+  while (1) {
+
+    if (!afl_read_command(FORKSRV_FD)) exit(2);
+
+    /* Relay the command to the snapshot child, if it is alive. */
+
+    if (child_pid && !afl_write_command(afl_snapshot_ctl_fd)) {
+      kill(child_pid, SIGKILL);
+      waitpid(child_pid, &status, 0);
+      close(afl_snapshot_ctl_fd);
+      close(afl_snapshot_st_fd);
+      child_pid = 0;
+    }
+
+    forked = !child_pid;
+    if (forked) {
+
+      if (pipe(ctl_pipe) || pipe(st_pipe)) exit(3);
+
+      fork_start = afl_now_ns();
+      child_pid = fork();
+      if (child_pid < 0) exit(4);
+
+      if (!child_pid) {
+        close(FORKSRV_FD);
+        close(FORKSRV_FD + 1);
+        close(ctl_pipe[1]);
+        close(st_pipe[0]);
+        afl_snapshot_ctl_fd = ctl_pipe[0];
+        afl_snapshot_st_fd = st_pipe[1];
+        fcntl(afl_snapshot_ctl_fd, F_SETFD, FD_CLOEXEC);
+        fcntl(afl_snapshot_st_fd, F_SETFD, FD_CLOEXEC);
+        eclipser_tb_translated = 0; /* Do not count the fork server's. */
+        afl_snapshot_take(cpu);
+        return;
+      }
+
+      close(ctl_pipe[0]);
+      close(st_pipe[1]);
+      afl_snapshot_ctl_fd = ctl_pipe[1];
+      afl_snapshot_st_fd = st_pipe[0];
+
+    }
+
+    exec_start = afl_now_ns();
+    if (write(FORKSRV_FD + 1, &child_pid, 4) != 4) exit(5);
+
+    /* If the child died (e.g. crash, timeout or single execution without the
+       snapshot), relay its actual exit status. */
+
+    if (read(afl_snapshot_st_fd, &reply, sizeof(reply)) == sizeof(reply)) {
+      status = reply.status;
+      if (!reply.alive) waitpid(child_pid, NULL, 0);
+    } else {
+      reply.alive = 0;
+      if (waitpid(child_pid, &status, 0) < 0) exit(6);
+    }
+
+    if (!reply.alive) {
+      close(afl_snapshot_ctl_fd);
+      close(afl_snapshot_st_fd);
+      child_pid = 0;
+    }
+
+    if (eclipser_stats) {
+      __sync_fetch_and_add(&eclipser_stats[STAT_EXECS], 1);
+      if (forked)
+        __sync_fetch_and_add(&eclipser_stats[STAT_FORK_NS],
+                             exec_start - fork_start);
+      __sync_fetch_and_add(&eclipser_stats[STAT_EXEC_NS],
+                           afl_now_ns() - exec_start);
+    }
+
+    if (write(FORKSRV_FD + 1, &status, 4) != 4) exit(7);
+
+  }
+
+}
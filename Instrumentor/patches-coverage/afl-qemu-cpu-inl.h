@@ -23,6 +23,18 @@
 #define FORKSRV_FD 198
 #define TSL_FD (FORKSRV_FD - 1)
 
+/* Counters of the shared tracer stats page updated by the fork server. The
+ * others are updated by the forked children (cf. eclipser.c). */
+
+#define STAT_EXECS 0
+#define STAT_FORK_NS 1
+#define STAT_EXEC_NS 2
+#define STAT_TSL_REQUESTS 3
+#define STAT_TSL_MIRRORED 4
+
+extern uint64_t * eclipser_stats;
+extern uint64_t eclipser_tb_translated;
+
 /* Set in the child process in forkserver mode: */
 
 static unsigned char afl_fork_child;
@@ -34,7 +46,10 @@ static void afl_forkserver(CPUState*);
 
 static void afl_wait_tsl(CPUState*, int);
 static void afl_request_tsl(target_ulong, target_ulong, uint64_t,
-                            TranslationBlock*, int);
+                            TranslationBlock*, int, int);
+static uint64_t afl_now_ns(void);
+static int afl_read_command(int);
+static int afl_write_command(int);
 
 /* Data structure passed around by the translate handlers: */
 
@@ -56,13 +71,51 @@ struct afl_chain {
  * ACTUAL IMPLEMENTATION *
  *************************/
 
+static uint64_t afl_now_ns(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+}
+
+/* Read the request of the next execution, sent by Eclipser. */
+
+static int afl_read_command(int fd) {
+
+  static unsigned char tmp[4];
+
+  return read(fd, tmp, 4) == 4;
+
+}
+
+/* Relay the request of the next execution to the snapshot child. */
+
+static int afl_write_command(int fd) {
+
+  static unsigned char tmp[4];
+
+  return write(fd, tmp, 4) == 4;
+
+}
+
+/* Snapshot mode, shared by the tracers (cf. patches-common/). */
+
+#include "afl-qemu-snapshot.h"
+
 /* Fork server logic, invoked once we hit _start. */
 
 static void afl_forkserver(CPUState *cpu) {
 
   static unsigned char tmp[4];
 
+  /* The snapshot child resumed from the entry point. */
+  if (afl_snapshot_pid) return;
+
   if (atoi(getenv("ECL_FORK_SERVER")) != 1) return;
+  afl_snapshot_mode = getenv("ECL_SNAPSHOT") != NULL &&
+                      atoi(getenv("ECL_SNAPSHOT")) == 1;
 
   /* Tell the parent that we're alive. If the parent doesn't want
      to talk, assume that we're not running in forkserver mode. */
@@ -71,16 +124,22 @@ static void afl_forkserver(CPUState *cpu) {
 
   afl_forksrv_pid = getpid();
 
+  if (afl_snapshot_mode) {
+    afl_snapshot_server(cpu);
+    return;
+  }
+
   /* All right, let's await orders... */
 
   while (1) {
 
     pid_t child_pid;
     int status, t_fd[2];
+    uint64_t fork_start, fork_end;
 
     /* Whoops, parent dead? */
 
-    if (read(FORKSRV_FD, tmp, 4) != 4) exit(2);
+    if (!afl_read_command(FORKSRV_FD)) exit(2);
 
     /* Establish a channel with child to grab translation commands. We'll
        read from t_fd[0], child will write to TSL_FD. */
@@ -88,6 +147,7 @@ static void afl_forkserver(CPUState *cpu) {
     if (pipe(t_fd) || dup2(t_fd[1], TSL_FD) < 0) exit(3);
     close(t_fd[1]);
 
+    fork_start = afl_now_ns();
     child_pid = fork();
     if (child_pid < 0) exit(4);
 
@@ -96,6 +156,7 @@ static void afl_forkserver(CPUState *cpu) {
       /* Child process. Close descriptors and run free. */
 
       afl_fork_child = 1;
+      eclipser_tb_translated = 0; /* Do not count the fork server's. */
       close(FORKSRV_FD);
       close(FORKSRV_FD + 1);
       close(t_fd[0]);
@@ -105,6 +166,7 @@ static void afl_forkserver(CPUState *cpu) {
 
     /* Parent. */
 
+    fork_end = afl_now_ns();
     close(TSL_FD);
 
     if (write(FORKSRV_FD + 1, &child_pid, 4) != 4) exit(5);
@@ -116,6 +178,15 @@ static void afl_forkserver(CPUState *cpu) {
     /* Get and relay exit status to parent. */
 
     if (waitpid(child_pid, &status, 0) < 0) exit(6);
+
+    if (eclipser_stats) {
+      __sync_fetch_and_add(&eclipser_stats[STAT_EXECS], 1);
+      __sync_fetch_and_add(&eclipser_stats[STAT_FORK_NS],
+                           fork_end - fork_start);
+      __sync_fetch_and_add(&eclipser_stats[STAT_EXEC_NS],
+                           afl_now_ns() - fork_end);
+    }
+
     if (write(FORKSRV_FD + 1, &status, 4) != 4) exit(7);
 
   }
@@ -125,13 +196,17 @@ static void afl_forkserver(CPUState *cpu) {
 /* This code is invoked whenever QEMU decides that it doesn't have a
    translation of a particular block and needs to compute it. When this happens,
    we tell the parent to mirror the operation, so that the next fork() has a
-   cached copy. */
+   cached copy. The translations in the child are counted, since they are the
+   translations that the fork server failed to cache. */
 
 static void afl_request_tsl(target_ulong pc, target_ulong cb, uint64_t flags,
-                            TranslationBlock* last_tb, int tb_exit)  {
+                            TranslationBlock* last_tb, int tb_exit,
+                            int translated)  {
   struct afl_tsl t;
   struct afl_chain c;
 
+  if (translated) eclipser_tb_translated++;
+
   if (!afl_fork_child) return;
 
   t.pc      = pc;
@@ -161,6 +236,7 @@ static void afl_wait_tsl(CPUState *cpu, int fd) {
   struct afl_tsl t;
   struct afl_chain c;
   TranslationBlock *tb, *last_tb;
+  uint64_t requests = 0, mirrored = 0;
 
   while (1) {
 
@@ -170,8 +246,10 @@ static void afl_wait_tsl(CPUState *cpu, int fd) {
       break;
 
     tb = tb_htable_lookup(cpu, t.pc, t.cs_base, t.flags);
+    requests++;
 
     if(!tb) {
+      mirrored++;
       mmap_lock();
       tb_lock();
       tb = tb_gen_code(cpu, t.pc, t.cs_base, t.flags, 0);
@@ -196,4 +274,9 @@ static void afl_wait_tsl(CPUState *cpu, int fd) {
 
   close(fd);
 
+  if (eclipser_stats) {
+    __sync_fetch_and_add(&eclipser_stats[STAT_TSL_REQUESTS], requests);
+    __sync_fetch_and_add(&eclipser_stats[STAT_TSL_MIRRORED], mirrored);
+  }
+
 }
@@ -16,11 +16,23 @@ typedef uint32_t abi_ulong;
 #endif
 
 extern unsigned int afl_forksrv_pid;
+extern void eclipser_snapshot_abort(int code);
 #define FORKSRV_FD 198
 #define TSL_FD (FORKSRV_FD - 1)
 
 #define BITMAP_SIZE (0x10000)
 #define BITMAP_MASK (BITMAP_SIZE - 1)
+#define PATH_HASH_INIT 0xcbf29ce484222325ULL
+
+/* Counters in the shared tracer stats page (cf. ECL_TRACER_STATS). Each tracer
+ * owns a slot of STAT_COUNT counters, and the remaining counters of the slot
+ * are updated by the fork server (cf. afl-qemu-cpu-inl.h). Should be updated
+ * along with Executor.fs.
+ */
+#define STAT_COUNT 8
+#define STATS_PAGE_SIZE (2 * STAT_COUNT * sizeof(uint64_t))
+#define STAT_SLOT 0
+#define STAT_TB_TRANSLATED 5
 
 void eclipser_setup_before_forkserver(void);
 void eclipser_setup_after_forkserver(void);
@@ -35,22 +47,56 @@ static char * dbg_path = NULL;
 static FILE * coverage_fp = NULL;
 static FILE * dbg_fp = NULL;
 
-static abi_ulong prev_addr = 0;
+static __thread abi_ulong prev_addr = 0;
 static int found_new_edge = 0;
-static int found_new_path = 0; // TODO. Extend to measure path coverage, too.
+static uint64_t path_hash = 0; /* Hash of the executed block sequence */
 static unsigned char * edge_bitmap = NULL;
+static uint64_t * stats_page = NULL;
+uint64_t * eclipser_stats = NULL; /* Slot of this tracer in 'stats_page' */
+uint64_t eclipser_tb_translated = 0;
+
+/* Accumulate the counters of this execution to the shared stats page. Called
+ * once per execution, to avoid contention on the page between the tracers.
+ */
+static void flush_stats(void) {
+  if (eclipser_stats)
+    __sync_fetch_and_add(&eclipser_stats[STAT_TB_TRANSLATED],
+                         eclipser_tb_translated);
+  eclipser_tb_translated = 0;
+}
 
 void eclipser_setup_before_forkserver(void) {
   char * bitmap_path = getenv("ECL_BITMAP_LOG");
+  char * stats_path;
+  int stats_fd;
   int bitmap_fd = open(bitmap_path, O_RDWR | O_CREAT, 0644);
   edge_bitmap = (unsigned char*) mmap(NULL, BITMAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, bitmap_fd, 0);
   assert(edge_bitmap != (void *) -1);
+  close(bitmap_fd);
+
+  /* Tracer statistics are optional, so just ignore the failure. */
+  stats_path = getenv("ECL_TRACER_STATS");
+  if (stats_path != NULL && (stats_fd = open(stats_path, O_RDWR)) >= 0) {
+    stats_page = (uint64_t*) mmap(NULL, STATS_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, stats_fd, 0);
+    if (stats_page == (void *) -1)
+      stats_page = NULL;
+    else
+      eclipser_stats = stats_page + STAT_SLOT * STAT_COUNT;
+    close(stats_fd);
+  }
 
   coverage_path = getenv("ECL_COVERAGE_LOG");
   dbg_path = getenv("ECL_DBG_LOG");
 }
 
 void eclipser_setup_after_forkserver(void) {
+  // Reset the states of the previous execution, in the snapshot mode where a
+  // process runs multiple executions (cf. afl-qemu-cpu-inl.h).
+  found_new_edge = 0;
+  path_hash = PATH_HASH_INIT;
+  prev_addr = 0;
+
   /* Open file pointers and descriptors early, since if we try to open them in
    * eclipser_exit(), it gets mixed with stderr & stdout stream. This seems to
    * be an issue due to incorrect file descriptor management in QEMU code.
@@ -85,6 +131,12 @@ void eclipser_detach(void) {
     edge_bitmap = NULL;
   }
 
+  if (stats_page) {
+    munmap(stats_page, STATS_PAGE_SIZE);
+    stats_page = NULL;
+    eclipser_stats = NULL;
+  }
+
   if (afl_forksrv_pid)
     close(TSL_FD);
 }
@@ -99,7 +151,8 @@ void eclipser_exit(void) {
     return;
 
   if (coverage_fp) {
-    fprintf(coverage_fp, "%d\n%d\n", found_new_edge, found_new_path);
+    fprintf(coverage_fp, "%d\n%016llx\n", found_new_edge,
+            (unsigned long long) path_hash);
     fclose(coverage_fp);
     coverage_fp = NULL;
   }
@@ -113,6 +166,22 @@ void eclipser_exit(void) {
     munmap(edge_bitmap, BITMAP_SIZE);
     edge_bitmap = NULL;
   }
+
+  flush_stats();
+  if (stats_page) {
+    munmap(stats_page, STATS_PAGE_SIZE);
+    stats_page = NULL;
+    eclipser_stats = NULL;
+  }
+}
+
+/* Mix 'val' into the path hash. The hash depends on the order of the values, so
+ * that it identifies the sequence of the executed blocks. Should be kept the
+ * same as the one of the branch tracer.
+ */
+static void mix_path_hash(uint64_t val) {
+  path_hash = (path_hash ^ val) * 0x9E3779B97F4A7C15ULL;
+  path_hash ^= path_hash >> 32;
 }
 
 void helper_eclipser_log_bb(abi_ulong addr) {
@@ -128,6 +197,8 @@ void helper_eclipser_log_bb(abi_ulong addr) {
   if (!coverage_fp || !edge_bitmap)
     return;
 
+  mix_path_hash(addr);
+
 #ifdef TARGET_X86_64
   edge = (prev_addr_local << 16) ^ addr;
 #else
@@ -140,9 +211,11 @@ void helper_eclipser_log_bb(abi_ulong addr) {
   byte_mask = 1 << (hash & 0x7); // Use the lowest 3 bits to shift
   old_byte = edge_bitmap[byte_idx];
   new_byte = old_byte | byte_mask;
-  if (old_byte != new_byte) {
+  // The bitmap is shared by the tracers of all the fuzzing workers, so set the
+  // bit atomically and claim the edge only if this process set it.
+  if (old_byte != new_byte &&
+      !(__sync_fetch_and_or(&edge_bitmap[byte_idx], byte_mask) & byte_mask)) {
     found_new_edge = 1;
-    edge_bitmap[byte_idx] = new_byte;
     /* Log visited nodes if dbg_fp is not NULL */
     if (dbg_fp) {
 #ifdef TARGET_X86_64
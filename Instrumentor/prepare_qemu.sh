@@ -97,6 +97,9 @@ rm -rf "qemu-${VERSION}-coverage-x86" || exit 1
 rm -rf "qemu-${VERSION}-coverage-x64" || exit 1
 rm -rf "qemu-${VERSION}-branch-x86" || exit 1
 rm -rf "qemu-${VERSION}-branch-x64" || exit 1
+rm -rf "qemu-${VERSION}-bbcount" || exit 1
+rm -rf "qemu-${VERSION}-bbcount-x86" || exit 1
+rm -rf "qemu-${VERSION}-bbcount-x64" || exit 1
 
 echo "[*] Uncompressing archive..."
 
@@ -124,12 +127,14 @@ patch -p0 <patches-common/target-helper.diff || exit 1
 
 cp -r "qemu-${VERSION}" "qemu-${VERSION}-coverage"
 cp -r "qemu-${VERSION}" "qemu-${VERSION}-branch"
+cp -r "qemu-${VERSION}" "qemu-${VERSION}-bbcount"
 
 ### Patch for coverage tracer
 
 echo "[*] Applying patches for coverage..."
 
 cp patches-coverage/afl-qemu-cpu-inl.h qemu-${VERSION}-coverage/accel/tcg/
+cp patches-common/afl-qemu-snapshot.h qemu-${VERSION}-coverage/accel/tcg/
 cp patches-coverage/eclipser.c qemu-${VERSION}-coverage/accel/tcg/
 patch -p0 <patches-coverage/makefile-objs.diff || exit 1
 patch -p0 <patches-coverage/target-translate.diff || exit 1
@@ -144,6 +149,7 @@ mv "qemu-${VERSION}-coverage" "qemu-${VERSION}-coverage-x64"
 echo "[*] Applying patches for branch..."
 
 cp patches-branch/afl-qemu-cpu-inl.h qemu-${VERSION}-branch/
+cp patches-common/afl-qemu-snapshot.h qemu-${VERSION}-branch/
 cp patches-branch/eclipser.c qemu-${VERSION}-branch/tcg/
 patch -p0 <patches-branch/makefile-target.diff || exit 1
 
@@ -152,8 +158,25 @@ patch -p0 <patches-branch/tcg-op.diff || exit 1
 patch -p0 <patches-branch/tcg-opc.diff || exit 1
 patch -p0 <patches-branch/tcg-target.diff || exit 1
 patch -p0 <patches-branch/target-translate.diff || exit 1
+patch -p0 <patches-branch/target-helper.diff || exit 1
 
 echo "[+] Patching done."
 
 cp -r "qemu-${VERSION}-branch" "qemu-${VERSION}-branch-x86"
 mv "qemu-${VERSION}-branch" "qemu-${VERSION}-branch-x64"
+
+### Patch for bbcount tracer
+
+echo "[*] Applying patches for bbcount..."
+
+# The bbcount tracer shares the fork server code with the coverage tracer.
+cp patches-coverage/afl-qemu-cpu-inl.h qemu-${VERSION}-bbcount/accel/tcg/
+cp patches-common/afl-qemu-snapshot.h qemu-${VERSION}-bbcount/accel/tcg/
+cp patches-bbcount/eclipser.c qemu-${VERSION}-bbcount/accel/tcg/
+patch -p0 <patches-bbcount/makefile-objs.diff || exit 1
+patch -p0 <patches-bbcount/target-translate.diff || exit 1
+
+echo "[+] Patching done."
+
+cp -r "qemu-${VERSION}-bbcount" "qemu-${VERSION}-bbcount-x86"
+mv "qemu-${VERSION}-bbcount" "qemu-${VERSION}-bbcount-x64"
@@ -20,14 +20,25 @@ export_common_patch() {
 export_coverage_patch() {
   TARG_DIR=./qemu-${VERSION}-coverage-$1
   cp qemu-${VERSION}-coverage/accel/tcg/afl-qemu-cpu-inl.h $TARG_DIR/accel/tcg/
+  cp qemu-${VERSION}-coverage/accel/tcg/afl-qemu-snapshot.h $TARG_DIR/accel/tcg/
   cp qemu-${VERSION}-coverage/accel/tcg/eclipser.c $TARG_DIR/accel/tcg/
   cp qemu-${VERSION}-coverage/accel/tcg/Makefile.objs $TARG_DIR/accel/tcg/Makefile.objs
   cp qemu-${VERSION}-coverage/target/i386/translate.c $TARG_DIR/target/i386/translate.c
 }
 
+export_bbcount_patch() {
+  TARG_DIR=./qemu-${VERSION}-bbcount-$1
+  cp qemu-${VERSION}-bbcount/accel/tcg/afl-qemu-cpu-inl.h $TARG_DIR/accel/tcg/
+  cp qemu-${VERSION}-bbcount/accel/tcg/afl-qemu-snapshot.h $TARG_DIR/accel/tcg/
+  cp qemu-${VERSION}-bbcount/accel/tcg/eclipser.c $TARG_DIR/accel/tcg/
+  cp qemu-${VERSION}-bbcount/accel/tcg/Makefile.objs $TARG_DIR/accel/tcg/Makefile.objs
+  cp qemu-${VERSION}-bbcount/target/i386/translate.c $TARG_DIR/target/i386/translate.c
+}
+
 export_branch_patch() {
   TARG_DIR=./qemu-${VERSION}-branch-$1
   cp qemu-${VERSION}-branch/afl-qemu-cpu-inl.h $TARG_DIR/
+  cp qemu-${VERSION}-branch/afl-qemu-snapshot.h $TARG_DIR/
   cp qemu-${VERSION}-branch/tcg/eclipser.c $TARG_DIR/tcg/
   cp qemu-${VERSION}-branch/Makefile.target $TARG_DIR/Makefile.target
 
@@ -36,6 +47,7 @@ export_branch_patch() {
   cp qemu-${VERSION}-branch/tcg/tcg-opc.h $TARG_DIR/tcg/tcg-opc.h
   cp qemu-${VERSION}-branch/tcg/i386/tcg-target.inc.c  $TARG_DIR/tcg/i386/tcg-target.inc.c
   cp qemu-${VERSION}-branch/target/i386/translate.c $TARG_DIR/target/i386/translate.c
+  cp qemu-${VERSION}-branch/target/i386/helper.h $TARG_DIR/target/i386/helper.h
 }
 
 ##### Common patch
@@ -63,6 +75,8 @@ export_common_patch "coverage" "x86"
 export_common_patch "coverage" "x64"
 export_common_patch "branch" "x86"
 export_common_patch "branch" "x64"
+export_common_patch "bbcount" "x86"
+export_common_patch "bbcount" "x64"
 
 ##### Patch coverage tracer
 
@@ -71,6 +85,7 @@ cp -r "qemu-${VERSION}" "qemu-${VERSION}-coverage"
 
 # Patch
 cp patches-coverage/afl-qemu-cpu-inl.h qemu-${VERSION}-coverage/accel/tcg/
+cp patches-common/afl-qemu-snapshot.h qemu-${VERSION}-coverage/accel/tcg/
 cp patches-coverage/eclipser.c qemu-${VERSION}-coverage/accel/tcg/
 patch -p0 <patches-coverage/makefile-objs.diff || exit 1
 patch -p0 <patches-coverage/target-translate.diff || exit 1
@@ -88,6 +103,7 @@ cp -r "qemu-${VERSION}" "qemu-${VERSION}-branch"
 
 # Patch
 cp patches-branch/afl-qemu-cpu-inl.h qemu-${VERSION}-branch/
+cp patches-common/afl-qemu-snapshot.h qemu-${VERSION}-branch/
 cp patches-branch/eclipser.c qemu-${VERSION}-branch/tcg/
 patch -p0 <patches-branch/makefile-target.diff || exit 1
 
@@ -96,9 +112,28 @@ patch -p0 <patches-branch/tcg-op.diff || exit 1
 patch -p0 <patches-branch/tcg-opc.diff || exit 1
 patch -p0 <patches-branch/tcg-target.diff || exit 1
 patch -p0 <patches-branch/target-translate.diff || exit 1
+patch -p0 <patches-branch/target-helper.diff || exit 1
 
 export_branch_patch "x86"
 export_branch_patch "x64"
 
 # Cleanup
 rm -rf "qemu-${VERSION}-branch"
+
+##### Patch bbcount tracer
+
+# Copy qemu-${VERSION} into qemu-${VERSION}-bbcount, to apply patch.
+cp -r "qemu-${VERSION}" "qemu-${VERSION}-bbcount"
+
+# Patch
+cp patches-coverage/afl-qemu-cpu-inl.h qemu-${VERSION}-bbcount/accel/tcg/
+cp patches-common/afl-qemu-snapshot.h qemu-${VERSION}-bbcount/accel/tcg/
+cp patches-bbcount/eclipser.c qemu-${VERSION}-bbcount/accel/tcg/
+patch -p0 <patches-bbcount/makefile-objs.diff || exit 1
+patch -p0 <patches-bbcount/target-translate.diff || exit 1
+
+export_bbcount_patch "x86"
+export_bbcount_patch "x64"
+
+# Cleanup
+rm -rf "qemu-${VERSION}-bbcount"
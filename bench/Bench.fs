@@ -0,0 +1,103 @@
+/// Microbenchmarks for the hot paths on the .NET side: branch trace parsing,
+/// round-trip of tracer execution, and BranchTree.make / GreySolver.solve on
+/// recorded traces. Results are written to a JSON file.
+///
+/// Usage: dotnet Bench.dll <result json> <repetitions> <fuzz options...>
+module Eclipser.Bench
+
+open System
+open System.IO
+open System.Diagnostics
+open Config
+open Utils
+open Options
+
+let private SYNTHETIC_TRACE_LEN = 100000
+
+// Run 'f' for 'n' times after a warm-up run, and return the average time in
+// milliseconds.
+let private measure n f =
+  f () |> ignore
+  let stopWatch = Stopwatch.StartNew()
+  for _ in 1 .. n do f () |> ignore
+  stopWatch.Elapsed.TotalMilliseconds / float n
+
+// Write a branch trace log in the format of the branch tracer, with equality
+// comparisons of 4-byte operands.
+let private writeSyntheticTrace opt path =
+  use w = new BinaryWriter(File.Create(path))
+  let writeAddr (addr: uint64) =
+    match opt.Architecture with
+    | X86 -> w.Write(uint32 addr)
+    | X64 -> w.Write(addr)
+  for i in 1 .. SYNTHETIC_TRACE_LEN do
+    writeAddr (0x400000UL + uint64 (i % 512))
+    w.Write(4uy) // Equality type in the upper 2 bits, operand size in the rest.
+    w.Write(uint32 i)
+    w.Write(uint32 (i * 7))
+  writeAddr 0UL
+
+let private benchParse opt n =
+  let path = Path.Combine(opt.OutDir, ".bench_trace")
+  writeSyntheticTrace opt path
+  let fileSize = float (FileInfo(path).Length)
+  let time = measure n (fun () -> Executor.readBranchTrace opt path 0I)
+  removeFile path
+  [ ("parse_ms", time)
+    ("parse_records_per_sec", float SYNTHETIC_TRACE_LEN * 1000.0 / time)
+    ("parse_mb_per_sec", fileSize / 1048576.0 * 1000.0 / time) ]
+
+let private benchExec opt seed n =
+  let covTime = measure n (fun () -> Executor.getCoverage opt seed)
+  let brTime = measure n (fun () -> Executor.getBranchTrace opt seed 0I)
+  [ ("get_coverage_ms", covTime); ("get_branch_trace_ms", brTime) ]
+
+// Record branch traces of the seed in the same way as GreyConcolic.run(), and
+// measure the time to build a branch tree and to solve it.
+let private benchGreyConcolic opt seed n =
+  let byteDir = Seed.getByteCursorDir seed
+  let bytes = Seed.queryNeighborBytes seed byteDir
+  let ctx = { Bytes = bytes; ByteDir = byteDir }
+  let traces, _, _ = BranchTrace.collect seed opt 0I 255I
+  let makeTree () =
+    BranchTree.make opt ctx traces |> BranchTree.selectAndRepair opt
+  let makeTime = measure n makeTree
+  let branchTree = makeTree ()
+  let solve () =
+    GreySolver.clearSolutionCache ()
+    GreySolver.solve seed opt byteDir branchTree
+  Executor.resetRoundExecs ()
+  Executor.enableRoundStatistics ()
+  let solveTime = measure n solve
+  Executor.disableRoundStatistics ()
+  let solveExecs = float (Executor.getRoundExecs ()) / float (n + 1)
+  [ ("trace_count", float (List.length traces))
+    ("trace_avg_len", List.averageBy (List.length >> float) traces)
+    ("branch_tree_make_ms", makeTime)
+    ("grey_solver_solve_ms", solveTime)
+    ("grey_solver_solve_execs", solveExecs) ]
+
+let private writeResult path target (results: (string * float) list) =
+  let entries = List.map (fun (k, v) -> sprintf "    \"%s\": %.3f" k v) results
+  let target = sprintf "    \"target\": \"%s\"" target
+  let body = String.concat ",\n" (target :: entries)
+  File.WriteAllText(path, "{\n" + body + "\n}\n")
+
+[<EntryPoint>]
+let main args =
+  if args.Length < 2 then
+    printLine "Usage: dotnet Bench.dll <result json> <repetitions> <options>"
+    exit 1
+  let resultPath, n = args.[0], int args.[1]
+  let opt = parseFuzzOption args.[2..]
+  let opt = if opt.ExecTimeout <> 0UL then opt
+            else { opt with ExecTimeout = EXEC_TIMEOUT_MAX }
+  createDirectoryIfNotExists opt.OutDir
+  Executor.initialize opt
+  let seed = Seed.make opt.FuzzSource
+  let results =
+    benchParse opt n @ benchExec opt seed n @ benchGreyConcolic opt seed n
+  Executor.cleanup ()
+  writeResult resultPath opt.TargetProg results
+  log "[*] Benchmark results written to %s" resultPath
+  0
@@ -0,0 +1,251 @@
+/* Microbenchmark for the execution hot paths of libexec.c and the tracers.
+ * Measures the round-trip latency of exec(), exec_fork_coverage() and
+ * exec_fork_branch(), and the per-comparison overhead of the tracers with
+ * bench/cmp_chain.c target. Results are printed to stdout in JSON format.
+ *
+ * Usage: bench_exec <build dir> <arch> <iterations> <cmp_chain binary>
+ *                   <target> [target args...]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define BITMAP_SIZE     0x10000
+#define BENCH_TIMEOUT   4000
+#define CMP_COUNT       20000
+#define CMP_COUNT_STR   "20000"
+#define NON_CUMULATIVE  2
+
+/* Exported functions of libexec.c */
+extern void initialize_exec(void);
+extern int exec(int argc, char **args, int stdin_size, char *stdin_data,
+                uint64_t timeout);
+extern pid_t init_forkserver_coverage(int id, int argc, char** args,
+                                      uint64_t timeout);
+extern pid_t init_forkserver_branch(int id, int argc, char** args,
+                                    uint64_t timeout);
+extern void kill_forkserver(int id);
+extern int exec_fork_coverage(int id, uint64_t timeout, int stdin_size,
+                              char *stdin_data);
+extern int exec_fork_branch(int id, uint64_t timeout, int stdin_size,
+                            char *stdin_data, uint64_t targ_addr,
+                            uint32_t targ_index, int measure_cov);
+
+enum mode { NATIVE, COVERAGE, BRANCH };
+
+struct stats {
+    int valid;
+    double mean_us, p50_us, p99_us, max_us;
+};
+
+static char stdin_data[16] = "AAAAAAAAAAAAAAAA";
+static char coverage_tracer[4096], branch_tracer[4096];
+static int iterations;
+static int first_entry = 1;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void setup_env(void) {
+    char cwd[4096];
+    char path[4200];
+    int fd;
+
+    if (!getcwd(cwd, sizeof(cwd))) {
+        perror("getcwd");
+        exit(1);
+    }
+
+    snprintf(path, sizeof(path), "%s/.bench_bitmap", cwd);
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || ftruncate(fd, BITMAP_SIZE)) {
+        perror("bitmap");
+        exit(1);
+    }
+    close(fd);
+    setenv("ECL_BITMAP_LOG", path, 1);
+    snprintf(path, sizeof(path), "%s/.bench_coverage", cwd);
+    setenv("ECL_COVERAGE_LOG", path, 1);
+    snprintf(path, sizeof(path), "%s/.bench_branch", cwd);
+    setenv("ECL_BRANCH_LOG", path, 1);
+    setenv("ECL_FORK_SERVER", "1", 1);
+}
+
+/* Build argv of the form { tracer, target, args... }. For native mode, the
+ * tracer is omitted.
+ */
+static char **build_args(char *tracer, int argc, char **target_argv,
+                         int *out_argc) {
+    char **args = malloc(sizeof(char *) * (argc + 2));
+    int i, n = 0;
+
+    if (tracer) args[n++] = tracer;
+    for (i = 0; i < argc; i++)
+        args[n++] = target_argv[i];
+    args[n] = NULL;
+    *out_argc = n;
+    return args;
+}
+
+static int run_once(enum mode mode, int id, int args_cnt, char **args) {
+    if (mode == NATIVE)
+        return exec(args_cnt, args, sizeof(stdin_data), stdin_data,
+                    BENCH_TIMEOUT);
+    else if (mode == COVERAGE)
+        return exec_fork_coverage(id, BENCH_TIMEOUT, sizeof(stdin_data),
+                                  stdin_data);
+    else
+        return exec_fork_branch(id, BENCH_TIMEOUT, sizeof(stdin_data),
+                                stdin_data, 0, 0, NON_CUMULATIVE);
+}
+
+static struct stats measure(enum mode mode, int id, int args_cnt,
+                            char **args) {
+    struct stats s = { 0, };
+    double *lat = malloc(sizeof(double) * iterations);
+    double sum = 0.0;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        uint64_t start = now_ns();
+
+        if (run_once(mode, id, args_cnt, args) < 0) goto out;
+        lat[i] = (now_ns() - start) / 1000.0;
+        sum += lat[i];
+    }
+
+    qsort(lat, iterations, sizeof(double), compare_double);
+    s.valid = 1;
+    s.mean_us = sum / iterations;
+    s.p50_us = lat[iterations / 2];
+    s.p99_us = lat[(int)(iterations * 0.99)];
+    s.max_us = lat[iterations - 1];
+
+out:
+    free(lat);
+    return s;
+}
+
+static struct stats measure_native(int argc, char **target_argv) {
+    int args_cnt;
+    char **args = build_args(NULL, argc, target_argv, &args_cnt);
+    struct stats s = measure(NATIVE, 0, args_cnt, args);
+
+    free(args);
+    return s;
+}
+
+/* Measure the latency of both tracers, with the fork servers of executor 'id'.
+ * If the tracers are not built, the results are left invalid.
+ */
+static void measure_traced(int id, int argc, char **target_argv,
+                           struct stats *cov, struct stats *br) {
+    int cov_cnt, br_cnt;
+    char **cov_args = build_args(coverage_tracer, argc, target_argv, &cov_cnt);
+    char **br_args = build_args(branch_tracer, argc, target_argv, &br_cnt);
+
+    memset(cov, 0, sizeof(*cov));
+    memset(br, 0, sizeof(*br));
+    if (access(coverage_tracer, X_OK) == 0 &&
+        access(branch_tracer, X_OK) == 0 &&
+        init_forkserver_coverage(id, cov_cnt, cov_args, BENCH_TIMEOUT) > 0 &&
+        init_forkserver_branch(id, br_cnt, br_args, BENCH_TIMEOUT) > 0) {
+        *cov = measure(COVERAGE, id, cov_cnt, cov_args);
+        *br = measure(BRANCH, id, br_cnt, br_args);
+        kill_forkserver(id);
+    }
+    free(cov_args);
+    free(br_args);
+}
+
+static void print_key(const char *key) {
+    printf("%s\n    \"%s\": ", first_entry ? "" : ",", key);
+    first_entry = 0;
+}
+
+static void print_stats(const char *key, struct stats s) {
+    print_key(key);
+    if (!s.valid) {
+        printf("null");
+        return;
+    }
+    printf("{ \"mean_us\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, "
+           "\"max_us\": %.2f }", s.mean_us, s.p50_us, s.p99_us, s.max_us);
+}
+
+/* Overhead of a single comparison, from the difference of the latency between
+ * CMP_COUNT comparisons and zero comparison.
+ */
+static void print_overhead(const char *key, struct stats s0, struct stats s1) {
+    print_key(key);
+    if (!s0.valid || !s1.valid) printf("null");
+    else printf("%.2f", (s1.p50_us - s0.p50_us) * 1000.0 / CMP_COUNT);
+}
+
+int main(int argc, char **argv) {
+    char *cmp_argv[2];
+    struct stats cov, br, native0, native1, cov0, cov1, br0, br1;
+
+    if (argc < 6) {
+        fprintf(stderr, "Usage: %s <build dir> <x86|x64> <iterations> "
+                "<cmp_chain binary> <target> [target args...]\n", argv[0]);
+        return 1;
+    }
+
+    snprintf(coverage_tracer, sizeof(coverage_tracer),
+             "%s/qemu-trace-coverage-%s", argv[1], argv[2]);
+    snprintf(branch_tracer, sizeof(branch_tracer),
+             "%s/qemu-trace-branch-%s", argv[1], argv[2]);
+    iterations = atoi(argv[3]);
+    if (iterations <= 0) {
+        fprintf(stderr, "Invalid iteration count: %s\n", argv[3]);
+        return 1;
+    }
+
+    setup_env();
+    initialize_exec();
+
+    printf("{");
+    print_key("target");
+    printf("\"%s\"", argv[5]);
+    print_key("iterations");
+    printf("%d", iterations);
+    print_stats("exec_native", measure_native(argc - 5, argv + 5));
+    measure_traced(0, argc - 5, argv + 5, &cov, &br);
+    print_stats("exec_fork_coverage", cov);
+    print_stats("exec_fork_branch", br);
+
+    cmp_argv[0] = argv[4];
+    cmp_argv[1] = "0";
+    native0 = measure_native(2, cmp_argv);
+    measure_traced(1, 2, cmp_argv, &cov0, &br0);
+    cmp_argv[1] = CMP_COUNT_STR;
+    native1 = measure_native(2, cmp_argv);
+    measure_traced(2, 2, cmp_argv, &cov1, &br1);
+    print_overhead("native_ns_per_cmp", native0, native1);
+    print_overhead("coverage_tracer_ns_per_cmp", cov0, cov1);
+    print_overhead("branch_tracer_ns_per_cmp", br0, br1);
+    printf("\n}\n");
+
+    unlink(".bench_bitmap");
+    unlink(".bench_coverage");
+    unlink(".bench_branch");
+    return 0;
+}
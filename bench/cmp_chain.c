@@ -0,0 +1,24 @@
+// Benchmark target that executes a given number of comparisons against the
+// standard input, to measure the per-comparison overhead of the tracers.
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(int argc, char ** argv){
+  char buf[16] = { 0, };
+  volatile int hits = 0;
+  int i, n;
+
+  if (argc < 2)
+    return -1;
+
+  n = atoi(argv[1]);
+  read(0, buf, sizeof(buf));
+
+  for (i = 0; i < n; i++) {
+    if (buf[i % sizeof(buf)] == (char) i)
+      hits++;
+  }
+
+  return 0;
+}
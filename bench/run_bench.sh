@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# Runs the microbenchmarks, and writes the results in JSON format. Usage:
+#   ./run_bench.sh <build dir> [result path]
+# Set ARCH (x86|x64, default: x64) and ITERS (default: 1000) to override the
+# target architecture and the number of iterations.
+set -e
+BENCHDIR=$(cd "$(dirname "$0")" && pwd)
+BUILDDIR=$(cd "${1:-$BENCHDIR/../build}" && pwd)
+RESULT=${2:-$BENCHDIR/results/$(date +%Y%m%d-%H%M%S).json}
+ARCH=${ARCH:-x64}
+ITERS=${ITERS:-1000}
+if [ "$ARCH" == "x86" ]; then CFLAGS="-m32"; fi
+
+WORKDIR=$(mktemp -d)
+trap "rm -rf $WORKDIR" EXIT
+cd $WORKDIR
+gcc $CFLAGS $BENCHDIR/../examples/linear.c -o linear.bin -static -g
+gcc $CFLAGS $BENCHDIR/cmp_chain.c -o cmp_chain.bin -static -O1
+printf 'AAAAAAAAAAAAAAAA' > input
+
+echo "[*] Running execution benchmark"
+$BUILDDIR/bench_exec $BUILDDIR $ARCH $ITERS $WORKDIR/cmp_chain.bin \
+  $WORKDIR/linear.bin $WORKDIR/input > exec.json
+
+echo "[*] Running .NET benchmark"
+dotnet $BUILDDIR/Bench.dll $WORKDIR/dotnet.json $((ITERS / 10)) \
+  -p linear.bin -o output -f input --arg input --architecture $ARCH
+
+mkdir -p $(dirname $RESULT)
+{ echo "{ \"exec\":"; cat exec.json; echo ", \"dotnet\":"; cat dotnet.json
+  echo "}"; } > $RESULT
+echo "[*] Results written to $RESULT"
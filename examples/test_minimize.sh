@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# Tests if 'cmin' drops the redundant inputs of a corpus, and if 'tmin' trims
+# the bytes that do not affect the coverage of each input.
+gcc linear.c -o linear.bin -static -g || exit 1
+rm -rf box
+mkdir box
+cd box
+
+# Inputs that take the same paths, and the ones padded with trailing bytes that
+# are never read by the program.
+mkdir seeds
+printf "A" > seeds/a1
+printf "A" > seeds/a2
+printf "ABB" > seeds/a3
+printf "aba" > seeds/b1
+printf "aba" > seeds/b2
+printf "abadcba%0100d" 0 > seeds/b3
+
+size() {
+  cat $1/* | wc -c
+}
+
+dotnet ../../build/Eclipser.dll cmin \
+  -p ../linear.bin -v 1 -i seeds -o cmin -f input --arg input || exit 1
+n_seeds=$(ls seeds | wc -l)
+n_cmin=$(ls cmin | wc -l)
+if [ $n_cmin -gt 0 ] && [ $n_cmin -lt $n_seeds ]; then
+  echo "[*] cmin selected $n_cmin inputs out of $n_seeds"
+else
+  echo "[!] cmin selected $n_cmin inputs out of $n_seeds"
+  exit 1
+fi
+
+dotnet ../../build/Eclipser.dll tmin \
+  -p ../linear.bin -v 1 -i seeds -o tmin -f input --arg input || exit 1
+if [ $(ls tmin | wc -l) -eq $n_seeds ] && [ $(size tmin) -lt $(size seeds) ]
+then
+  echo "[*] tmin trimmed $(size seeds) bytes into $(size tmin) bytes"
+else
+  echo "[!] tmin failed to trim $(size seeds) bytes"
+  exit 1
+fi
@@ -0,0 +1,18 @@
+#!/bin/bash
+
+# Tests if Eclipser can fuzz with multiple workers, which run their own fork
+# servers, share the edge bitmap and steal seeds from each other's queues.
+# Eclipser should be able to find a test case containing \x64\x63\x62\x61.
+gcc loop.c -o loop.bin -static -g || exit 1
+rm -rf box
+mkdir box
+cd box
+dotnet ../../build/Eclipser.dll \
+  -p ../loop.bin -t 45 -v 2 -o output -f input --arg input --nsolve 10 -j 4
+
+if grep -q -a "dcba" output/queue/*; then
+  echo "[*] Found the test case with 4 workers"
+else
+  echo "[!] Failed to find the test case with 4 workers"
+  exit 1
+fi
@@ -0,0 +1,19 @@
+#!/bin/bash
+
+# Tests if the executions recorded with '--record' option can be replayed
+# offline. Every round should be replayed without asking for an execution that
+# is not in the log.
+gcc linear.c -o linear.bin -static -g || exit 1
+rm -rf box
+mkdir box
+cd box
+dotnet ../../build/Eclipser.dll \
+  -p ../linear.bin -t 10 -v 1 -o output -f input --arg input --record exec.log
+dotnet ../../build/Eclipser.dll replay -v 1 -l exec.log | tee replay.log
+
+if grep -q "Replayed [1-9][0-9]* rounds .*(0 rounds abandoned)" replay.log; then
+  echo "[*] Replayed every round"
+else
+  echo "[!] Failed to replay the rounds"
+  exit 1
+fi
@@ -0,0 +1,32 @@
+#!/bin/bash
+
+# Tests if Eclipser can resume fuzzing from the checkpoint left by a killed
+# instance. The checkpoint is saved every 300 seconds (CHECKPOINT_INTERVAL), so
+# kill the first run after the first checkpoint. Eclipser should be able to
+# find a test case containing \x64\x63\x62\x61 in the end.
+gcc loop.c -o loop.bin -static -g || exit 1
+rm -rf box
+mkdir box
+cd box
+timeout -s KILL 330 dotnet ../../build/Eclipser.dll \
+  -p ../loop.bin -v 1 -o output -f input --arg input --nsolve 10 -j 2
+
+if [ ! -f output/.checkpoint ]; then
+  echo "[!] No checkpoint left by the killed instance"
+  exit 1
+fi
+
+dotnet ../../build/Eclipser.dll \
+  -p ../loop.bin -t 45 -v 2 -o output -f input --arg input --nsolve 10 -j 2 \
+  --resume | tee resume.log
+
+if ! grep -q "Resumed from checkpoint" resume.log; then
+  echo "[!] Failed to resume from the checkpoint"
+  exit 1
+fi
+if grep -q -a "dcba" output/queue/*; then
+  echo "[*] Found the test case with resuming"
+else
+  echo "[!] Failed to find the test case with resuming"
+  exit 1
+fi
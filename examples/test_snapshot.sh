@@ -0,0 +1,44 @@
+#!/bin/bash
+
+# Tests if Eclipser finds the same test cases when the tracers restore the
+# snapshot of the target instead of forking it for each execution.
+gcc linear.c -o linear.bin -static -g || exit 1
+gcc loop.c -o loop.bin -static -g || exit 1
+rm -rf box
+mkdir box
+cd box
+
+# Run Eclipser on the given program, in fork server mode and in snapshot mode.
+run() {
+  for mode in fork snapshot; do
+    if [ $mode = "snapshot" ]; then flag="--snapshot"; else flag=""; fi
+    dotnet ../../build/Eclipser.dll -p ../$1.bin -t $2 -v 1 -o $1-$mode \
+      -f input --arg input $flag || exit 1
+  done
+}
+
+# Check if both modes found the same number of files in the given directory.
+check() {
+  n_fork=$(ls $1-fork/$2 2>/dev/null | wc -l)
+  n_snapshot=$(ls $1-snapshot/$2 2>/dev/null | wc -l)
+  if [ $n_fork -eq $n_snapshot ]; then
+    echo "[*] Found $n_snapshot $2 for $1 in both modes"
+  else
+    echo "[!] Found $n_fork $2 with fork, $n_snapshot with snapshot for $1"
+    exit 1
+  fi
+}
+
+run linear 10
+check linear queue
+check linear crashes
+
+run loop 45
+check loop queue
+check loop crashes
+if grep -q -a "dcba" loop-snapshot/queue/*; then
+  echo "[*] Found the test case in snapshot mode"
+else
+  echo "[!] Failed to find the test case in snapshot mode"
+  exit 1
+fi
@@ -0,0 +1,105 @@
+/// Functions to handle the edge coverage bitmap, which is shared with the QEMU
+/// tracers through a memory-mapped file (cf. Instrumentor/patches-*/eclipser.c)
+module Eclipser.Bitmap
+
+#nowarn "9" // Native pointer is needed for atomic update of the mapped file.
+
+open System.IO
+open System.IO.MemoryMappedFiles
+open System.Numerics
+open System.Threading
+open Microsoft.FSharp.NativeInterop
+open Config
+
+/// Edge bits newly set in a bitmap, represented as pairs of byte index and the
+/// new bits in the byte.
+type BitmapDelta = (int * byte) array
+
+/// A bitmap file mapped into our address space.
+type SharedBitmap = {
+  File : MemoryMappedFile
+  View : MemoryMappedViewAccessor
+}
+
+let private size = int BITMAP_SIZE
+
+let private vecLen = Vector<byte>.Count
+
+let openShared (path: string) =
+  let file = MemoryMappedFile.CreateFromFile(path, FileMode.Open, null,
+                                             BITMAP_SIZE,
+                                             MemoryMappedFileAccess.ReadWrite)
+  { File = file; View = file.CreateViewAccessor(0L, BITMAP_SIZE) }
+
+let close bitmap =
+  bitmap.View.Dispose()
+  bitmap.File.Dispose()
+
+let empty () : byte array = Array.zeroCreate size
+
+/// Copy the current content of a shared bitmap.
+let read bitmap =
+  let arr = empty ()
+  bitmap.View.ReadArray(0L, arr, 0, size) |> ignore
+  arr
+
+// Compare the bytes in [offset, offset + vecLen) with a single SIMD operation.
+let private isSameChunk (map1: byte array) (map2: byte array) offset =
+  Vector.EqualsAll(Vector<byte>(map1, offset), Vector<byte>(map2, offset))
+
+/// Find the bits set in 'newMap' but not in 'oldMap'.
+let diff (oldMap: byte array) (newMap: byte array) : BitmapDelta =
+  [| for offset in 0 .. vecLen .. (size - vecLen) do
+       if not (isSameChunk oldMap newMap offset) then
+         for i in offset .. (offset + vecLen - 1) do
+           let newBits = newMap.[i] &&& ~~~ oldMap.[i]
+           if newBits <> 0uy then yield (i, newBits) |]
+
+/// Check if every bit in 'delta' is already set in 'map'.
+let isCovered (map: byte array) (delta: BitmapDelta) =
+  Array.forall (fun (i, bits) -> map.[i] &&& bits = bits) delta
+
+/// Set the bits in 'delta' to 'map'.
+let apply (map: byte array) (delta: BitmapDelta) =
+  Array.iter (fun (i, bits) -> map.[i] <- map.[i] ||| bits) delta
+
+let private popCountTable =
+  Array.init 256 (fun i -> List.sumBy (fun bit -> (i >>> bit) &&& 1) [0 .. 7])
+
+/// Count the number of set bits, i.e. the number of covered edges.
+let popCount (map: byte array) =
+  Array.fold (fun acc b -> acc + popCountTable.[int b]) 0 map
+
+/// Bitwise-OR 'src' into 'dst', in a vectorized manner.
+let unionInto (dst: byte array) (src: byte array) =
+  for offset in 0 .. vecLen .. (size - vecLen) do
+    let v1, v2 = Vector<byte>(dst, offset), Vector<byte>(src, offset)
+    Vector.BitwiseOr(v1, v2).CopyTo(dst, offset)
+
+// Atomically OR 'bits' into the 32-bit word at 'ptr', since the tracers may
+// update the same word concurrently.
+let rec private atomicOr (ptr: nativeptr<int>) bits =
+  let old = NativePtr.read ptr
+  let newVal = old ||| bits
+  if newVal <> old &&
+     Interlocked.CompareExchange(NativePtr.toByRef ptr, newVal, old) <> old
+  then atomicOr ptr bits
+
+/// Merge 'src' into a shared bitmap. Only the chunks with missing bits are
+/// updated, and each update is done atomically.
+let merge bitmap (src: byte array) =
+  let cur = read bitmap
+  let handle = bitmap.View.SafeMemoryMappedViewHandle
+  let mutable basePtr = NativePtr.nullPtr<byte>
+  handle.AcquirePointer(&basePtr)
+  try
+    let basePtr = NativePtr.add basePtr (int bitmap.View.PointerOffset)
+    let wordPtr = NativePtr.ofNativeInt<int> (NativePtr.toNativeInt basePtr)
+    let merged = Array.copy cur
+    unionInto merged src
+    for offset in 0 .. vecLen .. (size - vecLen) do
+      if not (isSameChunk cur merged offset) then
+        for i in (offset / 4) .. ((offset + vecLen) / 4 - 1) do
+          let bits = System.BitConverter.ToInt32(merged, i * 4)
+          atomicOr (NativePtr.add wordPtr i) bits
+  finally handle.ReleasePointer()
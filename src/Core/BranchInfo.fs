@@ -14,6 +14,15 @@ type Context = {
   ByteDir : Direction
 }
 
+/// Operands of a call to a string comparison function (e.g. memcmp()), which
+/// the branch tracer logs as a whole, along with the trace.
+type StringCompare = {
+  CallSite : uint64 // Return address of the call.
+  TryVal   : bigint
+  Buf1     : byte array
+  Buf2     : byte array
+}
+
 type BranchInfo = {
   InstAddr : uint64
   BrType   : CompareType
@@ -0,0 +1,60 @@
+/// Relevance of the input bytes to the comparisons of the target program,
+/// learned from the branch traces collected at each cursor position. Each
+/// lineage of seeds (i.e. the seeds derived from the same initial or imported
+/// seed) keeps its own map, since they mostly share the input format. The
+/// cursor jumps over the offsets found irrelevant, but only for
+/// RELEVANCE_SKIP_LIMIT times, after which the offset is spawned again to
+/// re-validate its relevance.
+module Eclipser.ByteRelevance
+
+open System.Collections.Concurrent
+open System.Collections.Generic
+open System.Threading
+open Config
+
+let private lineageCount = ref 0
+// For each lineage, irrelevant offsets mapped to the number of skips left.
+let private maps = ConcurrentDictionary<int, Dictionary<int, int>>()
+
+/// Allocate an identifier for a new lineage of seeds.
+let newLineage () = Interlocked.Increment(lineageCount)
+
+/// Return the number of lineages allocated so far.
+let getLineageCount () = !lineageCount
+
+/// Skip the identifiers up to 'count', which are used by the seeds restored
+/// from a checkpoint.
+let reserveLineages count =
+  let rec loop () =
+    let cur = !lineageCount
+    if cur < count &&
+       Interlocked.CompareExchange(lineageCount, count, cur) <> cur then loop ()
+  loop ()
+
+/// Record whether the byte at 'offset' affected any operand of comparisons.
+let update lineage offset isRelevant =
+  let map = maps.GetOrAdd(lineage, fun _ -> Dictionary<int, int>())
+  lock map (fun () ->
+    if isRelevant then map.Remove(offset) |> ignore
+    else map.[offset] <- RELEVANCE_SKIP_LIMIT)
+
+/// Check if the cursor can jump over 'offset'. This does not consume a skip,
+/// since the seed may be dropped before it is fuzzed (cf. consumeSkip).
+let isSkippable lineage offset =
+  match maps.TryGetValue(lineage) with
+  | false, _ -> false
+  | true, map -> lock map (fun () -> map.ContainsKey(offset))
+
+/// Consume a skip of 'offset', which a fuzzed seed jumped over. When no skip is
+/// left, forget the offset so that it is re-validated.
+let consumeSkip lineage offset =
+  match maps.TryGetValue(lineage) with
+  | false, _ -> ()
+  | true, map ->
+    lock map (fun () ->
+      match map.TryGetValue(offset) with
+      | true, skips ->
+        if skips > 1 then map.[offset] <- skips - 1
+        else map.Remove(offset) |> ignore
+        Stats.recordCursorSkip ()
+      | false, _ -> ())
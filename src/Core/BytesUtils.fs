@@ -80,3 +80,10 @@ let bytesToUInt endian (bytes: byte[]) =
   Array.toList bytes
   |> if endian = LE then List.rev else identity
   |> bytesToUIntAux 0u
+
+/// Compute 64-bit FNV-1a hash of a byte array.
+let hashBytes (bytes: byte[]) =
+  let mutable hash = 14695981039346656037UL
+  for b in bytes do
+    hash <- (hash ^^^ uint64 b) * 1099511628211UL
+  hash
@@ -4,6 +4,21 @@ module Eclipser.Config
 /// macros at Instrumentor/patches-*/eclipser.c
 let BITMAP_SIZE = 0x10000L
 
+/// Number of 64-bit counters per tracer in the shared tracer stats page. Should
+/// be updated along with the macros at Instrumentor/patches-*/eclipser.c
+let TRACER_STAT_COUNT = 8
+
+/// Maximum number of branch points that the branch tracer can probe in a single
+/// execution. Should be updated along with the macros at
+/// Instrumentor/patches-branch/eclipser.c
+let MAX_BRANCH_TARGETS = 16
+
+/// Maximum number of comparisons that the branch tracer logs in a single
+/// execution. The tracer logs only the first visits of each comparison site,
+/// so a trace reaches this limit only with many distinct sites. Should be
+/// updated along with the macros at Instrumentor/patches-branch/eclipser.c
+let MAX_TRACE_LEN = 100000
+
 /// Synchronize the seed queue with AFL every SYNC_N iteration of fuzzing loop.
 let SYNC_N = 10
 
@@ -13,6 +28,42 @@ let ROUND_SIZE = 10000
 let SLEEP_FACTOR_MIN = 0.0
 let SLEEP_FACTOR_MAX = 4.0
 
+/// Efficiency of AFL's random fuzzing to assume when it cannot be measured from
+/// the 'fuzzer_stats' files of AFL instances yet.
+let DEFAULT_RAND_FUZZ_EFFICIENCY = 0.0005
+
+/// AFL rewrites its 'fuzzer_stats' file about every minute. If the file of an
+/// AFL instance was not updated for AFL_STATS_STALE_SEC, we consider that the
+/// instance is not running anymore, and do not yield resource to it.
+let AFL_STATS_STALE_SEC = 300L
+
+/// Instead of sleeping for a whole round, Eclipser yields resource to AFL after
+/// each execution. To avoid calling sleep too frequently, the sleep time is
+/// accumulated until it exceeds THROTTLE_SLICE_MS.
+let THROTTLE_SLICE_MS = 20.0
+
+/// Maximum number of fuzzing workers in parallel mode, and the maximum number
+/// of helper instances that run the executions of a batch along with the
+/// workers (cf. Executor.runBatch). Their sum should be updated along with
+/// MAX_EXECUTORS macro at Core/libexec.c
+let MAX_JOBS = 64
+let MAX_HELPERS = 64
+
+/// Maximum number of sub-intervals that a round of the search on a monotonic
+/// branch splits the interval into (cf. GreySolver.solveMonotonic).
+let MAX_SEARCH_ARITY = 16
+
+/// Timeout for the communication with the coordinator (cf. Coordinator.fs), and
+/// the maximum numbers of seeds to push to and to pull from the coordinator at
+/// once.
+let COORDINATOR_TIMEOUT_MS = 10000
+let COORDINATOR_PUSH_MAX = 1000
+let COORDINATOR_PULL_MAX = 1000
+
+/// Interval to update 'fuzzer_stats' and append to 'plot_data' in the output
+/// directory (cf. FuzzerStats.fs).
+let STATS_UPDATE_SEC = 5
+
 /// Minimum and maximum value for the execution timeout of target program. Note
 /// that AFL uses 1000UL for EXEC_TIMEOUT_MAX, but we use a higher value since
 /// Eclipser is a binary-based fuzzer. Note that this range is ignored when an
@@ -20,6 +71,48 @@ let SLEEP_FACTOR_MAX = 4.0
 let EXEC_TIMEOUT_MIN = 400UL
 let EXEC_TIMEOUT_MAX = 4000UL
 
+/// The initial execution timeout is decided by timing the initial seeds, until
+/// the estimated timeout stays within CALIBRATE_STABLE_RATIO of itself for
+/// CALIBRATE_STABLE_N seeds in a row. The rest of the seeds are not timed.
+let CALIBRATE_STABLE_N = 32
+let CALIBRATE_STABLE_RATIO = 0.1
+
+/// When the execution timeout is not given, the timeout of each tracer mode is
+/// recalibrated every EXEC_TIMEOUT_RECALIBRATE_N executions, to the given
+/// percentile of the recent latencies multiplied by EXEC_TIMEOUT_FACTOR (cf.
+/// ExecTimeout.fs). Unlike EXEC_TIMEOUT_MIN, which applies to the initial
+/// timeout, EXEC_TIMEOUT_FLOOR is the lower bound of the recalibrated timeout.
+/// If more than EXEC_TIMEOUT_RATE_MAX of the executions timed out, the timeout
+/// is doubled instead.
+let EXEC_TIMEOUT_RECALIBRATE_N = 1000L
+let EXEC_TIMEOUT_PERCENTILE = 0.99
+let EXEC_TIMEOUT_FACTOR = 3.0
+let EXEC_TIMEOUT_FLOOR = 20UL
+let EXEC_TIMEOUT_RATE_MAX = 0.01
+
+/// Seeds that timed out SEED_TIMEOUT_LIMIT times in total are deprioritized.
+let SEED_TIMEOUT_LIMIT = 3
+
+/// Number of times that the cursor jumps over an input offset found irrelevant
+/// to the comparisons, before spawning at the offset again (cf.
+/// ByteRelevance.fs).
+let RELEVANCE_SKIP_LIMIT = 8
+
+/// Number of executions assumed for a lineage of seeds before it is fuzzed,
+/// which smooths the estimated yield of new edges (cf. SeedCost.fs).
+let SEED_YIELD_PRIOR_EXECS = 1000.0
+
+/// Parameters of input trimming, which are taken from AFL. The chunks to remove
+/// start from 1/TRIM_START_STEPS of the input length (rounded up to a power of
+/// two) and shrink down to 1/TRIM_END_STEPS, but not below TRIM_MIN_BYTES.
+let TRIM_START_STEPS = 16
+let TRIM_END_STEPS = 1024
+let TRIM_MIN_BYTES = 4
+
+/// Interval (sec) of saving a checkpoint of the fuzzing state, from which
+/// fuzzing can be resumed (cf. Checkpoint.fs).
+let CHECKPOINT_INTERVAL = 300
+
 /// Maximum length of chunk to try in grey-box concolic testing.
 let MAX_CHUNK_LEN = 10
 
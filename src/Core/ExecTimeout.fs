@@ -0,0 +1,153 @@
+/// Execution timeouts that adapt to the latency of the target program. Each
+/// tracer mode keeps an online latency histogram, from which its timeout is
+/// periodically recalibrated. Also keeps track of the seeds whose executions
+/// repeatedly time out, so that they can be deprioritized.
+module Eclipser.ExecTimeout
+
+open System
+open System.Collections.Concurrent
+open System.Threading
+open Config
+open Utils
+open BytesUtils
+open Options
+
+/// Latency histograms have HISTO_BUCKETS_PER_DOUBLING buckets per doubling of
+/// the latency, starting from HISTO_MIN_MS. Latencies out of the range fall
+/// into the first or the last bucket.
+let private HISTO_MIN_MS = 0.25
+let private HISTO_BUCKETS_PER_DOUBLING = 4.0
+let private HISTO_BUCKETS = 64
+
+let private modeCount = List.length Stats.allExecModes
+
+let mutable private adaptive = false
+let private timeouts : int64 array = Array.zeroCreate modeCount
+let private histograms : int64 array =
+  Array.zeroCreate (modeCount * HISTO_BUCKETS)
+let private windowExecs : int64 array = Array.zeroCreate modeCount
+let private windowTimeouts : int64 array = Array.zeroCreate modeCount
+let private recalibrateLock = obj ()
+
+// Number of timeouts of the current seed, counted per fuzzing worker.
+let private seedTimeouts = new ThreadLocal<int>()
+// Number of timeouts accumulated for each seed input, keyed by its hash.
+let private inputTimeouts = ConcurrentDictionary<Hash, int>()
+
+(*** Latency histogram ***)
+
+let private toBucket (ms: float) =
+  if ms <= HISTO_MIN_MS then 0
+  else let doublings = Math.Log(ms / HISTO_MIN_MS, 2.0)
+       min (HISTO_BUCKETS - 1) (int (HISTO_BUCKETS_PER_DOUBLING * doublings))
+
+// Upper bound of the latency that falls into the bucket.
+let private ofBucket idx =
+  HISTO_MIN_MS * Math.Pow(2.0, float (idx + 1) / HISTO_BUCKETS_PER_DOUBLING)
+
+let private getBucketCount modeIdx idx =
+  Interlocked.Read(&histograms.[modeIdx * HISTO_BUCKETS + idx])
+
+// Find the latency under which the given ratio of executions finished.
+let private getPercentile modeIdx ratio =
+  let counts = Array.init HISTO_BUCKETS (getBucketCount modeIdx)
+  let threshold = float (Array.sum counts) * ratio
+  let rec findBucket idx acc =
+    let acc = acc + counts.[idx]
+    if float acc >= threshold || idx = HISTO_BUCKETS - 1 then idx
+    else findBucket (idx + 1) acc
+  ofBucket (findBucket 0 0L)
+
+// Halve the histogram, so that it follows the recent latency of the target.
+let private decayHistogram modeIdx =
+  for idx in 0 .. HISTO_BUCKETS - 1 do
+    let i = modeIdx * HISTO_BUCKETS + idx
+    Interlocked.Exchange(&histograms.[i], histograms.[i] / 2L) |> ignore
+
+(*** Timeout recalibration ***)
+
+// Latencies of timed out executions are censored at the timeout, so the
+// percentile is not reliable if too many executions timed out. In that case,
+// double the timeout instead.
+let private decideTimeout modeIdx execs timeoutCnt =
+  let curTimeout = uint64 timeouts.[modeIdx]
+  if float timeoutCnt / float execs > EXEC_TIMEOUT_RATE_MAX then
+    min EXEC_TIMEOUT_MAX (curTimeout * 2UL)
+  else
+    let latency = getPercentile modeIdx EXEC_TIMEOUT_PERCENTILE
+    let timeout = uint64 (Math.Ceiling(latency * EXEC_TIMEOUT_FACTOR))
+    min EXEC_TIMEOUT_MAX (max EXEC_TIMEOUT_FLOOR timeout)
+
+let private recalibrate opt mode =
+  let modeIdx = Stats.ExecMode.toIndex mode
+  lock recalibrateLock (fun () ->
+    let execs = Interlocked.Exchange(&windowExecs.[modeIdx], 0L)
+    let timeoutCnt = Interlocked.Exchange(&windowTimeouts.[modeIdx], 0L)
+    let prevTimeout = uint64 timeouts.[modeIdx]
+    let newTimeout = decideTimeout modeIdx (max 1L execs) timeoutCnt
+    Interlocked.Exchange(&timeouts.[modeIdx], int64 newTimeout) |> ignore
+    decayHistogram modeIdx
+    if opt.Verbosity >= 1 && newTimeout <> prevTimeout then
+      log "[*] Set %s execution timeout to %d (ms) (%d timeouts / %d execs)"
+        (Stats.ExecMode.toString mode) newTimeout timeoutCnt execs)
+
+(*** Seed timeouts ***)
+
+/// Reset the number of timeouts counted for the current seed. Should be called
+/// by the fuzzing worker before it starts to fuzz a seed.
+let resetSeedTimeouts () = seedTimeouts.Value <- 0
+
+/// Accumulate the timeouts counted for the current seed to its input, and
+/// return true if the input repeatedly timed out so that it should be
+/// deprioritized.
+let flagSeed opt seed =
+  let count = seedTimeouts.Value
+  if count = 0 then false
+  else
+    let hash = hashBytes (Seed.concretize seed)
+    let total = inputTimeouts.AddOrUpdate(hash, count, fun _ n -> n + count)
+    let isFlagged = total >= SEED_TIMEOUT_LIMIT
+    if isFlagged && opt.Verbosity >= 1 then
+      log "[*] Seed timed out %d times: %s" total (Seed.toString seed)
+    isFlagged
+
+(*** Timeout queries and updates ***)
+
+/// Start adapting the timeout of each tracer mode, from the given initial
+/// value. Not called when an explicit timeout is given with '-e' option.
+let enableAdaptive (initTimeout: uint64) =
+  for modeIdx in 0 .. modeCount - 1 do timeouts.[modeIdx] <- int64 initTimeout
+  adaptive <- true
+
+/// Restore the timeout of each mode, which is obtained from
+/// getAdaptiveTimeouts() before a restart.
+let restoreAdaptive (modeTimeouts: (Stats.ExecMode * uint64) list) =
+  for mode, timeout in modeTimeouts do
+    timeouts.[Stats.ExecMode.toIndex mode] <- int64 timeout
+  adaptive <- not (List.isEmpty modeTimeouts)
+
+let private getAdaptive mode =
+  uint64 (Interlocked.Read(&timeouts.[Stats.ExecMode.toIndex mode]))
+
+/// Return the execution timeout (ms) to use for the given mode.
+let get opt mode =
+  if not adaptive then opt.ExecTimeout else getAdaptive mode
+
+/// Return the current timeout of each mode, or an empty list if the timeouts
+/// are not adaptive.
+let getAdaptiveTimeouts () =
+  if not adaptive then []
+  else List.map (fun mode -> (mode, getAdaptive mode)) Stats.allExecModes
+
+/// Record the latency of an execution in the given mode, and recalibrate the
+/// timeout of the mode every EXEC_TIMEOUT_RECALIBRATE_N executions.
+let record opt mode (elapsedMs: float) isTimeout =
+  if isTimeout then seedTimeouts.Value <- seedTimeouts.Value + 1
+  if adaptive then
+    let modeIdx = Stats.ExecMode.toIndex mode
+    let bucketIdx = modeIdx * HISTO_BUCKETS + toBucket elapsedMs
+    Interlocked.Increment(&histograms.[bucketIdx]) |> ignore
+    if isTimeout then
+      Interlocked.Increment(&windowTimeouts.[modeIdx]) |> ignore
+    let execs = Interlocked.Increment(&windowExecs.[modeIdx])
+    if execs = EXEC_TIMEOUT_RECALIBRATE_N then recalibrate opt mode
@@ -2,7 +2,9 @@ module Eclipser.Executor
 
 open System
 open System.IO
+open System.Collections.Concurrent
 open System.Runtime.InteropServices
+open System.Threading
 open Config
 open Utils
 open Options
@@ -10,22 +12,78 @@ open Options
 /// Kinds of QEMU instrumentor. Each instrumentor serves different purposes.
 type Tracer = Coverage | Branch | BBCount
 
+/// Counters collected by a tracer in the shared stats page, accumulated over
+/// all the executions. Fork and execution times are measured by fork servers,
+/// so they are not available when the fork server is disabled.
+type TracerStats = {
+  ForkedExecs   : uint64 // Executions through the fork server.
+  ForkNanosecs  : uint64 // Time spent in fork() of the fork server.
+  ExecNanosecs  : uint64 // Time from fork() until the child terminates.
+  // Translation requests sent to the fork server, and the ones among them that
+  // the fork server had not cached yet.
+  TSLRequests   : uint64
+  TSLMirrored   : uint64
+  // Blocks translated in the children (or in the tracer, without fork server).
+  TBTranslated  : uint64
+  CmpLogged     : uint64 // Comparisons written to the branch trace log.
+  TraceAborts   : uint64 // Executions whose trace hit MAX_TRACE_LEN limit.
+}
+
+/// Execution counts of the basic blocks, collected by the BBCount tracer. Loops
+/// are identified by their back edges, i.e. the transitions from a block (the
+/// tail) to a block at a lower or the same address (the head).
+type BlockProfile = {
+  ExecutedBlocks : uint64
+  DroppedBlocks  : uint64 // Blocks or back edges that the tracer missed.
+  Blocks         : (uint64 * uint64) array // Address and execution count.
+  Loops          : (uint64 * uint64 * uint64) array // Head, tail and count.
+}
+
 [<DllImport("libexec.dll")>] extern void set_env (string env_variable, string env_value)
 [<DllImport("libexec.dll")>] extern void initialize_exec ()
-[<DllImport("libexec.dll")>] extern int init_forkserver_coverage (int argc, string[] argv, uint64 timeout)
-[<DllImport("libexec.dll")>] extern int init_forkserver_branch (int argc, string[] argv, uint64 timeout)
-[<DllImport("libexec.dll")>] extern void kill_forkserver ()
+[<DllImport("libexec.dll")>] extern int init_forkserver_coverage (int id, int argc, string[] argv, uint64 timeout)
+[<DllImport("libexec.dll")>] extern int init_forkserver_branch (int id, int argc, string[] argv, uint64 timeout)
+[<DllImport("libexec.dll")>] extern void kill_forkserver (int id)
+[<DllImport("libexec.dll")>] extern int init_file_input (int id)
+[<DllImport("libexec.dll")>] extern void write_file_input (int id, int input_size, byte[] input_data)
+[<DllImport("libexec.dll")>] extern int set_cpu_affinity (int cpu)
 [<DllImport("libexec.dll")>] extern Signal exec (int argc, string[] argv, int stdin_size, byte[] stdin_data, uint64 timeout)
-[<DllImport("libexec.dll")>] extern Signal exec_fork_coverage (uint64 timeout, int stdin_size, byte[] stdin_data)
-[<DllImport("libexec.dll")>] extern Signal exec_fork_branch (uint64 timeout, int stdin_size, byte[] stdin_data, uint64 targ_addr, uint32 targ_index, int measure_cov)
+[<DllImport("libexec.dll")>] extern Signal exec_fork_coverage (int id, uint64 timeout, int stdin_size, byte[] stdin_data)
+[<DllImport("libexec.dll")>] extern Signal exec_fork_branch (int id, uint64 timeout, int stdin_size, byte[] stdin_data, uint64 targ_addr, uint32 targ_index, int measure_cov)
+[<DllImport("libexec.dll")>] extern Signal exec_triage (int argc, string[] argv, int stdin_size, byte[] stdin_data, uint64 timeout)
+
+/// Execution context owned by a fuzzing worker. In parallel mode, each worker
+/// thread runs its own pair of fork servers, which write to their own log
+/// files. The edge coverage bitmap is shared by all the workers.
+type private ExecInstance = {
+  Id : int
+  BranchLog : string
+  CoverageLog : string
+  BranchTargets : string
+  ReferenceTrace : string
+  EdgeBitmap : string // Used only if private bitmaps are enabled.
+  mutable ForkServerOn : bool
+  mutable ForkServerCpu : int // CPU that the fork servers are pinned to.
+  mutable FileInputOn : bool // File input is passed to the tracers via memfd.
+  mutable SleepDebt : float
+  mutable PathHash : uint64 // Reported by the last execution of the tracers.
+}
 
-let mutable private branchLog = ""
-let mutable private coverageLog = ""
+let mutable private outDir = ""
 let mutable private bitmapLog = ""
+let mutable private tracerStatsLog = ""
 let mutable private dbgLog = ""
-let mutable private forkServerOn = false
 let mutable private roundStatisticsOn = false
-let mutable private roundExecs = 0
+let mutable private privateBitmapsOn = false
+let private roundExecs = ref 0
+let private instances = new ConcurrentDictionary<int,ExecInstance> ()
+// ID of the execution instance that the current thread is bound to.
+let private boundId = new ThreadLocal<int>(fun () -> 0)
+// CPU that the current thread is pinned to, inherited by its fork servers.
+let private pinnedCpu = new ThreadLocal<int>(fun () -> -1)
+// Environment variables are process-wide, so fork servers that inherit them
+// should be initialized one at a time.
+let private forkServerLock = obj ()
 
 (*** Tracer and file paths ***)
 
@@ -58,67 +116,238 @@ let readAllLines filename =
   try List.ofSeq (System.IO.File.ReadLines filename) with
   | :? System.IO.FileNotFoundException -> []
 
-(*** Initialization and cleanup ***)
+// Path of a per-instance file. Instance 0 keeps the original path, so that
+// the file names do not change when fuzzing with a single worker.
+let private instancePath (path: string) id =
+  if id = 0 then path else sprintf "%s_%d" path id
+
+let private getInstance () = instances.[boundId.Value]
 
-let private initializeForkServer opt =
-  forkServerOn <- true
+let private makeInstance id =
+  { Id = id
+    BranchLog = instancePath (Path.Combine(outDir, ".branch")) id
+    CoverageLog = instancePath (Path.Combine(outDir, ".coverage")) id
+    BranchTargets = instancePath (Path.Combine(outDir, ".branch_targets")) id
+    ReferenceTrace = instancePath (Path.Combine(outDir, ".reference_trace")) id
+    EdgeBitmap = instancePath (Path.Combine(outDir, ".edge_bitmap")) id
+    ForkServerOn = false
+    ForkServerCpu = -1
+    FileInputOn = false
+    SleepDebt = 0.0
+    PathHash = 0UL }
+
+// Command line arguments for an instance. A file input is written to its own
+// path per instance (cf. setupFile), so replace the path in the command line.
+let private buildCmdLine opt id =
   let cmdLine = splitCmdLineArg opt.Arg
-  let coverageTracer = selectTracer Coverage opt.Architecture
-  let args = Array.append [|coverageTracer; opt.TargetProg|] cmdLine
-  let pidCoverage = init_forkserver_coverage(args.Length, args, opt.ExecTimeout)
-  if pidCoverage = -1 then
-    failwith "Failed to initialize fork server for coverage tracer"
-  let branchTracer = selectTracer Branch opt.Architecture
-  let args = Array.append [|branchTracer; opt.TargetProg|] cmdLine
-  let pidBranch = init_forkserver_branch (args.Length, args, opt.ExecTimeout)
-  if pidBranch = -1 then
-    failwith "Failed to initialize fork server for branch tracer"
+  match opt.FuzzSource with
+  | FileInput filePath when id <> 0 ->
+    let replacer arg = if arg = filePath then instancePath arg id else arg
+    Array.map replacer cmdLine
+  | _ -> cmdLine
+
+(*** Initialization and cleanup ***)
+
+// Table of the branch points to probe in a single execution, which consists of
+// the number of the points and an entry of six 64-bit fields for each point.
+let private TARGET_ENTRY_SIZE = 6 * sizeof<uint64>
+let private TARGET_TABLE_SIZE =
+  sizeof<uint64> + MAX_BRANCH_TARGETS * TARGET_ENTRY_SIZE
+
+// Reference trace for the differential trace mode, which consists of its length
+// and the records in the format of the branch trace log. Large enough to hold
+// MAX_TRACE_LEN records of x64 binaries.
+let private REFERENCE_TRACE_SIZE = sizeof<uint64> + MAX_TRACE_LEN * (8 + 1 + 16)
+
+// The branch tracer maps the table and the reference trace before it starts the
+// fork server, so the files should be created along with the environment
+// variables.
+let private setEnvForLogs inst =
+  set_env("ECL_BRANCH_LOG", Path.GetFullPath(inst.BranchLog))
+  set_env("ECL_COVERAGE_LOG", Path.GetFullPath(inst.CoverageLog))
+  use targetsFile = File.Create(inst.BranchTargets)
+  targetsFile.SetLength(int64 TARGET_TABLE_SIZE)
+  set_env("ECL_BRANCH_TARGETS", Path.GetFullPath(inst.BranchTargets))
+  use referenceFile = File.Create(inst.ReferenceTrace)
+  referenceFile.SetLength(int64 REFERENCE_TRACE_SIZE)
+  set_env("ECL_REFERENCE_TRACE", Path.GetFullPath(inst.ReferenceTrace))
+  if privateBitmapsOn then
+    use bitmapFile = File.Create(inst.EdgeBitmap)
+    bitmapFile.SetLength(BITMAP_SIZE)
+    set_env("ECL_BITMAP_LOG", Path.GetFullPath(inst.EdgeBitmap))
+
+// The fork servers inherit a memfd to pass a file input, from which the tracers
+// serve the input file (cf. syscall.diff). The file is still created, so that
+// the target can find it.
+let private setEnvForFileInput opt inst =
+  match opt.FuzzSource with
+  | StdInput -> ()
+  | FileInput filePath ->
+    let path = instancePath filePath inst.Id
+    if not (File.Exists(path)) then writeFile path [| |]
+    if not inst.FileInputOn then inst.FileInputOn <- init_file_input inst.Id = 0
+    if inst.FileInputOn then set_env("ECL_INPUT_FILE", Path.GetFullPath(path))
+
+let private initializeForkServer opt inst =
+  lock forkServerLock (fun () ->
+    setEnvForLogs inst
+    setEnvForFileInput opt inst
+    let cmdLine = buildCmdLine opt inst.Id
+    let coverageTracer = selectTracer Coverage opt.Architecture
+    let args = Array.append [|coverageTracer; opt.TargetProg|] cmdLine
+    let id, timeout = inst.Id, opt.ExecTimeout
+    let pidCoverage = init_forkserver_coverage(id, args.Length, args, timeout)
+    if pidCoverage = -1 then
+      failwith "Failed to initialize fork server for coverage tracer"
+    let branchTracer = selectTracer Branch opt.Architecture
+    let args = Array.append [|branchTracer; opt.TargetProg|] cmdLine
+    let pidBranch = init_forkserver_branch (id, args.Length, args, timeout)
+    if pidBranch = -1 then
+      failwith "Failed to initialize fork server for branch tracer"
+    inst.ForkServerOn <- true
+    inst.ForkServerCpu <- pinnedCpu.Value)
+
+let private killForkServer inst =
+  if inst.ForkServerOn then
+    inst.ForkServerOn <- false
+    kill_forkserver inst.Id
+
+/// Let each execution instance have its own edge bitmap instead of the shared
+/// one, to find the edges covered by a single execution (cf. getEdgeBitmap).
+/// Should be called before initialize(), and requires the fork server.
+let usePrivateBitmaps () = privateBitmapsOn <- true
 
 let initialize opt =
-  let outDir = opt.OutDir
+  outDir <- opt.OutDir
+  let inst = makeInstance 0
+  instances.[0] <- inst
   // Set environment variables for the instrumentor.
-  branchLog <- System.IO.Path.Combine(outDir, ".branch")
-  coverageLog <- System.IO.Path.Combine(outDir, ".coverage")
+  setEnvForLogs inst
   bitmapLog <- System.IO.Path.Combine(outDir, ".bitmap")
   dbgLog <- System.IO.Path.Combine(outDir, ".debug")
-  set_env("ECL_BRANCH_LOG", System.IO.Path.GetFullPath(branchLog))
-  set_env("ECL_COVERAGE_LOG", System.IO.Path.GetFullPath(coverageLog))
   use bitmapFile = File.Create(bitmapLog)
   bitmapFile.SetLength(BITMAP_SIZE)
   set_env("ECL_BITMAP_LOG", System.IO.Path.GetFullPath(bitmapLog))
+  // Tracer stats page has a slot for each of coverage and branch tracer.
+  tracerStatsLog <- System.IO.Path.Combine(outDir, ".tracer_stats")
+  use statsFile = File.Create(tracerStatsLog)
+  statsFile.SetLength(int64 (2 * TRACER_STAT_COUNT * sizeof<uint64>))
+  set_env("ECL_TRACER_STATS", System.IO.Path.GetFullPath(tracerStatsLog))
   initialize_exec ()
+  set_env("ECL_SNAPSHOT", if opt.Snapshot then "1" else "0")
   if opt.ForkServer then
     set_env("ECL_FORK_SERVER", "1")
-    initializeForkServer opt
+    initializeForkServer opt inst
   else
     set_env("ECL_FORK_SERVER", "0")
 
-let abandonForkServer () =
+/// Bind the calling thread to the execution instance of worker 'id', and pin
+/// the thread to a CPU core. The fork servers of the instance are restarted
+/// from this thread, so that they inherit the CPU affinity, unless they were
+/// already started on the same CPU (e.g. while calibrating the initial seeds).
+let initializeWorker opt id =
+  let cpu = id % Environment.ProcessorCount
+  if set_cpu_affinity cpu = 0 then pinnedCpu.Value <- cpu
+  else log "[Warning] Failed to pin worker %d to CPU %d" id cpu
+  let inst = instances.GetOrAdd(id, makeInstance)
+  if not inst.ForkServerOn || inst.ForkServerCpu <> pinnedCpu.Value then
+    killForkServer inst
+    initializeForkServer opt inst
+  boundId.Value <- id
+
+let private abandonForkServer inst =
   log "Abandon fork server"
-  forkServerOn <- false
   set_env("ECL_FORK_SERVER", "0")
-  kill_forkserver ()
+  killForkServer inst
+
+// With multiple workers, every worker should keep its fork servers, since the
+// non-fork-server mode relies on process-wide environment variables. The same
+// applies to helper instances, which run along with the workers.
+let private handleForkServerError opt inst =
+  if opt.Jobs > 1 || inst.Id >= MAX_JOBS then
+    log "[Warning] Restart fork server of worker %d" inst.Id
+    killForkServer inst
+    initializeForkServer opt inst
+  else abandonForkServer inst
 
 let cleanup () =
-  if forkServerOn then kill_forkserver ()
-  removeFile branchLog
-  removeFile coverageLog
+  for inst in instances.Values do
+    killForkServer inst
+    removeFile inst.BranchLog
+    removeFile inst.CoverageLog
+    removeFile inst.BranchTargets
+    removeFile inst.ReferenceTrace
+    removeFile inst.EdgeBitmap
   removeFile bitmapLog
+  removeFile tracerStatsLog
   removeFile dbgLog
 
+let getBitmapLog () = bitmapLog
+
+(*** Tracer statistics ***)
+
+let private tracerStatsSlot = function
+  | Coverage -> 0
+  | Branch -> 1
+  | BBCount -> failwith "BBCount tracer does not report statistics"
+
+/// Read the counters of 'tracer' from the shared stats page. The counters are
+/// updated by the tracers concurrently, so they may be slightly inconsistent.
+let getTracerStats tracer =
+  let offset = tracerStatsSlot tracer * TRACER_STAT_COUNT * sizeof<uint64>
+  use f = new FileStream(tracerStatsLog, FileMode.Open, FileAccess.Read,
+                         FileShare.ReadWrite)
+  use r = new BinaryReader(f)
+  f.Seek(int64 offset, SeekOrigin.Begin) |> ignore
+  let counters = Array.init TRACER_STAT_COUNT (fun _ -> r.ReadUInt64())
+  { ForkedExecs = counters.[0]
+    ForkNanosecs = counters.[1]
+    ExecNanosecs = counters.[2]
+    TSLRequests = counters.[3]
+    TSLMirrored = counters.[4]
+    TBTranslated = counters.[5]
+    CmpLogged = counters.[6]
+    TraceAborts = counters.[7] }
+
 (*** Execution count statistics ***)
 
 let enableRoundStatistics () = roundStatisticsOn <- true
 
 let disableRoundStatistics () = roundStatisticsOn <- false
 
-let getRoundExecs () = roundExecs
+let getRoundExecs () = !roundExecs
 
 // Increment only if roundStatisticsOn flag is set. We don't want the executions
 // for the synchronization with AFL to affect the efficiency calculation.
-let incrRoundExecs () = if roundStatisticsOn then roundExecs <- roundExecs + 1
+let incrRoundExecs () =
+  if roundStatisticsOn then Interlocked.Increment(roundExecs) |> ignore
+
+let resetRoundExecs () = Interlocked.Exchange(roundExecs, 0) |> ignore
+
+(*** Execution throttling ***)
 
-let resetRoundExecs () = roundExecs <- 0
+let mutable private sleepFactor = 0.0
+
+/// Set the ratio of sleep time to execution time. This is used to share the
+/// system resource with AFL instances (cf. Scheduler.fs).
+let setSleepFactor factor =
+  sleepFactor <- factor
+  if factor = 0.0 then for inst in instances.Values do inst.SleepDebt <- 0.0
+
+let getSleepFactor () = sleepFactor
+
+// Accumulate the time to yield for an execution started at 'startTick', and
+// sleep when the accumulated time exceeds a time slice.
+let private throttle inst startTick =
+  if sleepFactor > 0.0 then
+    let ticks = Diagnostics.Stopwatch.GetTimestamp() - startTick
+    let elapsed = float ticks * 1000.0 / float Diagnostics.Stopwatch.Frequency
+    inst.SleepDebt <- inst.SleepDebt + elapsed * sleepFactor
+    if inst.SleepDebt >= THROTTLE_SLICE_MS then
+      let sleepTime = int inst.SleepDebt
+      Thread.Sleep(sleepTime)
+      Stats.addPhaseMillisecs Stats.Sleep sleepTime
+      inst.SleepDebt <- inst.SleepDebt - float sleepTime
 
 (*** Setup functions ***)
 
@@ -127,10 +356,20 @@ let private setEnvForBranch (addr: uint64) (idx: uint32) covMeasure =
   set_env("ECL_BRANCH_IDX", sprintf "%016x" idx)
   set_env("ECL_MEASURE_COV", sprintf "%d" (CoverageMeasure.toEnum covMeasure))
 
-let private setupFile seed =
+let private writeInputFile inst seed =
   match seed.Source with
   | StdInput -> ()
-  | FileInput filePath -> writeFile filePath (Seed.concretize seed)
+  | FileInput filePath ->
+    writeFile (instancePath filePath inst.Id) (Seed.concretize seed)
+
+// The tracers forked by the fork servers read a file input from the memfd, so
+// avoid writing it to the filesystem.
+let private setupFile inst seed =
+  match seed.Source with
+  | FileInput _ when inst.ForkServerOn && inst.FileInputOn ->
+    let input = Seed.concretize seed
+    write_file_input(inst.Id, input.Length, input)
+  | _ -> writeInputFile inst seed
 
 let private prepareStdIn seed =
   match seed.Source with
@@ -139,32 +378,48 @@ let private prepareStdIn seed =
 
 (*** Tracer result parsing functions ***)
 
-// TODO. Currently we only support edge coverage gain. Will extend the system
-// to support path coverage gain if needed.
-let private parseCoverage filename =
-  match readAllLines filename with
-  | [newEdgeFlag; _] -> if int newEdgeFlag = 1 then NewEdge else NoGain
-  | x -> log "[Warning] Coverage logging failed : %A" x; NoGain
+// The coverage log holds the new edge flag and the hash of the executed path
+// (cf. path_hash of eclipser.c). The hash is kept in the instance, to be
+// queried with getPathHash(). Zero means that the hash is not available.
+let private parseCoverage inst =
+  match readAllLines inst.CoverageLog with
+  | [newEdgeFlag; pathHash] ->
+    inst.PathHash <- Convert.ToUInt64(pathHash, 16)
+    if int newEdgeFlag = 1 then NewEdge else NoGain
+  | x ->
+    inst.PathHash <- 0UL
+    log "[Warning] Coverage logging failed : %A" x
+    NoGain
+
+/// Return the path hash reported by the last execution of the tracers in the
+/// current thread, or zero if the coverage was not measured.
+let getPathHash () = (getInstance ()).PathHash
 
 let private is64Bit = function
   | X86 -> false
   | X64 -> true
 
+// The upper 2 bits of the type information are the kind of the comparison,
+// and the remaining bits are the operand size.
+let private decodeBranchType typeInfo =
+  match typeInfo >>> 6 with
+  | 0 -> Equality
+  | 1 -> SignedSize
+  | 2 -> UnsignedSize
+  | _ -> log "[Warning] Unexpected branch type"; failwith "Unmatched"
+
+let private readAddr opt (r: BinaryReader) =
+  if is64Bit opt.Architecture then r.ReadUInt64() else uint64 (r.ReadUInt32())
+
 let private parseBranchTraceLog opt (r:BinaryReader) tryVal =
-  let arch = opt.Architecture
   let addr =
-    try if is64Bit arch then r.ReadUInt64() else uint64 (r.ReadUInt32 ()) with
+    try readAddr opt r with
     | :? EndOfStreamException -> 0UL
   if addr = 0UL then None else
     try
       let typeInfo = int(r.ReadByte())
       let opSize = typeInfo &&& 0x3f
-      let brType =
-        match typeInfo >>> 6 with
-        | 0 -> Equality
-        | 1 -> SignedSize
-        | 2 -> UnsignedSize
-        | _ -> log "[Warning] Unexpected branch type"; failwith "Unmatched"
+      let brType = decodeBranchType typeInfo
       let oprnd1, oprnd2 =
         match opSize with
         | 1 -> uint64 (r.ReadByte()), uint64 (r.ReadByte())
@@ -179,100 +434,857 @@ let private parseBranchTraceLog opt (r:BinaryReader) tryVal =
       Some branchInfo
     with _ -> None
 
-let private readBranchTrace opt filename tryVal =
+let private parseBranchTrace opt (r: BinaryReader) tryVal =
+  let mutable valid = true
+  [while valid do
+    match parseBranchTraceLog opt r tryVal with
+    | None -> valid <- false
+    | Some branchInfo -> yield branchInfo ]
+
+/// Parse the branch trace log written by the branch tracer. The trace ends with
+/// a zero address, which is followed by the total visits of the sites that the
+/// tracer stopped logging (cf. MAX_SITE_LOGS in eclipser.c).
+let readBranchTrace opt filename tryVal =
   try
     let f = File.Open(filename, FileMode.Open, FileAccess.Read, FileShare.Read)
     use r = new BinaryReader(f)
-    let mutable valid = true
-    [while valid do
-      match parseBranchTraceLog opt r tryVal with
-      | None -> valid <- false
-      | Some branchInfo -> yield branchInfo ]
+    parseBranchTrace opt r tryVal
   with | :? FileNotFoundException -> []
 
+// Parse the calls to the string comparison functions, which are logged at the
+// end of the log in the full trace mode and the differential trace mode (cf.
+// MAX_STRCMP_LOGS in eclipser.c). Each record consists of the call site, the
+// lengths of the two operands, and the operands.
+let private parseStringCompares opt (r: BinaryReader) tryVal =
+  let rec loop acc =
+    let site = readAddr opt r
+    if site = 0UL then List.rev acc
+    else
+      let len1 = int (r.ReadByte())
+      let len2 = int (r.ReadByte())
+      let buf1 = r.ReadBytes(len1)
+      let buf2 = r.ReadBytes(len2)
+      if buf1.Length <> len1 || buf2.Length <> len2 then
+        raise (EndOfStreamException())
+      let strCmp =
+        { CallSite = site; TryVal = tryVal; Buf1 = buf1; Buf2 = buf2 }
+      loop (strCmp :: acc)
+  try loop [] with :? EndOfStreamException -> []
+
+// Same as readBranchTrace(), but also read the string comparisons that follow
+// the total visits of the sites.
+let private readFullTrace opt filename tryVal =
+  try
+    let f = File.Open(filename, FileMode.Open, FileAccess.Read, FileShare.Read)
+    use r = new BinaryReader(f)
+    let trace = parseBranchTrace opt r tryVal
+    let strCmps =
+      try
+        while readAddr opt r <> 0UL do r.ReadUInt32() |> ignore
+        parseStringCompares opt r tryVal
+      with :? EndOfStreamException -> []
+    (trace, strCmps)
+  with | :? FileNotFoundException -> ([], [])
+
+// Marks the end of the log in the differential trace mode.
+let private DIFF_TRAILER = UInt32.MaxValue
+
+// Parse the branch trace log written in the differential trace mode, where
+// each logged record is preceded by its index in the trace. The records that
+// are not logged are the same as the reference trace, except for 'tryVal'.
+let private readBranchTraceDiff opt filename tryVal (refTrace: BranchInfo []) =
+  try
+    let f = File.Open(filename, FileMode.Open, FileAccess.Read, FileShare.Read)
+    use r = new BinaryReader(f)
+    let deltas = Collections.Generic.Dictionary<int, BranchInfo>()
+    let rec readDeltas () =
+      let idx = r.ReadUInt32()
+      if idx = DIFF_TRAILER then (int (r.ReadUInt32()), int (r.ReadUInt32()))
+      else
+        match parseBranchTraceLog opt r tryVal with
+        | None -> raise (EndOfStreamException())
+        | Some branchInfo -> deltas.[int idx] <- branchInfo; readDeltas ()
+    let traceLen, divergeIdx = readDeltas ()
+    let trace =
+      [ for idx in 0 .. traceLen - 1 do
+          match deltas.TryGetValue(idx) with
+          | true, branchInfo -> yield branchInfo
+          | false, _ when idx < divergeIdx && idx < refTrace.Length ->
+            yield { refTrace.[idx] with TryVal = tryVal }
+          | false, _ -> () ]
+    (trace, parseStringCompares opt r tryVal)
+  with | :? FileNotFoundException | :? EndOfStreamException -> ([], [])
+
 let private tryReadBranchInfo opt filename tryVal =
   match readBranchTrace opt filename tryVal with
   | [] -> None
   | [ branchInfo ] -> Some branchInfo
   | _ -> None
 
+(*** Branch target table functions ***)
+
+// Target address that makes the branch tracer probe the points in the table.
+let private MULTI_TARGET_ADDR = UInt64.MaxValue
+
+// The tracer looks up the table with binary search, so 'targPts' should be
+// sorted by the address. Fields for the result of each point are cleared.
+let private writeTargetTable inst (targPts: BranchPoint array) =
+  use f = new FileStream(inst.BranchTargets, FileMode.Open, FileAccess.Write,
+                         FileShare.ReadWrite)
+  use w = new BinaryWriter(f)
+  w.Write(uint64 targPts.Length)
+  for targPt in targPts do
+    w.Write(targPt.Addr)
+    w.Write(uint64 targPt.Idx)
+    for _ in 1 .. 4 do w.Write(0UL) // Hit flag, type, and two operands.
+
+let private readTargetTable inst tryVal (targPts: BranchPoint array) =
+  use f = new FileStream(inst.BranchTargets, FileMode.Open, FileAccess.Read,
+                         FileShare.ReadWrite)
+  use r = new BinaryReader(f)
+  f.Seek(int64 sizeof<uint64>, SeekOrigin.Begin) |> ignore
+  let readEntry (targPt: BranchPoint) =
+    let fields = Array.init 6 (fun _ -> r.ReadUInt64())
+    if fields.[2] = 0UL then None else
+      let typeInfo = int fields.[3]
+      let oprnd1, oprnd2 = fields.[4], fields.[5]
+      Some { InstAddr = targPt.Addr; BrType = decodeBranchType typeInfo
+             TryVal = tryVal; OpSize = typeInfo &&& 0x3f; Oprnd1 = oprnd1
+             Oprnd2 = oprnd2; Distance = (bigint oprnd1) - (bigint oprnd2) }
+  Array.map readEntry targPts
+
+(*** Reference trace functions ***)
+
+// Target address that makes the branch tracer log the difference from the
+// reference trace.
+let private DIFF_TRACE_ADDR = UInt64.MaxValue - 1UL
+
+// Length of the branch trace at the beginning of a full trace log, i.e. the
+// offset of the null address that ends the trace. The site visits and the
+// string comparisons follow it (cf. readFullTrace).
+let private getTraceLength addrSize (log: byte array) =
+  let rec loop pos =
+    if pos + addrSize > log.Length then log.Length
+    elif Array.forall ((=) 0uy) log.[pos .. pos + addrSize - 1] then pos
+    elif pos + addrSize >= log.Length then log.Length
+    else
+      let opSize = int log.[pos + addrSize] &&& 0x3f
+      loop (pos + addrSize + 1 + 2 * opSize)
+  min (loop 0) log.Length
+
+// Copy the branch trace of the last execution to the reference trace. The
+// tracer maps the file with a fixed size, so it should not be truncated.
+let private writeReferenceTrace opt inst =
+  let addrSize = if is64Bit opt.Architecture then 8 else 4
+  let log = try File.ReadAllBytes(inst.BranchLog) with
+            | :? FileNotFoundException -> [| |]
+  // Exclude the null address at the end of the trace, and the records after.
+  let maxLen = REFERENCE_TRACE_SIZE - sizeof<uint64>
+  let len = min (getTraceLength addrSize log) maxLen
+  use f = new FileStream(inst.ReferenceTrace, FileMode.Open, FileAccess.Write,
+                         FileShare.ReadWrite)
+  use w = new BinaryWriter(f)
+  w.Write(uint64 len)
+  w.Write(log, 0, len)
+
 (*** Tracer execution functions ***)
 
-let private runTracer tracerType opt (stdin: byte array) =
+// Record the latency of an execution started at 'startTick', to adapt the
+// timeout of the mode (cf. ExecTimeout.fs).
+let private recordLatency opt mode startTick signal =
+  if signal <> Signal.ERROR then
+    let ticks = Diagnostics.Stopwatch.GetTimestamp() - startTick
+    let elapsed = float ticks * 1000.0 / float Diagnostics.Stopwatch.Frequency
+    ExecTimeout.record opt mode elapsed (Signal.isTimeout signal)
+
+let private runTracer tracerType mode opt inst (stdin: byte array) =
   incrRoundExecs ()
   let targetProg = opt.TargetProg
-  let timeout = opt.ExecTimeout
+  let timeout = ExecTimeout.get opt mode
   let tracer = selectTracer tracerType opt.Architecture
-  let cmdLine = splitCmdLineArg opt.Arg
+  let cmdLine = buildCmdLine opt inst.Id
   let args = Array.append [|tracer; targetProg|] cmdLine
   let argc = args.Length
-  exec(argc, args, stdin.Length, stdin, timeout)
+  let startTick = Diagnostics.Stopwatch.GetTimestamp()
+  let signal = exec(argc, args, stdin.Length, stdin, timeout)
+  recordLatency opt mode startTick signal
+  throttle inst startTick
+  signal
 
-let private runCoverageTracerForked opt stdin =
+let private runCoverageTracerForked opt inst stdin =
   incrRoundExecs ()
-  let timeout = opt.ExecTimeout
+  let timeout = ExecTimeout.get opt Stats.CoverageExec
   let stdLen = Array.length stdin
-  let signal = exec_fork_coverage(timeout, stdLen, stdin)
-  if signal = Signal.ERROR then abandonForkServer ()
+  let startTick = Diagnostics.Stopwatch.GetTimestamp()
+  let signal = exec_fork_coverage(inst.Id, timeout, stdLen, stdin)
+  recordLatency opt Stats.CoverageExec startTick signal
+  throttle inst startTick
+  if signal = Signal.ERROR then handleForkServerError opt inst
   signal
 
-let private runBranchTracerForked opt stdin addr idx covMeasure =
+let private runBranchTracerForked mode opt inst stdin addr idx covMeasure =
   incrRoundExecs ()
-  let timeout = opt.ExecTimeout
+  let timeout = ExecTimeout.get opt mode
   let stdLen = Array.length stdin
   let covEnum = CoverageMeasure.toEnum covMeasure
-  let signal = exec_fork_branch(timeout, stdLen, stdin, addr, idx, covEnum)
-  if signal = Signal.ERROR then abandonForkServer ()
+  let startTick = Diagnostics.Stopwatch.GetTimestamp()
+  let id = inst.Id
+  let signal = exec_fork_branch(id, timeout, stdLen, stdin, addr, idx, covEnum)
+  recordLatency opt mode startTick signal
+  throttle inst startTick
+  if signal = Signal.ERROR then handleForkServerError opt inst
   signal
 
 (*** Top-level tracer execution functions ***)
 
-let getCoverage opt seed =
-  setupFile seed
+// Hashes of the paths that found new edges with the coverage tracer.
+let private queuedPaths = new ConcurrentDictionary<uint64,byte> ()
+
+// Workers that run inputs of the same path at the same time may claim its new
+// edges separately, and both find new edges. Report the gain only for the first
+// one, so that the seed queue does not get the same path twice.
+let private dropQueuedPath inst coverageGain =
+  if coverageGain <> NewEdge || inst.PathHash = 0UL then coverageGain
+  elif queuedPaths.TryAdd(inst.PathHash, 0uy) then NewEdge
+  else NoGain
+
+let private getCoverageAux opt seed =
+  Stats.incrExecCount Stats.CoverageExec
+  let inst = getInstance ()
+  setupFile inst seed
   let stdin = prepareStdIn seed
-  let exitSig = if forkServerOn then runCoverageTracerForked opt stdin
-                else runTracer Coverage opt stdin
-  let coverageGain = parseCoverage coverageLog
+  let exitSig = if inst.ForkServerOn then runCoverageTracerForked opt inst stdin
+                else runTracer Coverage Stats.CoverageExec opt inst stdin
+  let coverageGain = parseCoverage inst |> dropQueuedPath inst
   (exitSig, coverageGain)
 
-let getBranchTrace opt seed tryVal =
-  setupFile seed
+/// Return the edges covered by the execution of 'seed', as a bitmap in the
+/// format of the coverage tracer. The private edge bitmap of the instance is
+/// cleared in place before the execution, since the fork server has mapped it.
+let getEdgeBitmap opt seed =
+  let inst = getInstance ()
+  if not privateBitmapsOn then failwith "Private edge bitmaps are not enabled"
+  using (new FileStream(inst.EdgeBitmap, FileMode.Open, FileAccess.Write,
+                        FileShare.ReadWrite)) (fun f ->
+    f.Write(Array.zeroCreate (int BITMAP_SIZE), 0, int BITMAP_SIZE))
+  let exitSig, _ = getCoverageAux opt seed
+  (exitSig, File.ReadAllBytes(inst.EdgeBitmap))
+
+let private runFullTrace opt seed tryVal =
+  let mode = Stats.BranchTraceExec
+  Stats.incrExecCount mode
+  let inst = getInstance ()
+  setupFile inst seed
   let stdin = prepareStdIn seed
   let exitSig =
-    if forkServerOn then runBranchTracerForked opt stdin 0UL 0ul NonCumulative
-    else setEnvForBranch 0UL 0ul NonCumulative; runTracer Branch opt stdin
-  let coverageGain = parseCoverage coverageLog
-  let branchTrace = readBranchTrace opt branchLog tryVal
-  removeFile coverageLog
+    if inst.ForkServerOn then
+      runBranchTracerForked mode opt inst stdin 0UL 0ul NonCumulative
+    else setEnvForBranch 0UL 0ul NonCumulative
+         runTracer Branch mode opt inst stdin
+  let coverageGain = parseCoverage inst
+  let branchTrace, strCmps = readFullTrace opt inst.BranchLog tryVal
+  removeFile inst.CoverageLog
+  (exitSig, coverageGain, branchTrace, strCmps)
+
+let getBranchTrace opt seed tryVal =
+  let exitSig, coverageGain, branchTrace, _ = runFullTrace opt seed tryVal
   (exitSig, coverageGain, branchTrace)
 
-let getBranchInfo opt seed tryVal targPoint =
-  setupFile seed
+let private getReferenceTraceAux opt seed tryVal =
+  let result = runFullTrace opt seed tryVal
+  writeReferenceTrace opt (getInstance ())
+  result
+
+// Rebuild the trace of an execution of the same path, with 'tryVal'.
+let private withTryVal tryVal (trace, strCmps) =
+  (List.map (fun (b: BranchInfo) -> { b with TryVal = tryVal }) trace,
+   List.map (fun (s: StringCompare) -> { s with TryVal = tryVal }) strCmps)
+
+let private getBranchTraceDiffAux opt seed tryVal (refTrace: BranchInfo [])
+    (knownTraces: Collections.Generic.Dictionary<_, _>) =
+  let mode = Stats.BranchTraceExec
+  Stats.incrExecCount mode
+  let inst = getInstance ()
+  setupFile inst seed
+  let stdin = prepareStdIn seed
+  let addr = DIFF_TRACE_ADDR
+  let exitSig =
+    if inst.ForkServerOn then
+      runBranchTracerForked mode opt inst stdin addr 0ul NonCumulative
+    else setEnvForBranch addr 0ul NonCumulative
+         runTracer Branch mode opt inst stdin
+  let coverageGain = parseCoverage inst
+  let branchTrace, strCmps =
+    match knownTraces.TryGetValue(inst.PathHash) with
+    | true, known -> withTryVal tryVal known
+    | false, _ ->
+      let result = readBranchTraceDiff opt inst.BranchLog tryVal refTrace
+      if inst.PathHash <> 0UL then knownTraces.[inst.PathHash] <- result
+      result
+  removeFile inst.CoverageLog
+  (exitSig, coverageGain, branchTrace, strCmps)
+
+let private getBranchInfoAux opt seed tryVal targPoint =
+  let mode = Stats.BranchInfoExec
+  Stats.incrExecCount mode
+  let inst = getInstance ()
+  setupFile inst seed
   let stdin = prepareStdIn seed
   let addr, idx = targPoint.Addr, uint32 targPoint.Idx
   let exitSig =
-    if forkServerOn then runBranchTracerForked opt stdin addr idx Cumulative
-    else setEnvForBranch addr idx Cumulative; runTracer Branch opt stdin
-  let coverageGain = parseCoverage coverageLog
-  let branchInfoOpt = tryReadBranchInfo opt branchLog tryVal
-  removeFile coverageLog
+    if inst.ForkServerOn then
+      runBranchTracerForked mode opt inst stdin addr idx Cumulative
+    else setEnvForBranch addr idx Cumulative
+         runTracer Branch mode opt inst stdin
+  let coverageGain = parseCoverage inst
+  let branchInfoOpt = tryReadBranchInfo opt inst.BranchLog tryVal
+  removeFile inst.CoverageLog
   (exitSig, coverageGain, branchInfoOpt)
 
-let getBranchInfoOnly opt seed tryVal targPoint =
-  setupFile seed
+let private getBranchInfoOnlyAux opt seed tryVal targPoint =
+  let mode = Stats.BranchInfoExec
+  Stats.incrExecCount mode
+  let inst = getInstance ()
+  setupFile inst seed
   let stdin = prepareStdIn seed
   let addr, idx = targPoint.Addr, uint32 targPoint.Idx
-  if forkServerOn then runBranchTracerForked opt stdin addr idx Ignore
-  else setEnvForBranch addr idx Ignore; runTracer Branch opt stdin
+  if inst.ForkServerOn then
+    runBranchTracerForked mode opt inst stdin addr idx Ignore
+  else setEnvForBranch addr idx Ignore
+       runTracer Branch mode opt inst stdin
+  |> ignore
+  tryReadBranchInfo opt inst.BranchLog tryVal
+
+let private getBranchInfosAux opt seed tryVal (targPts: BranchPoint list) =
+  if List.length targPts > MAX_BRANCH_TARGETS then
+    failwith "Too many branch points to probe at once"
+  let mode = Stats.BranchInfoExec
+  Stats.incrExecCount mode
+  let inst = getInstance ()
+  setupFile inst seed
+  let stdin = prepareStdIn seed
+  let sortedPts = List.sortBy (fun targPt -> targPt.Addr) targPts
+                  |> Array.ofList
+  writeTargetTable inst sortedPts
+  let addr = MULTI_TARGET_ADDR
+  if inst.ForkServerOn then
+    runBranchTracerForked mode opt inst stdin addr 0ul Ignore
+  else setEnvForBranch addr 0ul Ignore
+       runTracer Branch mode opt inst stdin
   |> ignore
-  tryReadBranchInfo opt branchLog tryVal
+  let results = readTargetTable inst tryVal sortedPts
+  let resultMap = Array.zip sortedPts results |> Map.ofArray
+  List.map (fun targPt -> Map.find targPt resultMap) targPts
+
+(*** Execution recording and replay ***)
+
+// The executions during the grey-box concolic testing of a seed (a round) can
+// be recorded into a log, and answered from the log later without running the
+// tracers, to benchmark the solver deterministically (cf. Replay.fs). The log
+// starts with a header, which is followed by the rounds. A round consists of
+// the seed of the random generator, the fuzzed seed, and the records of the
+// executions. A record holds a request (the kind of the execution, 'tryVal',
+// the branch points and the input), the path hash and the result. An input of
+// the same length as the fuzzed seed is encoded as the bytes that differ.
+
+let private LOG_MAGIC = 0x45435250u // "ECRP"
+let private LOG_VERSION = 1
+
+// Kinds of the requests.
+let private REQ_COVERAGE = 0uy
+let private REQ_REFERENCE_TRACE = 1uy
+let private REQ_TRACE_DIFF = 2uy
+let private REQ_BRANCH_INFO = 3uy
+let private REQ_BRANCH_INFO_ONLY = 4uy
+let private REQ_BRANCH_INFOS = 5uy
+
+/// Raised when a replayed execution is not found in the log.
+exception ReplayMissException
+
+type private ExecRecord = {
+  Request : byte array // Request except for the input.
+  Input : byte array // Encoded input.
+  PathHash : uint64
+  Result : byte array
+}
+
+// Path hashes and results of a request, in the order of the executions.
+type private ReplyQueue = Collections.Generic.Queue<uint64 * byte array>
+
+type private Round = {
+  Header : byte array // Seed of the random generator and the fuzzed seed.
+  BaseInput : byte array // Input of the fuzzed seed, to encode the others.
+  Records : Collections.Generic.List<ExecRecord> // For recording.
+  Replies : Collections.Generic.Dictionary<string, ReplyQueue> // For replay.
+}
+
+let mutable private recordWriter : BinaryWriter = null
+let mutable private replayReader : BinaryReader = null
+let mutable private replayBatched = false
+let private replayedExecs = ref 0L
+let private recordLock = obj ()
+// Round of the calling thread. The helper threads of runBatch() join the round
+// of the calling thread.
+let private currentRound = new ThreadLocal<Round option>()
+
+let private isReplaying () = not (isNull replayReader)
+
+let private toBytes (write: BinaryWriter -> unit) =
+  use m = new MemoryStream()
+  use w = new BinaryWriter(m)
+  write w
+  w.Flush()
+  m.ToArray()
+
+let private ofBytes (read: BinaryReader -> 'a) (bytes: byte array) =
+  use r = new BinaryReader(new MemoryStream(bytes))
+  read r
+
+let private writeBytes (w: BinaryWriter) (bytes: byte array) =
+  w.Write(bytes.Length)
+  w.Write(bytes)
+
+let private readBytes (r: BinaryReader) = r.ReadBytes(r.ReadInt32())
+
+let private writeBigInt (w: BinaryWriter) (x: bigint) =
+  writeBytes w (x.ToByteArray())
+
+let private readBigInt r = bigint (readBytes r)
+
+let private writeList (w: BinaryWriter) writeElem elems =
+  w.Write(List.length elems)
+  List.iter (writeElem w) elems
+
+let private readList (r: BinaryReader) readElem =
+  List.init (r.ReadInt32()) (fun _ -> readElem r)
+
+let private writeOption (w: BinaryWriter) writeElem = function
+  | None -> w.Write(false)
+  | Some elem -> w.Write(true); writeElem w elem
+
+let private readOption (r: BinaryReader) readElem =
+  if r.ReadBoolean() then Some (readElem r) else None
+
+let private writeSignal (w: BinaryWriter) (signal: Signal) = w.Write(int signal)
+
+let private readSignal (r: BinaryReader) : Signal = enum (r.ReadInt32())
+
+let private writeGain (w: BinaryWriter) gain =
+  w.Write(match gain with NoGain -> 0uy | NewPath -> 1uy | NewEdge -> 2uy)
+
+let private readGain (r: BinaryReader) =
+  match r.ReadByte() with
+  | 0uy -> NoGain
+  | 1uy -> NewPath
+  | _ -> NewEdge
+
+let private writeBranchInfo (w: BinaryWriter) (brInfo: BranchInfo) =
+  w.Write(brInfo.InstAddr)
+  w.Write(match brInfo.BrType with
+          | Equality -> 0uy
+          | SignedSize -> 1uy
+          | UnsignedSize -> 2uy)
+  writeBigInt w brInfo.TryVal
+  w.Write(brInfo.OpSize)
+  w.Write(brInfo.Oprnd1)
+  w.Write(brInfo.Oprnd2)
+  writeBigInt w brInfo.Distance
+
+let private readBranchInfo (r: BinaryReader) =
+  let instAddr = r.ReadUInt64()
+  let brType = match r.ReadByte() with
+               | 0uy -> Equality
+               | 1uy -> SignedSize
+               | _ -> UnsignedSize
+  let tryVal = readBigInt r
+  let opSize = r.ReadInt32()
+  let oprnd1 = r.ReadUInt64()
+  let oprnd2 = r.ReadUInt64()
+  { InstAddr = instAddr; BrType = brType; TryVal = tryVal; OpSize = opSize
+    Oprnd1 = oprnd1; Oprnd2 = oprnd2; Distance = readBigInt r }
+
+let private writeStringCompare (w: BinaryWriter) (strCmp: StringCompare) =
+  w.Write(strCmp.CallSite)
+  writeBigInt w strCmp.TryVal
+  writeBytes w strCmp.Buf1
+  writeBytes w strCmp.Buf2
+
+let private readStringCompare (r: BinaryReader) : StringCompare =
+  let callSite = r.ReadUInt64()
+  let tryVal = readBigInt r
+  let buf1 = readBytes r
+  { CallSite = callSite; TryVal = tryVal; Buf1 = buf1; Buf2 = readBytes r }
+
+let private writeTraceResult w (exitSig, covGain, trace, strCmps) =
+  writeSignal w exitSig
+  writeGain w covGain
+  writeList w writeBranchInfo trace
+  writeList w writeStringCompare strCmps
+
+let private readTraceResult r =
+  let exitSig = readSignal r
+  let covGain = readGain r
+  let trace = readList r readBranchInfo
+  (exitSig, covGain, trace, readList r readStringCompare)
+
+// Encode the input as the bytes that differ from 'baseInput', if they have the
+// same length. Otherwise, keep the whole input.
+let private encodeInput (baseInput: byte array) (input: byte array) =
+  toBytes (fun w ->
+    if input.Length <> baseInput.Length then
+      w.Write(0uy)
+      writeBytes w input
+    else
+      let diffs = List.filter (fun i -> input.[i] <> baseInput.[i])
+                    [0 .. input.Length - 1]
+      w.Write(1uy)
+      let writeDiff (w: BinaryWriter) (i: int) =
+        w.Write(i)
+        w.Write(input.[i])
+      writeList w writeDiff diffs)
+
+let private decodeInput (baseInput: byte array) (r: BinaryReader) =
+  if r.ReadByte() = 0uy then readBytes r
+  else
+    let input = Array.copy baseInput
+    let readDiff (r: BinaryReader) =
+      let i = r.ReadInt32()
+      input.[i] <- r.ReadByte()
+    readList r readDiff |> ignore
+    input
+
+let private makeReplyKey request (input: byte array) =
+  Convert.ToBase64String(Array.append request input)
+
+/// Record the executions of the following rounds into the log at 'path'.
+let startRecording opt (path: string) =
+  // Allow replaying the rounds written so far, while fuzzing is in progress.
+  recordWriter <-
+    new BinaryWriter(new FileStream(path, FileMode.Create, FileAccess.Write,
+                                    FileShare.Read))
+  recordWriter.Write(LOG_MAGIC)
+  recordWriter.Write(LOG_VERSION)
+  recordWriter.Write(opt.NSpawn)
+  recordWriter.Write(opt.NSolve)
+  recordWriter.Write(opt.SearchArity)
+  // Whether runBatch() can run in parallel, which decides the search strategy
+  // of the solver (cf. isForkServerOn()).
+  recordWriter.Write(opt.ForkServer)
+  recordWriter.Flush()
+
+/// Start a round of the calling thread, where 'seed' is fuzzed. A no-op unless
+/// the executions are being recorded. The random generator of the thread is
+/// reseeded, so that the replay makes the same random choices.
+let beginRound seed =
+  if not (isNull recordWriter) then
+    let rngSeed = random.Value.Next()
+    random.Value <- Random(rngSeed)
+    let header = toBytes (fun w -> w.Write(rngSeed); Seed.write w seed)
+    currentRound.Value <-
+      Some { Header = header; BaseInput = Seed.concretize seed
+             Records = Collections.Generic.List(); Replies = null }
+
+/// Finish the round of the calling thread, and write it to the log.
+let endRound () =
+  match currentRound.Value with
+  | Some round when not (isReplaying ()) ->
+    currentRound.Value <- None
+    lock recordLock (fun () ->
+      let w = recordWriter
+      if not (isNull w) then
+        w.Write(true)
+        w.Write(round.Header)
+        w.Write(round.Records.Count)
+        for record in round.Records do
+          writeBytes w record.Request
+          writeBytes w record.Input
+          w.Write(record.PathHash)
+          writeBytes w record.Result
+        w.Flush())
+  | _ -> ()
+
+/// Close the log, once the round being written (if any) is complete. The rounds
+/// that finish later are dropped, so that the process can exit anytime after.
+let stopRecording () =
+  lock recordLock (fun () ->
+    if not (isNull recordWriter) then
+      recordWriter.Dispose()
+      recordWriter <- null)
+
+/// Open the log at 'path' to replay its rounds, instead of running the tracers.
+/// Returns N_spawn, N_solve and the search arity of the recording.
+let startReplay (path: string) =
+  instances.[0] <- makeInstance 0
+  let f = File.Open(path, FileMode.Open, FileAccess.Read, FileShare.ReadWrite)
+  replayReader <- new BinaryReader(f)
+  let r = replayReader
+  if r.ReadUInt32() <> LOG_MAGIC || r.ReadInt32() <> LOG_VERSION then
+    failwith "Invalid execution log file"
+  let nSpawn = r.ReadInt32()
+  let nSolve = r.ReadInt32()
+  let searchArity = r.ReadInt32()
+  replayBatched <- r.ReadBoolean()
+  (nSpawn, nSolve, searchArity)
+
+/// Load the next round of the log into the calling thread, and return its seed.
+/// Returns None at the end of the log.
+let nextReplayRound () =
+  let r = replayReader
+  if r.BaseStream.Position >= r.BaseStream.Length || not (r.ReadBoolean()) then
+    None
+  else
+    random.Value <- Random(r.ReadInt32())
+    let seed = Seed.read r
+    let baseInput = Seed.concretize seed
+    let replies = Collections.Generic.Dictionary()
+    for _ in 1 .. r.ReadInt32() do
+      let request = readBytes r
+      let input = readBytes r |> ofBytes (decodeInput baseInput)
+      let pathHash = r.ReadUInt64()
+      let result = readBytes r
+      let key = makeReplyKey request input
+      if not (replies.ContainsKey(key)) then
+        replies.[key] <- ReplyQueue()
+      replies.[key].Enqueue((pathHash, result))
+    currentRound.Value <- Some { Header = [| |]; BaseInput = baseInput
+                                 Records = null; Replies = replies }
+    Some seed
+
+/// Return the number of the executions answered from the log.
+let getReplayedExecs () = !replayedExecs
+
+// Run the execution of the request, or answer it from the log when replaying.
+// The request is identified by 'kind', 'tryVal', 'targPts' and the input.
+let private recordOrReplay kind seed tryVal targPts write read run =
+  match currentRound.Value with
+  | None -> run ()
+  | Some round ->
+    let request = toBytes (fun w ->
+      w.Write(kind: byte)
+      writeBigInt w tryVal
+      writeList w (fun w (pt: BranchPoint) -> w.Write(pt.Addr); w.Write(pt.Idx))
+        targPts)
+    let input = Seed.concretize seed
+    if isReplaying () then
+      match round.Replies.TryGetValue(makeReplyKey request input) with
+      | true, queue when queue.Count > 0 ->
+        let pathHash, result = queue.Dequeue()
+        (getInstance ()).PathHash <- pathHash
+        Interlocked.Increment(replayedExecs) |> ignore
+        ofBytes read result
+      | _ -> raise ReplayMissException
+    else
+      let res = run ()
+      let record = { Request = request
+                     Input = encodeInput round.BaseInput input
+                     PathHash = (getInstance ()).PathHash
+                     Result = toBytes (fun w -> write w res) }
+      lock round.Records (fun () -> round.Records.Add(record))
+      res
+
+let getCoverage opt seed =
+  let write w (exitSig, covGain) = writeSignal w exitSig; writeGain w covGain
+  let read r = let exitSig = readSignal r in (exitSig, readGain r)
+  recordOrReplay REQ_COVERAGE seed 0I [] write read (fun () ->
+    getCoverageAux opt seed)
+
+/// Same as getBranchTrace(), but also keep the trace as the reference trace of
+/// the following getBranchTraceDiff() calls. The calls to the string comparison
+/// functions are returned as well.
+let getReferenceTrace opt seed tryVal =
+  recordOrReplay REQ_REFERENCE_TRACE seed tryVal [] writeTraceResult
+    readTraceResult (fun () -> getReferenceTraceAux opt seed tryVal)
+
+/// Collect a branch trace in the differential trace mode, where the tracer logs
+/// only the records that differ from the reference trace. 'refTrace' should be
+/// the trace returned by the last getReferenceTrace() call. 'knownTraces' maps
+/// path hashes to the traces collected with the same reference trace. If the
+/// execution has a known path, its trace is rebuilt without parsing the log.
+let getBranchTraceDiff opt seed tryVal (refTrace: BranchInfo [])
+    (knownTraces: Collections.Generic.Dictionary<_, _>) =
+  recordOrReplay REQ_TRACE_DIFF seed tryVal [] writeTraceResult readTraceResult
+    (fun () -> getBranchTraceDiffAux opt seed tryVal refTrace knownTraces)
+
+let getBranchInfo opt seed tryVal targPoint =
+  let write w (exitSig, covGain, brInfoOpt) =
+    writeSignal w exitSig
+    writeGain w covGain
+    writeOption w writeBranchInfo brInfoOpt
+  let read r =
+    let exitSig = readSignal r
+    let covGain = readGain r
+    (exitSig, covGain, readOption r readBranchInfo)
+  recordOrReplay REQ_BRANCH_INFO seed tryVal [targPoint] write read (fun () ->
+    getBranchInfoAux opt seed tryVal targPoint)
+
+let getBranchInfoOnly opt seed tryVal targPoint =
+  let write w brInfoOpt = writeOption w writeBranchInfo brInfoOpt
+  let read r = readOption r readBranchInfo
+  recordOrReplay REQ_BRANCH_INFO_ONLY seed tryVal [targPoint] write read
+    (fun () -> getBranchInfoOnlyAux opt seed tryVal targPoint)
+
+/// Probe multiple branch points with a single execution, without measuring the
+/// coverage. Returns the branch information of each point in the given order.
+/// At most MAX_BRANCH_TARGETS points can be probed at once.
+let getBranchInfos opt seed tryVal (targPts: BranchPoint list) =
+  let write w infos =
+    writeList w (fun w infoOpt -> writeOption w writeBranchInfo infoOpt) infos
+  let read r = readList r (fun r -> readOption r readBranchInfo)
+  recordOrReplay REQ_BRANCH_INFOS seed tryVal targPts write read (fun () ->
+    getBranchInfosAux opt seed tryVal targPts)
+
+(*** Batch execution ***)
+
+// Helper instances are shared by all the workers, and take the IDs that follow
+// those of the workers. They are created on demand, up to MAX_HELPERS.
+let private idleHelpers = new ConcurrentBag<int> ()
+let private helperCount = ref 0
+
+let private acquireHelper () =
+  match idleHelpers.TryTake() with
+  | true, id -> Some id
+  | false, _ ->
+    let n = Interlocked.Increment(helperCount)
+    if n <= MAX_HELPERS then Some (MAX_JOBS + n - 1)
+    else Interlocked.Decrement(helperCount) |> ignore
+         None
+
+/// Check if the instance of the calling thread runs with the fork server, which
+/// is required to run a batch in parallel (cf. runBatch). When replaying, check
+/// if it did at the recording.
+let isForkServerOn () =
+  if isReplaying () then replayBatched else (getInstance ()).ForkServerOn
+
+let private bindHelper opt id =
+  let inst = instances.GetOrAdd(id, makeInstance)
+  if not inst.ForkServerOn then initializeForkServer opt inst
+  boundId.Value <- id
+
+/// Run the jobs of a batch concurrently, each with its own execution instance,
+/// and return their results in the given order. The first job runs on the
+/// instance of the calling thread, and the others on helper instances. If the
+/// fork server is disabled or no helper is left, the jobs run one by one on the
+/// calling thread, as well as when replaying.
+let runBatch opt (jobs: (unit -> 'a) array) =
+  let results = Array.zeroCreate jobs.Length
+  let errors = Array.create jobs.Length None
+  let helperExecs = ref 0L
+  let round = currentRound.Value
+  let runJob i () =
+    try results.[i] <- jobs.[i] () with e -> errors.[i] <- Some e
+  let runHelperJob id i () =
+    try
+      bindHelper opt id
+      currentRound.Value <- round
+      runJob i ()
+      Interlocked.Add(helperExecs, Stats.getThreadExecCount ()) |> ignore
+    with e -> errors.[i] <- Some e
+  let startHelper i =
+    if i = 0 || isReplaying () || not (isForkServerOn ()) then None
+    else
+      match acquireHelper () with
+      | None -> None
+      | Some id ->
+        let thread = Thread(runHelperJob id i)
+        thread.Start()
+        Some (id, thread)
+  let helpers = Array.init jobs.Length startHelper
+  Array.iteri (fun i helper -> if Option.isNone helper then runJob i ()) helpers
+  for helperId, thread in Array.choose id helpers do
+    thread.Join()
+    idleHelpers.Add(helperId)
+  Stats.addThreadExecCount !helperExecs
+  match Array.tryPick id errors with
+  | Some e -> raise e
+  | None -> results
+
+(*** Block profiling ***)
+
+// Layout of the table written by the BBCount tracer, which consists of a header
+// of two counters, the entries of the blocks and the entries of the loops.
+// Should be updated along with patches-bbcount/eclipser.c.
+let private BBCOUNT_BLOCK_SLOTS = 1 <<< 16
+let private BBCOUNT_LOOP_SLOTS = 1 <<< 14
+let private BBCOUNT_LOG_SIZE =
+  sizeof<uint64> * (2 + 2 * BBCOUNT_BLOCK_SLOTS + 3 * BBCOUNT_LOOP_SLOTS)
+
+let private readBlockProfile path =
+  use f = File.OpenRead(path)
+  use r = new BinaryReader(f)
+  let executed = r.ReadUInt64()
+  let dropped = r.ReadUInt64()
+  let readBlock _ = let addr = r.ReadUInt64() in (addr, r.ReadUInt64())
+  let blocks = Array.init BBCOUNT_BLOCK_SLOTS readBlock
+               |> Array.filter (fun (addr, _) -> addr <> 0UL)
+  let readLoop _ =
+    let head = r.ReadUInt64()
+    let tail = r.ReadUInt64()
+    ((head, tail), r.ReadUInt64())
+  // The tracer may record a loop in more than one entry, so merge them.
+  let loops = Array.init BBCOUNT_LOOP_SLOTS readLoop
+              |> Array.filter (fun ((head, _), _) -> head <> 0UL)
+              |> Array.groupBy fst
+              |> Array.map (fun ((head, tail), entries) ->
+                   (head, tail, Array.sumBy snd entries))
+  { ExecutedBlocks = executed; DroppedBlocks = dropped; Blocks = blocks
+    Loops = loops }
+
+/// Execute 'seed' with the BBCount tracer, and return the execution counts of
+/// its basic blocks and loops. The tracer is run without the fork server, as
+/// it is only used for one-off profiling.
+let getBlockProfile opt seed =
+  let inst = getInstance ()
+  let bbCountLog = Path.Combine(outDir, ".bbcount")
+  using (File.Create(bbCountLog)) (fun f ->
+    f.SetLength(int64 BBCOUNT_LOG_SIZE))
+  set_env("ECL_BBCOUNT_LOG", Path.GetFullPath(bbCountLog))
+  writeInputFile inst seed
+  let stdin = prepareStdIn seed
+  let tracer = selectTracer BBCount opt.Architecture
+  let cmdLine = buildCmdLine opt inst.Id
+  let args = Array.append [| tracer; opt.TargetProg |] cmdLine
+  let exitSig = exec(args.Length, args, stdin.Length, stdin, opt.ExecTimeout)
+  let profile = readBlockProfile bbCountLog
+  removeFile bbCountLog
+  (exitSig, profile)
 
 let nativeExecute opt seed =
+  Stats.incrExecCount Stats.NativeExec
+  let inst = getInstance ()
   let targetProg = opt.TargetProg
-  setupFile seed
+  writeInputFile inst seed
   let stdin = prepareStdIn seed
-  let timeout = opt.ExecTimeout
-  let cmdLine = splitCmdLineArg opt.Arg
+  let timeout = ExecTimeout.get opt Stats.NativeExec
+  let cmdLine = buildCmdLine opt inst.Id
   let args = Array.append [| targetProg |] cmdLine
   let argc = args.Length
-  exec(argc, args, stdin.Length, stdin, timeout)
+  let startTick = Diagnostics.Stopwatch.GetTimestamp()
+  let signal = exec(argc, args, stdin.Length, stdin, timeout)
+  recordLatency opt Stats.NativeExec startTick signal
+  signal
+
+/// Check if nativeExecuteTriage() can execute the given seed. Since the fuzzing
+/// loop keeps writing to the input file path, a file input should be written to
+/// a separate path, which replaces the original path in the command line.
+let canExecuteTriage opt seed =
+  match seed.Source with
+  | StdInput -> true
+  | FileInput filePath -> Array.contains filePath (splitCmdLineArg opt.Arg)
+
+/// Execute the target program natively from a thread other than the fuzzing
+/// loop (cf. crash triage in TestCase.fs). Should be preceded by a check with
+/// canExecuteTriage().
+let nativeExecuteTriage opt seed =
+  Stats.incrExecCount Stats.NativeExec
+  let cmdLine = splitCmdLineArg opt.Arg
+  let cmdLine, stdin =
+    match seed.Source with
+    | StdInput -> (cmdLine, Seed.concretize seed)
+    | FileInput filePath ->
+      let triagePath = filePath + ".triage"
+      writeFile triagePath (Seed.concretize seed)
+      let replacer arg = if arg = filePath then triagePath else arg
+      (Array.map replacer cmdLine, [| |])
+  let args = Array.append [| opt.TargetProg |] cmdLine
+  let timeout = opt.ExecTimeout
+  exec_triage(args.Length, args, stdin.Length, stdin, timeout)
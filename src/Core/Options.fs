@@ -9,11 +9,16 @@ type FuzzerCLI =
   | [<AltCommandLine("-t")>] [<Unique>] Timelimit of sec: int
   | [<AltCommandLine("-o")>] [<Mandatory>] [<Unique>] OutputDir of path: string
   | [<AltCommandLine("-s")>] [<Unique>] SyncDir of path: string
+  | [<Unique>] Coordinator of addr: string
+  | [<Unique>] Resume
+  | [<Unique>] Record of path: string
   // Options related to program execution.
   | [<AltCommandLine("-p")>] [<Mandatory>] [<Unique>] Program of path: string
   | [<AltCommandLine("-e")>] [<Unique>] ExecTimeout of millisec:uint64
   | [<Unique>] Architecture of string
   | [<Unique>] NoForkServer
+  | [<Unique>] Snapshot
+  | [<AltCommandLine("-j")>] [<Unique>] Jobs of int
   // Options related to seed.
   | [<AltCommandLine("-i")>] [<Unique>] InputDir of path: string
   | [<Unique>] Arg of string
@@ -21,6 +26,7 @@ type FuzzerCLI =
   // Options related to grey-box concolic testing technique.
   | [<Unique>] NSolve of int
   | [<Unique>] NSpawn of int
+  | [<Unique>] SearchArity of int
 with
   interface IArgParserTemplate with
     member s.Usage =
@@ -29,11 +35,22 @@ with
       | Timelimit _ -> "Timeout for fuzz testing (in seconds)."
       | OutputDir _ -> "Directory to store testcase outputs."
       | SyncDir _ -> "Directory shared with AFL instances"
+      | Coordinator _ -> "Address (host:port) of the coordinator to exchange " +
+                         "seeds and coverage with other Eclipser instances"
+      | Resume -> "Resume fuzzing from the checkpoint in the output directory"
+      | Record _ -> "Record the executions of grey-box concolic testing into " +
+                    "the file, to replay them with 'replay' command"
       // Options related to program execution.
       | Program _ -> "Target program for test case generation with fuzzing."
-      | ExecTimeout _ -> "Execution timeout (ms) for a fuzz run (default:500)"
+      | ExecTimeout _ -> "Execution timeout (ms) for a fuzz run. If not " +
+                         "given, adapt the timeout to each tracer mode"
       | Architecture _ -> "Target program architecture (x86|x64) (default:x64)"
       | NoForkServer -> "Do not use fork server for target program execution"
+      | Snapshot -> "Run multiple executions in a single tracer process, by " +
+                    "restoring the snapshot taken at the entry point, " +
+                    "instead of forking a process per execution"
+      | Jobs _ -> "Number of fuzzing workers to run in parallel, each pinned " +
+                  "to its own CPU core (default:1)"
       // Options related to seed.
       | InputDir _ -> "Directory containing initial seeds."
       | Arg _ -> "Command-line argument of the target program to fuzz."
@@ -44,17 +61,25 @@ with
                     "the paper."
       | NSpawn _ -> "Number of byte values to initially spawn in grey-box " +
                     "concolic testing. 'N_spawn' parameter in the paper."
+      | SearchArity _ -> "Number of sub-intervals to split the interval into " +
+                         "at each round of the search on a monotonic branch. " +
+                         "A round runs its executions in parallel (default:4)"
 
 type FuzzOption = {
   Verbosity         : int
   Timelimit         : int
   OutDir            : string
   SyncDir           : string
+  Coordinator       : string
+  Resume            : bool
+  RecordLog         : string
   // Options related to program execution.
   TargetProg        : string
   ExecTimeout       : uint64
   Architecture      : Arch
   ForkServer        : bool
+  Snapshot          : bool
+  Jobs              : int
   // Options related to seed.
   InputDir          : string
   Arg               : string
@@ -62,8 +87,33 @@ type FuzzOption = {
   // Options related to grey-box concolic testing technique.
   NSolve            : int
   NSpawn            : int
+  SearchArity       : int
 }
 
+/// Options for the commands other than 'fuzz', which execute the target program
+/// (or replay its executions) without grey-box concolic testing. Each command
+/// overrides the fields given from its command line.
+let defaultFuzzOption =
+  { Verbosity = 1
+    Timelimit = -1
+    OutDir = ""
+    SyncDir = ""
+    Coordinator = ""
+    Resume = false
+    RecordLog = ""
+    TargetProg = ""
+    ExecTimeout = EXEC_TIMEOUT_MAX
+    Architecture = X64
+    ForkServer = false
+    Snapshot = false
+    Jobs = 1
+    InputDir = ""
+    Arg = ""
+    FuzzSource = StdInput
+    NSolve = 0
+    NSpawn = 0
+    SearchArity = 2 }
+
 let parseFuzzOption (args: string array) =
   let cmdPrefix = "dotnet Eclipser.dll fuzz"
   let parser = ArgumentParser.Create<FuzzerCLI> (programName = cmdPrefix)
@@ -73,12 +123,17 @@ let parseFuzzOption (args: string array) =
     Timelimit = r.GetResult (<@ Timelimit @>, defaultValue = -1)
     OutDir = r.GetResult (<@ OutputDir @>)
     SyncDir = r.GetResult (<@ SyncDir @>, defaultValue = "")
+    Coordinator = r.GetResult (<@ Coordinator @>, defaultValue = "")
+    Resume = r.Contains(<@ Resume @>)
+    RecordLog = r.GetResult (<@ Record @>, defaultValue = "")
     // Options related to program execution.
     TargetProg = System.IO.Path.GetFullPath(r.GetResult (<@ Program @>))
     ExecTimeout = r.GetResult (<@ ExecTimeout @>, defaultValue = 0UL)
     Architecture = r.GetResult(<@ Architecture @>, defaultValue = "X64")
                    |> Arch.ofString
     ForkServer = not (r.Contains(<@ NoForkServer @>)) // Enable by default.
+    Snapshot = r.Contains(<@ Snapshot @>)
+    Jobs = r.GetResult(<@ Jobs @>, defaultValue = 1)
     // Options related to seed.
     InputDir = r.GetResult(<@ InputDir @>, defaultValue = "")
     Arg = r.GetResult (<@ Arg @>, defaultValue = "")
@@ -86,8 +141,193 @@ let parseFuzzOption (args: string array) =
                  else FileInput (r.GetResult (<@ Filepath @>))
     // Options related to grey-box concolic testing technique.
     NSolve = r.GetResult(<@ NSolve @>, defaultValue = 600)
-    NSpawn = r.GetResult(<@ NSpawn @>, defaultValue = 10) }
+    NSpawn = r.GetResult(<@ NSpawn @>, defaultValue = 10)
+    SearchArity = r.GetResult(<@ SearchArity @>, defaultValue = 4) }
 
 let validateFuzzOption opt =
   if opt.NSpawn < 3 then
     failwith "Should provide N_spawn greater than or equal to 3"
+  if opt.SearchArity < 2 || opt.SearchArity > MAX_SEARCH_ARITY then
+    failwithf "Should provide the search arity between 2 and %d"
+      MAX_SEARCH_ARITY
+  if opt.Jobs < 1 || opt.Jobs > MAX_JOBS then
+    failwithf "Should provide the number of jobs between 1 and %d" MAX_JOBS
+  if opt.Jobs > 1 && not opt.ForkServer then
+    failwith "Parallel fuzzing requires fork server"
+  if opt.Snapshot && not opt.ForkServer then
+    failwith "Snapshot mode requires fork server"
+
+type CoordinatorCLI =
+  | [<AltCommandLine("-b")>] [<Unique>] Bind of addr: string
+  | [<AltCommandLine("-p")>] [<Unique>] Port of int
+with
+  interface IArgParserTemplate with
+    member s.Usage =
+      match s with
+      | Bind _ -> "Address to listen on (default:127.0.0.1)"
+      | Port _ -> "TCP port to listen on (default:9900)"
+
+type CoordinatorOption = {
+  BindAddr  : string
+  Port      : int
+}
+
+let parseCoordinatorOption (args: string array) =
+  let cmdPrefix = "dotnet Eclipser.dll coordinator"
+  let parser = ArgumentParser.Create<CoordinatorCLI> (programName = cmdPrefix)
+  let r = try parser.Parse(args) with
+          :? Argu.ArguParseException -> printLine (parser.PrintUsage()); exit 1
+  { BindAddr = r.GetResult (<@ Bind @>, defaultValue = "127.0.0.1")
+    Port = r.GetResult (<@ Port @>, defaultValue = 9900) }
+
+type MinimizerCLI =
+  | [<AltCommandLine("-v")>] [<Unique>] Verbose of int
+  | [<AltCommandLine("-i")>] [<Mandatory>] [<Unique>] InputDir of path: string
+  | [<AltCommandLine("-o")>] [<Mandatory>] [<Unique>] OutputDir of path: string
+  | [<AltCommandLine("-p")>] [<Mandatory>] [<Unique>] Program of path: string
+  | [<AltCommandLine("-e")>] [<Unique>] ExecTimeout of millisec:uint64
+  | [<Unique>] Architecture of string
+  | [<AltCommandLine("-j")>] [<Unique>] Jobs of int
+  | [<Unique>] Arg of string
+  | [<AltCommandLine("-f")>] [<Unique>] Filepath of string
+  | [<Unique>] Trim
+with
+  interface IArgParserTemplate with
+    member s.Usage =
+      match s with
+      | Verbose _ -> "Verbosity level to control debug messages (default:0)."
+      | InputDir _ -> "Directory containing the inputs to minimize."
+      | OutputDir _ -> "Directory to store the minimized inputs."
+      | Program _ -> "Target program to measure the coverage of inputs."
+      | ExecTimeout _ -> "Execution timeout (ms) (default:4000)"
+      | Architecture _ -> "Target program architecture (x86|x64) (default:x64)"
+      | Jobs _ -> "Number of workers to run in parallel (default:1)"
+      | Arg _ -> "Command-line argument of the target program."
+      | Filepath _ -> "File input's (fixed) path"
+      | Trim -> "Also trim the selected inputs (cmin only)"
+
+/// Options of 'cmin' and 'tmin' commands. The target program is executed with
+/// the same options as fuzzing, so keep them as a FuzzOption.
+type MinimizeOption = {
+  ExecOpt : FuzzOption
+  Trim    : bool
+}
+
+let parseMinimizeOption cmd (args: string array) =
+  let cmdPrefix = sprintf "dotnet Eclipser.dll %s" cmd
+  let parser = ArgumentParser.Create<MinimizerCLI> (programName = cmdPrefix)
+  let r = try parser.Parse(args) with
+          :? Argu.ArguParseException -> printLine (parser.PrintUsage()); exit 1
+  let execOpt =
+    { defaultFuzzOption with
+        Verbosity = r.GetResult (<@ MinimizerCLI.Verbose @>, defaultValue = 1)
+        OutDir = r.GetResult (<@ MinimizerCLI.OutputDir @>)
+        TargetProg =
+          System.IO.Path.GetFullPath(r.GetResult (<@ MinimizerCLI.Program @>))
+        ExecTimeout = r.GetResult (<@ MinimizerCLI.ExecTimeout @>,
+                                   defaultValue = EXEC_TIMEOUT_MAX)
+        Architecture = r.GetResult(<@ MinimizerCLI.Architecture @>,
+                                   defaultValue = "X64")
+                       |> Arch.ofString
+        ForkServer = true
+        Jobs = r.GetResult(<@ MinimizerCLI.Jobs @>, defaultValue = 1)
+        InputDir = r.GetResult(<@ MinimizerCLI.InputDir @>)
+        Arg = r.GetResult (<@ MinimizerCLI.Arg @>, defaultValue = "")
+        FuzzSource =
+          if not (r.Contains(<@ MinimizerCLI.Filepath @>)) then StdInput
+          else FileInput (r.GetResult (<@ MinimizerCLI.Filepath @>)) }
+  { ExecOpt = execOpt; Trim = r.Contains(<@ MinimizerCLI.Trim @>) }
+
+let validateMinimizeOption opt =
+  let execOpt = opt.ExecOpt
+  if execOpt.Jobs < 1 || execOpt.Jobs > MAX_JOBS then
+    failwithf "Should provide the number of jobs between 1 and %d" MAX_JOBS
+  let fullPath (dir: string) =
+    System.IO.Path.GetFullPath(dir).TrimEnd('/')
+  if fullPath execOpt.InputDir = fullPath execOpt.OutDir then
+    failwith "Should provide an output directory other than the input one"
+
+type ProfilerCLI =
+  | [<AltCommandLine("-v")>] [<Unique>] Verbose of int
+  | [<AltCommandLine("-i")>] [<Mandatory>] [<Unique>] Input of path: string
+  | [<AltCommandLine("-p")>] [<Mandatory>] [<Unique>] Program of path: string
+  | [<AltCommandLine("-e")>] [<Unique>] ExecTimeout of millisec:uint64
+  | [<Unique>] Architecture of string
+  | [<Unique>] Arg of string
+  | [<AltCommandLine("-f")>] [<Unique>] Filepath of string
+  | [<AltCommandLine("-n")>] [<Unique>] TopN of int
+with
+  interface IArgParserTemplate with
+    member s.Usage =
+      match s with
+      | Verbose _ -> "Verbosity level to control debug messages (default:0)."
+      | Input _ -> "Input file to execute the target program with."
+      | Program _ -> "Target program to profile."
+      | ExecTimeout _ -> "Execution timeout (ms) (default:4000)"
+      | Architecture _ -> "Target program architecture (x86|x64) (default:x64)"
+      | Arg _ -> "Command-line argument of the target program."
+      | Filepath _ -> "File input's (fixed) path"
+      | TopN _ -> "Number of the hottest blocks and loops to report " +
+                  "(default:20)"
+
+/// Options of 'profile' command. The target program is executed with the same
+/// options as fuzzing, so keep them as a FuzzOption.
+type ProfileOption = {
+  ExecOpt   : FuzzOption
+  InputFile : string
+  TopN      : int
+}
+
+let parseProfileOption (args: string array) =
+  let cmdPrefix = "dotnet Eclipser.dll profile"
+  let parser = ArgumentParser.Create<ProfilerCLI> (programName = cmdPrefix)
+  let r = try parser.Parse(args) with
+          :? Argu.ArguParseException -> printLine (parser.PrintUsage()); exit 1
+  // Logs of the tracer are written to a temporary directory.
+  let pid = System.Diagnostics.Process.GetCurrentProcess().Id
+  let workDir = sprintf "eclipser-profile-%d" pid
+  let execOpt =
+    { defaultFuzzOption with
+        Verbosity = r.GetResult (<@ ProfilerCLI.Verbose @>, defaultValue = 1)
+        OutDir = System.IO.Path.Combine(System.IO.Path.GetTempPath(), workDir)
+        TargetProg =
+          System.IO.Path.GetFullPath(r.GetResult (<@ ProfilerCLI.Program @>))
+        ExecTimeout = r.GetResult (<@ ProfilerCLI.ExecTimeout @>,
+                                   defaultValue = EXEC_TIMEOUT_MAX)
+        Architecture = r.GetResult(<@ ProfilerCLI.Architecture @>,
+                                   defaultValue = "X64")
+                       |> Arch.ofString
+        Arg = r.GetResult (<@ ProfilerCLI.Arg @>, defaultValue = "")
+        FuzzSource =
+          if not (r.Contains(<@ ProfilerCLI.Filepath @>)) then StdInput
+          else FileInput (r.GetResult (<@ ProfilerCLI.Filepath @>)) }
+  { ExecOpt = execOpt
+    InputFile = r.GetResult (<@ ProfilerCLI.Input @>)
+    TopN = r.GetResult (<@ ProfilerCLI.TopN @>, defaultValue = 20) }
+
+type ReplayerCLI =
+  | [<AltCommandLine("-v")>] [<Unique>] Verbose of int
+  | [<AltCommandLine("-l")>] [<Mandatory>] [<Unique>] Log of path: string
+with
+  interface IArgParserTemplate with
+    member s.Usage =
+      match s with
+      | Verbose _ -> "Verbosity level to control debug messages (default:0)."
+      | Log _ -> "Execution log recorded with '--record' option of fuzzing."
+
+/// Options of 'replay' command. The grey-box concolic testing options are
+/// restored from the log, so keep them as a FuzzOption.
+type ReplayOption = {
+  FuzzOpt : FuzzOption
+  LogFile : string
+}
+
+let parseReplayOption (args: string array) =
+  let cmdPrefix = "dotnet Eclipser.dll replay"
+  let parser = ArgumentParser.Create<ReplayerCLI> (programName = cmdPrefix)
+  let r = try parser.Parse(args) with
+          :? Argu.ArguParseException -> printLine (parser.PrintUsage()); exit 1
+  let verbosity = r.GetResult (<@ ReplayerCLI.Verbose @>, defaultValue = 1)
+  let fuzzOpt = { defaultFuzzOption with Verbosity = verbosity }
+  { FuzzOpt = fuzzOpt
+    LogFile = System.IO.Path.GetFullPath(r.GetResult (<@ ReplayerCLI.Log @>)) }
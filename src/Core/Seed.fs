@@ -1,5 +1,6 @@
 namespace Eclipser
 
+open System.IO
 open Config
 open Utils
 
@@ -16,6 +17,8 @@ type Seed = {
   CursorDir : Direction
   /// Input source.
   Source : InputSource
+  /// Lineage of the seed, which shares the relevance of input bytes.
+  Lineage : int
 }
 
 module Seed =
@@ -25,6 +28,7 @@ module Seed =
     CursorPos = 0
     CursorDir = Right
     Source = StdInput
+    Lineage = 0
   }
 
   /// Initialize a seed for the specified input source, with the specified
@@ -35,14 +39,16 @@ module Seed =
                    | FileInput _ -> 0uy // NULL byte.
     let bytes = Array.init INIT_INPUT_LEN (fun _ -> initByte)
     let byteVals = Array.map ByteVal.newByteVal bytes
-    { ByteVals = byteVals; CursorPos = 0; CursorDir = Right; Source = src }
+    { ByteVals = byteVals; CursorPos = 0; CursorDir = Right; Source = src
+      Lineage = ByteRelevance.newLineage () }
 
   /// Initialize a seed with provided byte array content.
   let makeWith src bytes =
     // Do not allow empty content.
     if Array.length bytes = 0 then failwith "Seed.makeWith() with empty bytes"
     let byteVals = Array.map ByteVal.newByteVal bytes
-    { ByteVals = byteVals; CursorPos = 0; CursorDir = Right; Source = src }
+    { ByteVals = byteVals; CursorPos = 0; CursorDir = Right; Source = src
+      Lineage = ByteRelevance.newLineage () }
 
   /// Concretize a seed into a byte array.
   let concretize seed =
@@ -193,18 +199,24 @@ module Seed =
       Some (setCursorPos seed (byteCursor + 1))
     | Left _ | Right _ -> None
 
+  // Check if the cursor can stop at 'idx'. The cursor jumps over the fixed
+  // ByteVals and the offsets found irrelevant (cf. ByteRelevance.fs).
+  let private isCursorTarget seed idx =
+    ByteVal.isUnfixed seed.ByteVals.[idx] &&
+    not (ByteRelevance.isSkippable seed.Lineage idx)
+
   // Starting from 'curIdx', find the index of the first unfixed ByteVal.
-  let rec private findUnfixedByte (bytes: ByteVal []) curIdx =
-    if curIdx < 0 || curIdx >= bytes.Length then -1
-    elif ByteVal.isUnfixed bytes.[curIdx] then curIdx
-    else findUnfixedByte bytes (curIdx + 1)
+  let rec private findUnfixedByte seed curIdx =
+    if curIdx < 0 || curIdx >= seed.ByteVals.Length then -1
+    elif isCursorTarget seed curIdx then curIdx
+    else findUnfixedByte seed (curIdx + 1)
 
   // Starting from 'curIdx', find the index of the first unfixed ByteVal, in a
   // backward direction.
-  let rec private findUnfixedByteBackward (bytes: ByteVal []) curIdx =
-    if curIdx < 0 || curIdx >= bytes.Length then -1
-    elif ByteVal.isUnfixed bytes.[curIdx] then curIdx
-    else findUnfixedByteBackward bytes (curIdx - 1)
+  let rec private findUnfixedByteBackward seed curIdx =
+    if curIdx < 0 || curIdx >= seed.ByteVals.Length then -1
+    elif isCursorTarget seed curIdx then curIdx
+    else findUnfixedByteBackward seed (curIdx - 1)
 
   /// Move the byte cursor to an unfixed ByteVal. Cursor may stay at the same
   /// position.
@@ -213,9 +225,9 @@ module Seed =
     let cursorDir = seed.CursorDir
     match cursorDir with
     | Stay -> None
-    | Left -> let offset = findUnfixedByteBackward seed.ByteVals byteCursor
+    | Left -> let offset = findUnfixedByteBackward seed byteCursor
               if offset <> -1 then Some (setCursorPos seed offset) else None
-    | Right -> let offset = findUnfixedByte seed.ByteVals byteCursor
+    | Right -> let offset = findUnfixedByte seed byteCursor
                if offset <> -1 then Some (setCursorPos seed offset) else None
 
   /// Move the byte cursor to the next unfixed ByteVal. Cursor should move at
@@ -225,6 +237,18 @@ module Seed =
     | None -> None
     | Some newSeed -> moveToUnfixedByte newSeed
 
+  /// Consume the skips of the irrelevant offsets that the cursor jumped over to
+  /// reach its current position, when the seed is fuzzed there.
+  let consumeCursorSkips seed =
+    let step = match seed.CursorDir with Left -> 1 | Right -> -1 | Stay -> 0
+    let rec loop idx =
+      if step <> 0 && idx >= 0 && idx < seed.ByteVals.Length &&
+         not (isCursorTarget seed idx) then
+        if ByteVal.isUnfixed seed.ByteVals.[idx] then
+          ByteRelevance.consumeSkip seed.Lineage idx
+        loop (idx + step)
+    loop (seed.CursorPos + step)
+
   /// Update the byte cursor direction of current input.
   let setByteCursorDir seed dir =
     { seed with CursorDir = dir }
@@ -232,7 +256,7 @@ module Seed =
   /// Randomly move byte cursor position within current input.
   let shuffleByteCursor seed =
     let curLength = seed.ByteVals.Length
-    let newByteCursor = random.Next(curLength)
+    let newByteCursor = random.Value.Next(curLength)
     let newCursorDir = if newByteCursor > (curLength / 2) then Left else Right
     { seed with CursorPos = newByteCursor; CursorDir = newCursorDir}
 
@@ -278,3 +302,47 @@ module Seed =
     let byteVals = List.ofArray seed.ByteVals
     let byteStr = byteValsToStr [] "" byteVals
     sprintf "%s (%d) (%A)" byteStr seed.CursorPos seed.CursorDir
+
+  (****************************** Serialization ******************************)
+
+  let private writeByteVal (w: BinaryWriter) = function
+    | Fixed b -> w.Write(0uy); w.Write(b)
+    | Interval (low, high) -> w.Write(1uy); w.Write(low); w.Write(high)
+    | Undecided b -> w.Write(2uy); w.Write(b)
+    | Untouched b -> w.Write(3uy); w.Write(b)
+    | Sampled b -> w.Write(4uy); w.Write(b)
+
+  let private readByteVal (r: BinaryReader) =
+    match r.ReadByte() with
+    | 0uy -> Fixed (r.ReadByte())
+    | 1uy -> let low = r.ReadByte()
+             Interval (low, r.ReadByte())
+    | 2uy -> Undecided (r.ReadByte())
+    | 3uy -> Untouched (r.ReadByte())
+    | 4uy -> Sampled (r.ReadByte())
+    | tag -> failwithf "Invalid ByteVal tag: %d" tag
+
+  /// Write the seed along with its ByteVal constraints and cursor.
+  let write (w: BinaryWriter) seed =
+    w.Write(seed.Lineage)
+    w.Write(seed.CursorPos)
+    w.Write(match seed.CursorDir with Stay -> 0uy | Left -> 1uy | Right -> 2uy)
+    match seed.Source with
+    | StdInput -> w.Write(0uy)
+    | FileInput filePath -> w.Write(1uy); w.Write(filePath)
+    w.Write(seed.ByteVals.Length)
+    Array.iter (writeByteVal w) seed.ByteVals
+
+  /// Read a seed written with Seed.write().
+  let read (r: BinaryReader) =
+    let lineage = r.ReadInt32()
+    let cursorPos = r.ReadInt32()
+    let cursorDir = match r.ReadByte() with
+                    | 0uy -> Stay
+                    | 1uy -> Left
+                    | _ -> Right
+    let source = if r.ReadByte() = 0uy then StdInput
+                 else FileInput (r.ReadString())
+    let byteVals = Array.init (r.ReadInt32()) (fun _ -> readByteVal r)
+    { ByteVals = byteVals; CursorPos = cursorPos; CursorDir = cursorDir
+      Source = source; Lineage = lineage }
@@ -0,0 +1,118 @@
+/// Cheap counters updated on the hot paths, which are periodically reported to
+/// 'fuzzer_stats' and 'plot_data' files (cf. FuzzerStats.fs). Counters may be
+/// updated from multiple fuzzing workers, so they are updated atomically.
+module Eclipser.Stats
+
+open System.Diagnostics
+open System.Threading
+
+/// Kinds of execution, distinguished by the tracer mode.
+type ExecMode =
+  | CoverageExec // Coverage tracer.
+  | BranchTraceExec // Branch tracer, collecting the whole branch trace.
+  | BranchInfoExec // Branch tracer, collecting a single branch.
+  | NativeExec // Native execution without tracer.
+
+/// Phases of fuzzing, to figure out where the time goes.
+type Phase =
+  | Spawn // Collect branch traces with sampled byte values.
+  | Inference // Build a branch tree and infer branch conditions.
+  | Solve // Solve branch conditions.
+  | CoverageCheck // Re-evaluate the coverage of candidate seeds.
+  | Sync // Synchronize with AFL or the other Eclipser instances.
+  | Sleep // Yield resource to AFL instances.
+
+let allExecModes = [ CoverageExec; BranchTraceExec; BranchInfoExec; NativeExec ]
+
+let allPhases = [ Spawn; Inference; Solve; CoverageCheck; Sync; Sleep ]
+
+module ExecMode =
+  let toIndex = function
+    | CoverageExec -> 0
+    | BranchTraceExec -> 1
+    | BranchInfoExec -> 2
+    | NativeExec -> 3
+
+  let toString = function
+    | CoverageExec -> "coverage"
+    | BranchTraceExec -> "branch_trace"
+    | BranchInfoExec -> "branch_info"
+    | NativeExec -> "native"
+
+module Phase =
+  let toIndex = function
+    | Spawn -> 0
+    | Inference -> 1
+    | Solve -> 2
+    | CoverageCheck -> 3
+    | Sync -> 4
+    | Sleep -> 5
+
+  let toString = function
+    | Spawn -> "spawn"
+    | Inference -> "inference"
+    | Solve -> "solve"
+    | CoverageCheck -> "coverage_check"
+    | Sync -> "sync"
+    | Sleep -> "sleep"
+
+let private execCounts : int64 array = Array.zeroCreate 4
+let private phaseTicks : int64 array = Array.zeroCreate 6
+let private cacheLookups = ref 0L
+let private cacheHits = ref 0L
+let private cursorSkips = ref 0L
+// Number of executions done by the current thread (i.e. fuzzing worker).
+let private threadExecCount = new ThreadLocal<int64>()
+
+(*** Counter updates ***)
+
+let incrExecCount mode =
+  Interlocked.Increment(&execCounts.[ExecMode.toIndex mode]) |> ignore
+  threadExecCount.Value <- threadExecCount.Value + 1L
+
+/// Count the executions that ran on another thread on behalf of the current
+/// thread (cf. Executor.runBatch).
+let addThreadExecCount n =
+  threadExecCount.Value <- threadExecCount.Value + n
+
+let addPhaseTicks phase ticks =
+  Interlocked.Add(&phaseTicks.[Phase.toIndex phase], ticks) |> ignore
+
+let addPhaseMillisecs phase (millisecs: int) =
+  addPhaseTicks phase (int64 millisecs * Stopwatch.Frequency / 1000L)
+
+/// Run 'f' and account its elapsed time to 'phase'.
+let measure phase f =
+  let startTick = Stopwatch.GetTimestamp()
+  let result = f ()
+  addPhaseTicks phase (Stopwatch.GetTimestamp() - startTick)
+  result
+
+/// Record a lookup of the solution cache (cf. GreySolver).
+let recordCacheLookup isHit =
+  Interlocked.Increment(cacheLookups) |> ignore
+  if isHit then Interlocked.Increment(cacheHits) |> ignore
+
+/// Record that a fuzzed seed jumped over an irrelevant offset (cf. Seed.fs).
+let recordCursorSkip () =
+  Interlocked.Increment(cursorSkips) |> ignore
+
+(*** Counter queries ***)
+
+let getExecCount mode = Interlocked.Read(&execCounts.[ExecMode.toIndex mode])
+
+let getTotalExecCount () = List.sumBy getExecCount allExecModes
+
+/// Return the number of executions done by the current thread.
+let getThreadExecCount () = threadExecCount.Value
+
+let getPhaseSeconds phase =
+  let ticks = Interlocked.Read(&phaseTicks.[Phase.toIndex phase])
+  float ticks / float Stopwatch.Frequency
+
+/// Return the hit rate of the solution cache in percentage.
+let getCacheHitRate () =
+  let lookups = !cacheLookups
+  if lookups = 0L then 0.0 else float !cacheHits * 100.0 / float lookups
+
+let getCursorSkipCount () = !cursorSkips
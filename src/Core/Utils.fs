@@ -9,7 +9,9 @@ let identity = id
 
 let startTime = DateTime.Now
 
-let random = System.Random()
+// Each fuzzing worker thread needs its own instance (cf. parallel mode), since
+// System.Random is not thread-safe.
+let random = new Threading.ThreadLocal<Random>(fun () -> Random())
 
 let printLine (str: string) = Console.WriteLine str
 
@@ -62,7 +64,7 @@ let getUnsignedMax = function
 
 // Auxiliary function for randSubset().
 let private randomSubsetAux (accumSet : ImmutableHashSet<int>) i =
-  let t = random.Next(i + 1) // 't' will be in the range 0 ~ i.
+  let t = random.Value.Next(i + 1) // 't' will be in the range 0 ~ i.
   if accumSet.Contains(t)
   then accumSet.Add(i)
   else accumSet.Add(t)
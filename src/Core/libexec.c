@@ -15,32 +15,58 @@
 */
 
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
+#include <sched.h>
 #include <dlfcn.h>
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
 #include <stdint.h>
+#include <time.h>
 
 #define COV_FORKSRV_FD      198
 #define BR_FORKSRV_FD      194
 #define FORK_WAIT_MULT  10
-
-static pid_t coverage_forksrv_pid;
-static int coverage_fsrv_ctl_fd, coverage_fsrv_st_fd;
-static pid_t branch_forksrv_pid;
-static int branch_fsrv_ctl_fd, branch_fsrv_st_fd;
+#define TRIAGE_POLL_US  1000
+#define SIGTERM_WAIT_MS 400
+#define MAX_EXECUTORS   128
+/* Descriptor of the memfd that holds a file input in the fork servers. The
+ * tracers serve the input file from it (cf. syscall.diff).
+ */
+#define INPUT_FD        190
+/* Descriptors kept by the parent are moved above this number, so that they do
+ * not collide with *_FORKSRV_FD in the fork server process.
+ */
+#define MIN_PARENT_FD   256
+
+/* An executor owns a pair of fork servers for coverage tracer and branch
+ * tracer. Each fuzzing worker thread uses its own executor, identified with an
+ * index into 'executors'.
+ */
+struct executor {
+    pid_t coverage_forksrv_pid;
+    int coverage_fsrv_ctl_fd, coverage_fsrv_st_fd;
+    pid_t branch_forksrv_pid;
+    int branch_fsrv_ctl_fd, branch_fsrv_st_fd;
+    int coverage_stdin_fd;
+    int branch_stdin_fd;
+    int input_fd; /* memfd holding the file input, or 0 if not used */
+};
+
+static struct executor executors[MAX_EXECUTORS];
 
 static pid_t child_pid = 0;
 static int timeout_flag;
 static int non_fork_stdin_fd;
-static int coverage_stdin_fd;
-static int branch_stdin_fd;
+static int triage_stdin_fd = -1;
 
 void error_exit(char* msg) {
     perror(msg);
@@ -55,11 +81,11 @@ void unset_env (char *env_variable) {
     unsetenv(env_variable);
 }
 
-void open_stdin_fd(int * fd){
+void open_stdin_fd(int * fd, char * path){
 
-    unlink(".stdin");
+    unlink(path);
 
-    *fd = open(".stdin", O_RDWR | O_CREAT | O_EXCL, 0600);
+    *fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
 
     if (*fd == -1)
         error_exit("open_stdin_fd : failed to open");
@@ -162,7 +188,7 @@ int exec(int argc, char **args, int stdin_size, char *stdin_data, uint64_t timeo
         dup2(devnull, 2);
         close(devnull);
 
-        open_stdin_fd(&non_fork_stdin_fd);
+        open_stdin_fd(&non_fork_stdin_fd, ".stdin");
         write_stdin(non_fork_stdin_fd, stdin_size, stdin_data);
         dup2(non_fork_stdin_fd, 0);
         // We already wrote stdin_data and redirected it, so OK to close
@@ -181,9 +207,157 @@ int exec(int argc, char **args, int stdin_size, char *stdin_data, uint64_t timeo
     return waitchild(child_pid, timeout);
 }
 
+static uint64_t get_cur_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Execute the program natively, without touching the global states shared by
+ * exec() and the fork servers. This way, crash triage can run in a separate
+ * thread while the fuzzing loop keeps running. Instead of using SIGALRM, the
+ * timeout is checked by polling the child process.
+ */
+int exec_triage(int argc, char **args, int stdin_size, char *stdin_data,
+                uint64_t timeout) {
+    int i, devnull, ret, childstatus = 0;
+    uint64_t start_us;
+    pid_t pid;
+    char **argv = (char **)malloc(sizeof(char*) * (argc + 1));
+
+    if (!argv) error_exit( "args malloc" );
+
+    for (i = 0; i<argc; i++) {
+        argv[i] = args[i];
+    }
+    argv[i] = 0;
+
+    if (triage_stdin_fd == -1) {
+        unlink(".stdin_triage");
+        triage_stdin_fd = open(".stdin_triage",
+                               O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (triage_stdin_fd == -1)
+            error_exit("exec_triage : failed to open");
+    }
+    write_stdin(triage_stdin_fd, stdin_size, stdin_data);
+
+    devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if ( devnull < 0 ) error_exit("devnull open");
+
+    pid = vfork();
+    if (pid == 0) {
+        dup2(devnull, 1);
+        dup2(devnull, 2);
+        dup2(triage_stdin_fd, 0);
+        execv(argv[0], argv);
+        _exit(-1);
+    }
+
+    free(argv);
+    close(devnull);
+    if (pid < 0) return -1;
+
+    start_us = get_cur_time_us();
+    while (1) {
+        ret = waitpid(pid, &childstatus, WNOHANG);
+        if (ret == pid) break;
+        if (ret < 0 && errno != EINTR) {
+            perror("[Warning] waitpid() : ");
+            return -1;
+        }
+        if (get_cur_time_us() - start_us >= timeout * 1000) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &childstatus, 0);
+            return SIGALRM;
+        }
+        usleep(TRIAGE_POLL_US);
+    }
+
+    if ( WIFSIGNALED( childstatus ) ) {
+        if ( WTERMSIG( childstatus ) == SIGSEGV ) return SIGSEGV;
+        else if ( WTERMSIG( childstatus ) == SIGFPE ) return SIGFPE;
+        else if ( WTERMSIG( childstatus ) == SIGILL ) return SIGILL;
+        else if ( WTERMSIG( childstatus ) == SIGABRT ) return SIGABRT;
+        else return 0;
+    } else {
+        return 0;
+    }
+}
+
+/* Move a descriptor kept by the parent above MIN_PARENT_FD, and set
+ * close-on-exec flag on it. This way, the descriptors of an executor are not
+ * inherited by the fork servers of the other executors.
+ */
+static int move_parent_fd(int fd) {
+    int new_fd = fcntl(fd, F_DUPFD_CLOEXEC, MIN_PARENT_FD);
+
+    if (new_fd < 0) error_exit("fcntl() failed");
+    close(fd);
+    return new_fd;
+}
+
+/* Read 4 bytes from the status pipe of a fork server, waiting at most
+ * 'timeout_ms' (negative value means infinite). Returns 0 on timeout. Instead
+ * of SIGALRM, poll() is used here, so that the executors running in different
+ * threads do not interfere with each other.
+ */
+static int read_timed(int fd, void *buf, int timeout_ms) {
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret <= 0) return ret;
+
+    return read(fd, buf, 4);
+}
+
+/* Wait for the exit status of a child process relayed by the fork server. If
+ * timeout is reached, send SIGTERM (not SIGKILL) so that QEMU tracer can
+ * receive it and call eclipser_exit() to finish logging.
+ */
+static int wait_child_status(int st_fd, pid_t pid, uint64_t timeout,
+                             int *status, int *timed_out) {
+    int res = read_timed(st_fd, status, timeout);
+
+    *timed_out = 0;
+    if (res == 0) {
+        *timed_out = 1;
+        kill(pid, SIGTERM);
+        res = read_timed(st_fd, status, SIGTERM_WAIT_MS);
+        /* In some cases, the child process may not be terminated by SIGTERM,
+         * so send SIGKILL if it did not exit yet. */
+        if (res == 0) {
+            kill(pid, SIGKILL);
+            res = read_timed(st_fd, status, -1);
+        }
+    }
+
+    return res;
+}
+
+static int status_to_signal(int childstatus, int timed_out) {
+    if ( WIFEXITED( childstatus ) ) return 0;
+
+    if ( WIFSIGNALED( childstatus ) ) {
+        if ( WTERMSIG( childstatus ) == SIGSEGV ) return SIGSEGV;
+        else if ( WTERMSIG( childstatus ) == SIGFPE ) return SIGFPE;
+        else if ( WTERMSIG( childstatus ) == SIGILL ) return SIGILL;
+        else if ( WTERMSIG( childstatus ) == SIGABRT ) return SIGABRT;
+        else if ( timed_out ) return SIGALRM;
+        else return 0;
+    } else {
+        return 0;
+    }
+}
+
 pid_t init_forkserver(int argc, char** args, uint64_t timeout, int forksrv_fd,
-                      int *stdin_fd, int *fsrv_ctl_fd, int *fsrv_st_fd) {
-    static struct itimerval it;
+                      char *stdin_path, int *stdin_fd, int input_fd,
+                      int *fsrv_ctl_fd, int *fsrv_st_fd) {
     int st_pipe[2], ctl_pipe[2];
     int status;
     int devnull, i;
@@ -191,7 +365,8 @@ pid_t init_forkserver(int argc, char** args, uint64_t timeout, int forksrv_fd,
     pid_t forksrv_pid;
     char **argv = (char **)malloc( sizeof(char*) * (argc + 1) );
 
-    open_stdin_fd(stdin_fd);
+    open_stdin_fd(stdin_fd, stdin_path);
+    *stdin_fd = move_parent_fd(*stdin_fd);
 
     if (!argv) error_exit( "args malloc" );
     for (i = 0; i<argc; i++)
@@ -227,6 +402,9 @@ pid_t init_forkserver(int argc, char** args, uint64_t timeout, int forksrv_fd,
 
         dup2(*stdin_fd, 0);
 
+        if (input_fd > 0 && dup2(input_fd, INPUT_FD) < 0)
+            error_exit("dup2() failed");
+
       if (dup2(ctl_pipe[0], forksrv_fd) < 0) error_exit("dup2() failed");
       if (dup2(st_pipe[1], forksrv_fd + 1) < 0) error_exit("dup2() failed");
 
@@ -251,27 +429,19 @@ pid_t init_forkserver(int argc, char** args, uint64_t timeout, int forksrv_fd,
     close(ctl_pipe[0]);
     close(st_pipe[1]);
 
-    *fsrv_ctl_fd = ctl_pipe[1];
-    *fsrv_st_fd  = st_pipe[0];
-
-    it.it_value.tv_sec = (timeout * FORK_WAIT_MULT) / 1000;
-    it.it_value.tv_usec = ((timeout * FORK_WAIT_MULT) % 1000) * 1000;
-
-    setitimer(ITIMER_REAL, &it, NULL);
-
-    rlen = read(*fsrv_st_fd, &status, 4);
+    *fsrv_ctl_fd = move_parent_fd(ctl_pipe[1]);
+    *fsrv_st_fd  = move_parent_fd(st_pipe[0]);
 
-    it.it_value.tv_sec = 0;
-    it.it_value.tv_usec = 0;
-
-    setitimer(ITIMER_REAL, &it, NULL);
+    rlen = read_timed(*fsrv_st_fd, &status, timeout * FORK_WAIT_MULT);
 
     if (rlen == 4) {
       return forksrv_pid;
     }
 
-    if (timeout_flag) {
-      perror("Timeout while initializing fork server");
+    if (rlen == 0) {
+      fprintf(stderr, "Timeout while initializing fork server\n");
+      kill(forksrv_pid, SIGKILL);
+      waitpid(forksrv_pid, &status, 0);
       return -1;
     }
 
@@ -284,159 +454,174 @@ pid_t init_forkserver(int argc, char** args, uint64_t timeout, int forksrv_fd,
     return -1;
 }
 
-pid_t init_forkserver_coverage(int argc, char** args, uint64_t timeout) {
-    coverage_forksrv_pid = init_forkserver(argc, args, timeout, COV_FORKSRV_FD,
-                                          &coverage_stdin_fd,
-                                          &coverage_fsrv_ctl_fd,
-                                          &coverage_fsrv_st_fd);
-    return coverage_forksrv_pid;
+pid_t init_forkserver_coverage(int id, int argc, char** args,
+                               uint64_t timeout) {
+    struct executor *e = &executors[id];
+    char stdin_path[32];
+
+    snprintf(stdin_path, sizeof(stdin_path), ".stdin_%d", id);
+    e->coverage_forksrv_pid = init_forkserver(argc, args, timeout,
+                                              COV_FORKSRV_FD, stdin_path,
+                                              &e->coverage_stdin_fd,
+                                              e->input_fd,
+                                              &e->coverage_fsrv_ctl_fd,
+                                              &e->coverage_fsrv_st_fd);
+    return e->coverage_forksrv_pid;
 }
 
-pid_t init_forkserver_branch(int argc, char** args, uint64_t timeout) {
-    branch_forksrv_pid = init_forkserver(argc, args, timeout, BR_FORKSRV_FD,
-                                         &branch_stdin_fd,
-                                         &branch_fsrv_ctl_fd,
-                                         &branch_fsrv_st_fd);
-    return branch_forksrv_pid;
+pid_t init_forkserver_branch(int id, int argc, char** args, uint64_t timeout) {
+    struct executor *e = &executors[id];
+    char stdin_path[32];
+
+    snprintf(stdin_path, sizeof(stdin_path), ".stdin_%d", id);
+    e->branch_forksrv_pid = init_forkserver(argc, args, timeout, BR_FORKSRV_FD,
+                                            stdin_path, &e->branch_stdin_fd,
+                                            e->input_fd, &e->branch_fsrv_ctl_fd,
+                                            &e->branch_fsrv_st_fd);
+    return e->branch_forksrv_pid;
 }
 
-void kill_forkserver() {
+/* Create the memfd that passes a file input to the fork servers of an executor.
+ * Should be called before the fork servers are initialized. Returns -1 if
+ * memfd is not supported, in which case the input should be written to the
+ * file instead.
+ */
+int init_file_input(int id) {
+    struct executor *e = &executors[id];
+    int fd;
 
-    close(coverage_stdin_fd);
-    close(branch_stdin_fd);
+    if (e->input_fd > 0)
+        return 0;
 
-    close(coverage_fsrv_ctl_fd);
-    close(coverage_fsrv_st_fd);
-    close(branch_fsrv_ctl_fd);
-    close(branch_fsrv_st_fd);
+    fd = syscall(SYS_memfd_create, "eclipser_input", 0);
+    if (fd < 0)
+        return -1;
 
-    if (coverage_forksrv_pid) {
-        kill(coverage_forksrv_pid, SIGKILL);
-        coverage_forksrv_pid = 0;
+    e->input_fd = move_parent_fd(fd);
+    return 0;
+}
+
+void write_file_input(int id, int input_size, char *input_data) {
+    write_stdin(executors[id].input_fd, input_size, input_data);
+}
+
+void kill_forkserver(int id) {
+    struct executor *e = &executors[id];
+
+    close(e->coverage_stdin_fd);
+    close(e->branch_stdin_fd);
+
+    close(e->coverage_fsrv_ctl_fd);
+    close(e->coverage_fsrv_st_fd);
+    close(e->branch_fsrv_ctl_fd);
+    close(e->branch_fsrv_st_fd);
+
+    if (e->coverage_forksrv_pid > 0) {
+        kill(e->coverage_forksrv_pid, SIGKILL);
+        waitpid(e->coverage_forksrv_pid, NULL, 0);
     }
-    if (branch_forksrv_pid) {
-        kill(branch_forksrv_pid, SIGKILL);
-        branch_forksrv_pid = 0;
+    e->coverage_forksrv_pid = 0;
+    if (e->branch_forksrv_pid > 0) {
+        kill(e->branch_forksrv_pid, SIGKILL);
+        waitpid(e->branch_forksrv_pid, NULL, 0);
     }
+    e->branch_forksrv_pid = 0;
 }
 
-int exec_fork_coverage(uint64_t timeout, int stdin_size, char *stdin_data) {
-    int res, childstatus;
-    static struct itimerval it;
+/* Pin the calling thread to the given CPU core. Fork servers initialized from
+ * this thread afterward inherit the affinity.
+ */
+int set_cpu_affinity(int cpu) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int exec_fork_coverage(int id, uint64_t timeout, int stdin_size,
+                       char *stdin_data) {
+    struct executor *e = &executors[id];
+    int res, childstatus, timed_out;
+    pid_t pid;
     static unsigned char tmp[4];
 
-    write_stdin(coverage_stdin_fd, stdin_size, stdin_data);
+    write_stdin(e->coverage_stdin_fd, stdin_size, stdin_data);
 
-    if ((res = write(coverage_fsrv_ctl_fd, tmp, 4)) != 4) {
+    if ((res = write(e->coverage_fsrv_ctl_fd, tmp, 4)) != 4) {
       perror("exec_fork_coverage: Cannot request new process to fork server");
       printf("write() call ret = %d\n", res);
       return -1;
     }
 
-    if ((res = read(coverage_fsrv_st_fd, &child_pid, 4)) != 4) {
+    if ((res = read(e->coverage_fsrv_st_fd, &pid, 4)) != 4) {
       perror("exec_fork_coverage: Cannot receive child pid from fork server");
-      printf("read() call ret = %d, child_pid = %d\n", res, child_pid);
+      printf("read() call ret = %d, child_pid = %d\n", res, pid);
       return -1;
     }
 
-    if (child_pid <= 0) {
+    if (pid <= 0) {
       perror("exec_fork_coverage: Fork server is mibehaving");
       return -1;
     }
 
-    it.it_value.tv_sec = (timeout / 1000);
-    it.it_value.tv_usec = (timeout % 1000) * 1000;
-    setitimer(ITIMER_REAL, &it, NULL);
-
-    if ((res = read(coverage_fsrv_st_fd, &childstatus, 4)) != 4) {
+    res = wait_child_status(e->coverage_fsrv_st_fd, pid, timeout,
+                            &childstatus, &timed_out);
+    if (res != 4) {
       perror("exec_fork_coverage: Unable to communicate with fork server");
       printf("read() call ret = %d, childstatus = %d\n", res, childstatus);
       return -1;
     }
 
-    if (!WIFSTOPPED(childstatus)) child_pid = 0;
-
-    it.it_value.tv_sec = 0;
-    it.it_value.tv_usec = 0;
-    setitimer(ITIMER_REAL, &it, NULL);
-
-    if ( WIFEXITED( childstatus ) ) return 0;
-
-    if ( WIFSIGNALED( childstatus ) ) {
-        if ( WTERMSIG( childstatus ) == SIGSEGV ) return SIGSEGV;
-        else if ( WTERMSIG( childstatus ) == SIGFPE ) return SIGFPE;
-        else if ( WTERMSIG( childstatus ) == SIGILL ) return SIGILL;
-        else if ( WTERMSIG( childstatus ) == SIGABRT ) return SIGABRT;
-        else if ( timeout_flag ) return SIGALRM;
-        else return 0;
-    } else {
-        return 0;
-    }
+    return status_to_signal(childstatus, timed_out);
 }
 
-int exec_fork_branch(uint64_t timeout, int stdin_size, char *stdin_data,
-                     uint64_t targ_addr, uint32_t targ_index, int measure_cov) {
-    int res, childstatus;
-    static struct itimerval it;
+int exec_fork_branch(int id, uint64_t timeout, int stdin_size,
+                     char *stdin_data, uint64_t targ_addr, uint32_t targ_index,
+                     int measure_cov) {
+    struct executor *e = &executors[id];
+    int res, childstatus, timed_out;
+    pid_t pid;
 
     /* TODO : what if we want to use pseudo-terminal? */
-    write_stdin(branch_stdin_fd, stdin_size, stdin_data);
+    write_stdin(e->branch_stdin_fd, stdin_size, stdin_data);
 
-    if ((res = write(branch_fsrv_ctl_fd, &targ_addr, 8)) != 8) {
+    if ((res = write(e->branch_fsrv_ctl_fd, &targ_addr, 8)) != 8) {
       perror("exec_fork_branch: Cannot send targ_addr to fork server");
       printf("write() call ret = %d\n", res);
       return -1;
     }
 
-    if ((res = write(branch_fsrv_ctl_fd, &targ_index, 4)) != 4) {
+    if ((res = write(e->branch_fsrv_ctl_fd, &targ_index, 4)) != 4) {
       perror("exec_fork_branch: Cannot send targ_index to fork server");
       printf("write() call ret = %d\n", res);
       return -1;
     }
 
-    if ((res = write(branch_fsrv_ctl_fd, &measure_cov, 4)) != 4) {
+    if ((res = write(e->branch_fsrv_ctl_fd, &measure_cov, 4)) != 4) {
       perror("exec_fork_branch: Cannot send measure_cov to fork server");
       printf("write() call ret = %d\n", res);
       return -1;
     }
 
-    if ((res = read(branch_fsrv_st_fd, &child_pid, 4)) != 4) {
+    if ((res = read(e->branch_fsrv_st_fd, &pid, 4)) != 4) {
       perror("exec_fork_branch: Cannot receive child pid from fork server");
-      printf("read() call ret = %d, child_pid = %d\n", res, child_pid);
+      printf("read() call ret = %d, child_pid = %d\n", res, pid);
       return -1;
     }
 
-    if (child_pid <= 0) {
+    if (pid <= 0) {
       perror("exec_fork_branch: Fork server is mibehaving");
       return -1;
     }
 
-    it.it_value.tv_sec = (timeout / 1000);
-    it.it_value.tv_usec = (timeout % 1000) * 1000;
-    setitimer(ITIMER_REAL, &it, NULL);
-
-    if ((res = read(branch_fsrv_st_fd, &childstatus, 4)) != 4) {
+    res = wait_child_status(e->branch_fsrv_st_fd, pid, timeout, &childstatus,
+                            &timed_out);
+    if (res != 4) {
       perror("exec_fork_branch: Unable to communicate with fork server");
       printf("read() call ret = %d, childstatus = %d\n", res, childstatus);
       return -1;
     }
 
-    if (!WIFSTOPPED(childstatus)) child_pid = 0;
-
-    it.it_value.tv_sec = 0;
-    it.it_value.tv_usec = 0;
-    setitimer(ITIMER_REAL, &it, NULL);
-
-    if ( WIFEXITED( childstatus ) ) return 0;
-
-    if ( WIFSIGNALED( childstatus ) ) {
-        if ( WTERMSIG( childstatus ) == SIGSEGV ) return SIGSEGV;
-        else if ( WTERMSIG( childstatus ) == SIGFPE ) return SIGFPE;
-        else if ( WTERMSIG( childstatus ) == SIGILL ) return SIGILL;
-        else if ( WTERMSIG( childstatus ) == SIGABRT ) return SIGABRT;
-        else if ( timeout_flag ) return SIGALRM;
-        else return 0;
-    } else {
-        return 0;
-    }
+    return status_to_signal(childstatus, timed_out);
 }
@@ -0,0 +1,122 @@
+/// Checkpoint of the fuzzing state, to resume fuzzing after a restart without
+/// re-evaluating the seeds from scratch. A checkpoint holds the seeds in the
+/// queue (with their ByteVal constraints and cursors), the edge bitmap, the
+/// calibrated execution timeouts, the test case counters and the offsets of
+/// the synchronization with AFL. It is written to a temporary file and then
+/// renamed, so that a crash in the middle leaves the previous checkpoint.
+module Eclipser.Checkpoint
+
+open System.Diagnostics
+open System.IO
+open Config
+open Utils
+open Options
+
+let private MAGIC = 0x45434b50u // "ECKP"
+let private VERSION = 1
+
+let private stopWatch = Stopwatch()
+
+let private getPath opt = Path.Combine(opt.OutDir, ".checkpoint")
+
+let exists opt = File.Exists(getPath opt)
+
+/// Check if CHECKPOINT_INTERVAL has passed since the last checkpoint.
+let isDue () =
+  if not stopWatch.IsRunning then stopWatch.Start()
+  stopWatch.Elapsed.TotalSeconds >= float CHECKPOINT_INTERVAL
+
+(*** Serialization ***)
+
+let private writeItem (w: BinaryWriter) (priority, seed: Seed) =
+  w.Write(if priority = Favored then 0uy else 1uy)
+  Seed.write w seed
+
+let private readItem (r: BinaryReader) =
+  let priority = if r.ReadByte() = 0uy then Favored else Normal
+  (priority, Seed.read r)
+
+let private writeList (w: BinaryWriter) writeElem elems =
+  w.Write(List.length elems)
+  List.iter (writeElem w) elems
+
+let private readList (r: BinaryReader) readElem =
+  List.init (r.ReadInt32()) (fun _ -> readElem r)
+
+(*** Save and load ***)
+
+let private writeState (w: BinaryWriter) opt items =
+  w.Write(MAGIC)
+  w.Write(VERSION)
+  w.Write(opt.ExecTimeout)
+  let writeTimeout (w: BinaryWriter) (mode, timeout: uint64) =
+    w.Write(Stats.ExecMode.toIndex mode)
+    w.Write(timeout)
+  writeList w writeTimeout (ExecTimeout.getAdaptiveTimeouts ())
+  let writeMaxImport (w: BinaryWriter) (dir: string, maxImport: int) =
+    w.Write(dir)
+    w.Write(maxImport)
+  writeList w writeMaxImport (Sync.getMaxImports ())
+  let counters = TestCase.getCounters ()
+  w.Write(counters.Length)
+  Array.iter (fun (n: int) -> w.Write(n)) counters
+  let bitmap = Bitmap.openShared (Executor.getBitmapLog ())
+  let bitmapBytes = Bitmap.read bitmap
+  Bitmap.close bitmap
+  w.Write(bitmapBytes.Length)
+  w.Write(bitmapBytes)
+  w.Write(ByteRelevance.getLineageCount ())
+  writeList w writeItem items
+
+/// Save the seeds in 'items' and the other states of fuzzing. The seeds that
+/// are being fuzzed should be included as well, since they are not in queue.
+let save opt items =
+  let path = getPath opt
+  let tmpPath = path + ".tmp"
+  using (new FileStream(tmpPath, FileMode.Create)) (fun f ->
+    use w = new BinaryWriter(f)
+    writeState w opt items
+    w.Flush()
+    f.Flush(true))
+  if File.Exists(path) then File.Replace(tmpPath, path, null)
+  else File.Move(tmpPath, path)
+  stopWatch.Restart()
+  if opt.Verbosity >= 1 then
+    log "[*] Saved checkpoint with %d seeds" (List.length items)
+
+let private readState (r: BinaryReader) opt =
+  if r.ReadUInt32() <> MAGIC || r.ReadInt32() <> VERSION then
+    failwith "Invalid checkpoint file"
+  let execTimeout = r.ReadUInt64()
+  let readTimeout (r: BinaryReader) =
+    let mode = List.item (r.ReadInt32()) Stats.allExecModes
+    (mode, r.ReadUInt64())
+  let modeTimeouts = readList r readTimeout
+  let readMaxImport (r: BinaryReader) =
+    let dir = r.ReadString()
+    (dir, r.ReadInt32())
+  Sync.restoreMaxImports (readList r readMaxImport)
+  let counters = Array.init (r.ReadInt32()) (fun _ -> r.ReadInt32())
+  TestCase.restoreCounters counters
+  let bitmapBytes = r.ReadBytes(r.ReadInt32())
+  let bitmap = Bitmap.openShared (Executor.getBitmapLog ())
+  Bitmap.merge bitmap bitmapBytes
+  Bitmap.close bitmap
+  ByteRelevance.reserveLineages (r.ReadInt32())
+  let items = readList r readItem
+  // An explicitly given timeout takes precedence over the calibrated ones.
+  if opt.ExecTimeout <> 0UL then (opt, items)
+  else ExecTimeout.restoreAdaptive modeTimeouts
+       ({ opt with ExecTimeout = execTimeout }, items)
+
+/// Load the checkpoint in the output directory, and restore the states of
+/// fuzzing. Should be called after the executor and the test case storage are
+/// initialized. Returns the option with the calibrated execution timeout, and
+/// the seeds to enqueue.
+let load opt =
+  use f = File.OpenRead(getPath opt)
+  use r = new BinaryReader(f)
+  let opt, items = readState r opt
+  log "[*] Resumed from checkpoint with %d seeds" (List.length items)
+  stopWatch.Restart()
+  (opt, items)
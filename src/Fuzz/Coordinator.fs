@@ -0,0 +1,247 @@
+/// Exchange of seeds and edge coverage among Eclipser instances, which possibly
+/// run on different machines. Each instance pushes the seeds it found to the
+/// coordinator, along with the bitmap delta of each seed. Then it pulls the
+/// seeds found by the other instances and the union of all the bitmaps, so it
+/// does not have to re-execute the seeds to learn their coverage.
+module Eclipser.Coordinator
+
+open System
+open System.IO
+open System.Net
+open System.Net.Sockets
+open System.Collections.Generic
+open System.Threading
+open Config
+open Utils
+open Bitmap
+open Options
+
+(*** Protocol ***)
+
+// Requests sent from an instance, after it sends its name on connection.
+let private REQ_PUSH = 1uy
+let private REQ_PULL = 2uy
+
+let private writeSeed (w: BinaryWriter) (data: byte array, delta: BitmapDelta) =
+  w.Write(data.Length)
+  w.Write(data)
+  w.Write(delta.Length)
+  Array.iter (fun (idx: int, bits: byte) -> w.Write(idx); w.Write(bits)) delta
+
+// Read a seed and its bitmap delta, rejecting the sizes and the indices out of
+// range, which a malformed message would make us allocate or write to.
+let private readSeed (r: BinaryReader) =
+  let len = r.ReadInt32()
+  if len < 0 || len > MAX_INPUT_LEN then failwithf "Invalid seed length %d" len
+  let data = r.ReadBytes(len)
+  if data.Length <> len then raise (EndOfStreamException())
+  let readBits _ =
+    let idx = r.ReadInt32()
+    if idx < 0 || int64 idx >= BITMAP_SIZE then
+      failwithf "Invalid bitmap index %d" idx
+    (idx, r.ReadByte())
+  let count = r.ReadInt32()
+  if count < 0 || int64 count > BITMAP_SIZE then
+    failwithf "Invalid bitmap delta size %d" count
+  (data, Array.init count readBits)
+
+(*** Coordinator process ***)
+
+/// A seed pushed to the coordinator, and the name of the instance that found
+/// it. The index in 'entries' plus one is used as the ID of a seed.
+type private Entry = {
+  Owner : string
+  Data : byte array
+  Delta : BitmapDelta
+}
+
+let private entries = new List<Entry> ()
+let private union = Bitmap.empty ()
+let private serverLock = obj ()
+
+// The whole message is read and validated before updating the entries and the
+// union, so that a malformed push is dropped along with the connection.
+let private handlePush owner (r: BinaryReader) (w: BinaryWriter) =
+  let count = r.ReadInt32()
+  if count < 0 || count > COORDINATOR_PUSH_MAX then
+    failwithf "Invalid seed count %d" count
+  let seeds = List.init count (fun _ -> readSeed r)
+  lock serverLock (fun () ->
+    for (data, delta) in seeds do
+      entries.Add({ Owner = owner; Data = data; Delta = delta })
+      Bitmap.apply union delta)
+  w.Write(List.length seeds)
+
+// Union of the bitmaps of the seeds before 'endId'. Once the instance merges
+// it, it skips the seeds covered by its bitmap, so the union should not cover
+// the seeds that are not pulled yet.
+let private unionUntil endId =
+  if endId = entries.Count then Array.copy union
+  else
+    let partial = Bitmap.empty ()
+    for i in 0 .. endId - 1 do Bitmap.apply partial entries.[i].Delta
+    partial
+
+// Send the seeds pushed after 'lastId' by the other instances, the union of the
+// bitmaps up to the last sent seed, and the ID to resume from in the next pull.
+let private handlePull owner (r: BinaryReader) (w: BinaryWriter) =
+  let lastId = int (r.ReadInt64())
+  let seeds, unionCopy, newLastId =
+    lock serverLock (fun () ->
+      if lastId < 0 || lastId > entries.Count then
+        failwithf "Invalid seed ID %d" lastId
+      let newLastId = min entries.Count (lastId + COORDINATOR_PULL_MAX)
+      let seeds = [ for i in lastId .. (newLastId - 1) do
+                      if entries.[i].Owner <> owner then yield entries.[i] ]
+      (seeds, unionUntil newLastId, newLastId))
+  w.Write(List.length seeds)
+  List.iter (fun e -> writeSeed w (e.Data, e.Delta)) seeds
+  w.Write(unionCopy)
+  w.Write(int64 newLastId)
+
+let private handleClient (client: TcpClient) () =
+  use client = client
+  use stream = client.GetStream()
+  use r = new BinaryReader(stream)
+  use w = new BinaryWriter(stream)
+  try
+    let owner = r.ReadString()
+    log "[*] Instance connected : %s" owner
+    try
+      while true do
+        let req = r.ReadByte()
+        if req = REQ_PUSH then handlePush owner r w
+        elif req = REQ_PULL then handlePull owner r w
+        else failwithf "Unknown request %d" req
+        w.Flush()
+    with
+    | :? EndOfStreamException | :? IOException ->
+      log "[*] Instance disconnected : %s" owner
+  with e -> log "[Warning] Failed to serve instance : %s" e.Message
+
+/// Run the coordinator, which serves each instance in a separate thread.
+let run copt =
+  let listener = new TcpListener(IPAddress.Parse(copt.BindAddr), copt.Port)
+  listener.Start()
+  log "[*] Coordinator listening on %s:%d" copt.BindAddr copt.Port
+  while true do
+    let client = listener.AcceptTcpClient()
+    let thread = Thread(handleClient client)
+    thread.IsBackground <- true
+    thread.Start()
+
+(*** Instance side ***)
+
+type private Connection = {
+  Client : TcpClient
+  Reader : BinaryReader
+  Writer : BinaryWriter
+  Bitmap : SharedBitmap
+}
+
+let mutable private connection : Connection option = None
+// Content of the local bitmap when the last seed was recorded.
+let mutable private snapshot = Bitmap.empty ()
+let private pendings = new List<byte array * BitmapDelta> ()
+let mutable private lastPulled = 0L
+let private clientLock = obj ()
+
+let private parseAddr (addr: string) =
+  let sepIdx = addr.LastIndexOf(':')
+  if sepIdx < 0 then failwithf "Invalid coordinator address : %s" addr
+  (addr.[.. sepIdx - 1], int addr.[sepIdx + 1 ..])
+
+let private connect opt bitmapPath =
+  let host, port = parseAddr opt.Coordinator
+  let client = new TcpClient(host, port)
+  client.ReceiveTimeout <- COORDINATOR_TIMEOUT_MS
+  client.SendTimeout <- COORDINATOR_TIMEOUT_MS
+  let stream = client.GetStream()
+  let writer = new BinaryWriter(stream)
+  let name = sprintf "%s:%s" Environment.MachineName
+                 (Path.GetFullPath(opt.OutDir))
+  writer.Write(name)
+  writer.Flush()
+  let bitmap = Bitmap.openShared bitmapPath
+  snapshot <- Bitmap.read bitmap
+  { Client = client; Reader = new BinaryReader(stream); Writer = writer
+    Bitmap = bitmap }
+
+let private disconnect conn =
+  connection <- None
+  conn.Client.Dispose()
+  Bitmap.close conn.Bitmap
+
+/// Connect to the coordinator if its address is given. Should be called after
+/// the bitmap file is created (cf. Executor.initialize()).
+let initialize opt bitmapPath =
+  if opt.Coordinator <> "" then
+    try
+      connection <- Some (connect opt bitmapPath)
+      log "[*] Connected to coordinator %s" opt.Coordinator
+    with e ->
+      log "[Warning] Failed to connect to coordinator : %s" e.Message
+
+/// Record a newly found seed to push. Edges found since the previous call are
+/// attributed to this seed.
+let recordSeed (data: byte array) =
+  match connection with
+  | None -> ()
+  | Some conn ->
+    lock clientLock (fun () ->
+      let cur = Bitmap.read conn.Bitmap
+      pendings.Add((data, Bitmap.diff snapshot cur))
+      snapshot <- cur)
+
+// Push up to COORDINATOR_PUSH_MAX seeds, and leave the rest for the next push.
+let private push conn =
+  let seeds = lock clientLock (fun () ->
+    let count = min pendings.Count COORDINATOR_PUSH_MAX
+    let seeds = List.ofSeq (pendings.GetRange(0, count))
+    pendings.RemoveRange(0, count)
+    seeds)
+  conn.Writer.Write(REQ_PUSH)
+  conn.Writer.Write(List.length seeds)
+  List.iter (writeSeed conn.Writer) seeds
+  conn.Writer.Flush()
+  conn.Reader.ReadInt32() |> ignore
+
+let private pull conn =
+  conn.Writer.Write(REQ_PULL)
+  conn.Writer.Write(lastPulled)
+  conn.Writer.Flush()
+  let seedCount = conn.Reader.ReadInt32()
+  let seeds = List.init seedCount (fun _ -> readSeed conn.Reader)
+  let unionMap = conn.Reader.ReadBytes(int BITMAP_SIZE)
+  lastPulled <- conn.Reader.ReadInt64()
+  (seeds, unionMap)
+
+// Import the seeds that cover any edge not covered yet, without executing them,
+// and merge the union bitmap into the local bitmap.
+let private import opt conn (seeds, unionMap) =
+  let localMap = Bitmap.read conn.Bitmap
+  let folder accSeeds (data, delta) =
+    if Bitmap.isCovered localMap delta then accSeeds
+    else Bitmap.apply localMap delta
+         Seed.makeWith opt.FuzzSource data :: accSeeds
+  let newSeeds = List.fold folder [] seeds |> List.rev
+  Bitmap.merge conn.Bitmap unionMap
+  lock clientLock (fun () -> Bitmap.unionInto snapshot unionMap)
+  if opt.Verbosity >= 1 && not (List.isEmpty seeds) then
+    log "[*] Imported %d seeds from coordinator (skipped %d covered ones)"
+      (List.length newSeeds) (List.length seeds - List.length newSeeds)
+  List.map (fun seed -> (Favored, seed)) newSeeds
+
+/// Push the recorded seeds to the coordinator and pull new seeds found by the
+/// other instances. Returns the items to add to the seed queue.
+let exchange opt =
+  match connection with
+  | None -> []
+  | Some conn ->
+    try
+      push conn
+      import opt conn (pull conn)
+    with e ->
+      log "[Warning] Lost connection to coordinator : %s" e.Message
+      disconnect conn
+      []
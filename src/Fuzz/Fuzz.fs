@@ -14,52 +14,113 @@ let private initializeSeeds opt =
        |> List.map System.IO.File.ReadAllBytes // Read in file contents
        |> List.map (Seed.makeWith opt.FuzzSource) // Create seed with content
 
-let private checkInitSeedCoverage opt seed =
-  let exitSig, covGain = Executor.getCoverage opt seed
-  TestCase.save opt seed exitSig covGain
+(*** Calibration of initial seeds ***)
+
+// Execution times of the initial seeds, from which the initial timeout is
+// estimated. 'StableRef' is the estimate that the recent estimates stayed close
+// to, for 'StableCount' seeds in a row.
+type private Calibration = {
+  mutable Count : int
+  mutable SumTime : float
+  mutable MaxTime : float
+  mutable StableRef : uint64
+  mutable StableCount : int
+}
+
+// Adopt the basic idea from AFL, and adjust coefficients and range for
+// Eclipser.
+let private estimateTimeout cal =
+  let avgExecTime = cal.SumTime / float (max 1 cal.Count)
+  let execTimeout = uint64 (max (4.0 * avgExecTime) (1.2 * cal.MaxTime))
+  min EXEC_TIMEOUT_MAX (max EXEC_TIMEOUT_MIN execTimeout)
+
+let private isStable cal = cal.StableCount >= CALIBRATE_STABLE_N
+
+let private addExecTime cal execTime =
+  lock cal (fun () ->
+    cal.Count <- cal.Count + 1
+    cal.SumTime <- cal.SumTime + execTime
+    cal.MaxTime <- max cal.MaxTime execTime
+    let estimate = estimateTimeout cal
+    let diff = abs (float estimate - float cal.StableRef)
+    if diff <= CALIBRATE_STABLE_RATIO * float cal.StableRef then
+      cal.StableCount <- cal.StableCount + 1
+    else
+      cal.StableRef <- estimate
+      cal.StableCount <- 0)
+
+let private measureTime f =
+  let stopWatch = System.Diagnostics.Stopwatch.StartNew()
+  let result = f ()
+  (result, stopWatch.Elapsed.TotalMilliseconds)
+
+// Run an initial seed once with each tracer, and record its coverage and its
+// execution time (the longer one of the two tracers). Once the estimate is
+// stable, only the coverage is measured, with the estimated timeout.
+let private calibrateSeed opt cal seed =
+  let isTiming, execOpt =
+    if opt.ExecTimeout <> 0UL then (false, opt)
+    else lock cal (fun () ->
+      if isStable cal then (false, { opt with ExecTimeout = cal.StableRef })
+      else (true, { opt with ExecTimeout = EXEC_TIMEOUT_MAX }))
+  let (exitSig, covGain), time1 =
+    measureTime (fun () -> Executor.getCoverage execOpt seed)
+  if isTiming then
+    // Use a dummy 'tryVal' arg.
+    let _, time2 =
+      measureTime (fun () -> Executor.getBranchTrace execOpt seed 0I)
+    addExecTime cal (max time1 time2)
+  TestCase.save execOpt seed exitSig covGain
   match Priority.ofCoverageGain covGain with
   | None -> None
   | Some priority -> Some (priority, seed)
 
+// Calibrate the initial seeds in parallel, with a worker for each execution
+// instance. The items are returned in the order of the seeds.
+let private runCalibration opt cal (seeds: Seed array) =
+  let results = Array.zeroCreate seeds.Length
+  let next = ref -1
+  let rec work () =
+    let i = System.Threading.Interlocked.Increment(next)
+    if i < seeds.Length then
+      results.[i] <- calibrateSeed opt cal seeds.[i]
+      work ()
+  if opt.Jobs = 1 then work ()
+  else
+    let runWorker id () =
+      Executor.initializeWorker opt id
+      work ()
+    let startWorker id =
+      let thread = System.Threading.Thread(runWorker id)
+      thread.Start()
+      thread
+    let threads = List.map startWorker [0 .. opt.Jobs - 1]
+    List.iter (fun (t: System.Threading.Thread) -> t.Join()) threads
+  List.choose id (List.ofArray results)
+
+// Evaluate the initial seeds to build the initial seed queue. If the execution
+// timeout is not given, also decide the initial timeout to adapt for each
+// tracer mode, from the execution times of the seeds.
 let private initializeQueue opt seeds =
-  // If the execution timeout is not given, use a large enough value for now.
-  let opt = if opt.ExecTimeout <> 0UL then opt
-            else { opt with ExecTimeout = EXEC_TIMEOUT_MAX }
-  let initItems = List.choose (checkInitSeedCoverage opt) seeds
-  List.fold SeedQueue.enqueue SeedQueue.empty initItems
-
-// Measure the execution time of an initial seed. Choose the longer time between
-// getCoverage() and getBranchTrace() call.
-let private getInitSeedExecTime opt seed =
-  let stopWatch = new System.Diagnostics.Stopwatch()
-  stopWatch.Start()
-  Executor.getCoverage opt seed |> ignore
-  let time1 = stopWatch.Elapsed.TotalMilliseconds
-  stopWatch.Reset()
-  stopWatch.Start()
-  Executor.getBranchTrace opt seed 0I |> ignore // Use a dummy 'tryVal' arg.
-  let time2 = stopWatch.Elapsed.TotalMilliseconds
-  max time1 time2
-
-// Decide execution timeout based on the execution time of initial seeds. Adopt
-// the basic idea from AFL, and adjust coefficients and range for Eclipser.
-let private decideExecTimeout (execTimes: float list) =
-  let avgExecTime = List.average execTimes
-  let maxExecTime = List.max execTimes
-  log "[*] Initial seed execution time: avg = %.1f (ms), max = %.1f (ms)"
-    avgExecTime maxExecTime
-  let execTimeout = uint64 (max (4.0 * avgExecTime) (1.2 * maxExecTime))
-  let execTimeout = min EXEC_TIMEOUT_MAX (max EXEC_TIMEOUT_MIN execTimeout)
-  log "[*] Set execution timeout to %d (ms)" execTimeout
-  execTimeout
-
-// If the execution timeout is not given, set it to a large enough value and
-// find each seed's execution time. Then, decide a new timeout based on them.
-let private updateExecTimeout opt seeds =
-  if opt.ExecTimeout <> 0UL then opt
-  else let opt = { opt with ExecTimeout = EXEC_TIMEOUT_MAX }
-       let execTimes = List.map (getInitSeedExecTime opt) seeds
-       { opt with ExecTimeout = decideExecTimeout execTimes }
+  let cal = { Count = 0; SumTime = 0.0; MaxTime = 0.0; StableRef = 0UL
+              StableCount = 0 }
+  let initItems = runCalibration opt cal (Array.ofList seeds)
+  let initQueue = List.fold SeedQueue.enqueue SeedQueue.empty initItems
+  if opt.ExecTimeout <> 0UL then (opt, initQueue)
+  else
+    log "[*] Initial seed execution time: avg = %.1f (ms), max = %.1f (ms)"
+      (cal.SumTime / float (max 1 cal.Count)) cal.MaxTime
+    log "[*] Timed %d out of %d initial seeds" cal.Count (List.length seeds)
+    let execTimeout = estimateTimeout cal
+    log "[*] Set execution timeout to %d (ms)" execTimeout
+    ExecTimeout.enableAdaptive execTimeout
+    ({ opt with ExecTimeout = execTimeout }, initQueue)
+
+// Restore the seed queue and the calibrated timeout from the checkpoint,
+// instead of evaluating and timing the initial seeds again.
+let private resumeQueue opt =
+  let opt, items = Checkpoint.load opt
+  (opt, List.fold SeedQueue.enqueue SeedQueue.empty items)
 
 let private evalSeed opt seed exitSig covGain =
   TestCase.save opt seed exitSig covGain
@@ -74,7 +135,10 @@ let private makeRelocatedItems opt seeds =
     | Some pr -> List.map (fun s -> (pr, s)) (Seed.relocateCursor seed)
   List.collect collector seeds
 
-let private makeSteppedItems pr seed =
+// If the executions of the seed repeatedly timed out, demote it to the normal
+// priority, so that it does not keep the fuzzing workers busy.
+let private makeSteppedItems opt pr seed =
+  let pr = if ExecTimeout.flagSeed opt seed then Normal else pr
   match Seed.proceedCursor seed with
   | None -> []
   | Some s -> [(pr, s)]
@@ -85,36 +149,115 @@ let private scheduleWithAFL opt =
 
 // Sychronize the seed queue with AFL instances.
 let private syncWithAFL opt seedQueue n =
-  if opt.SyncDir <> "" && n % SYNC_N = 0 then Sync.run opt seedQueue
+  if opt.SyncDir <> "" && n % SYNC_N = 0 then
+    Stats.measure Stats.Sync (fun () -> Sync.run opt seedQueue)
   else seedQueue
 
+// Exchange seeds with the other Eclipser instances through the coordinator.
+let private syncWithPeers opt n =
+  if opt.Coordinator <> "" && n % SYNC_N = 0 then
+    Stats.measure Stats.Sync (fun () -> Coordinator.exchange opt)
+  else []
+
+// Run grey-box concolic testing on a seed, and return new items to enqueue.
+let private fuzzOne opt priority seed =
+  if opt.Verbosity >= 2 then log "Fuzzing with: %s" (Seed.toString seed)
+  ExecTimeout.resetSeedTimeouts ()
+  let startExecs = Stats.getThreadExecCount ()
+  let startTick = System.Diagnostics.Stopwatch.GetTimestamp()
+  Executor.beginRound seed
+  let newItems = GreyConcolic.run seed opt
+  Executor.endRound ()
+  // Record the cost and the yield of this seed, to schedule its descendants.
+  let ticks = System.Diagnostics.Stopwatch.GetTimestamp() - startTick
+  let execs = Stats.getThreadExecCount () - startExecs
+  let newEdges = List.filter (fun (_, _, gain) -> gain = NewEdge) newItems
+  SeedCost.record seed execs ticks (List.length newEdges)
+  // Relocate the cursors of newly generated seeds.
+  let relocatedItems = makeRelocatedItems opt newItems
+  // Also generate seeds by just stepping the cursor of the original seed.
+  let steppedItems = makeSteppedItems opt priority seed
+  relocatedItems @ steppedItems
+
+let private waitSeed opt n =
+  if n % 10 = 0 && opt.Verbosity >= 2 then log "Seed queue empty, waiting..."
+  System.Threading.Thread.Sleep(1000)
+
+let private saveCheckpoint opt items =
+  try Checkpoint.save opt items with
+  | e -> log "[Warning] Failed to save checkpoint : %s" e.Message
+
 let rec private fuzzLoop opt seedQueue n =
+  if Checkpoint.isDue () then saveCheckpoint opt (SeedQueue.toList seedQueue)
   scheduleWithAFL opt
   let seedQueue = syncWithAFL opt seedQueue n
+  let seedQueue = List.fold SeedQueue.enqueue seedQueue (syncWithPeers opt n)
+  FuzzerStats.updateQueueSizes (SeedQueue.getSizes seedQueue)
   if SeedQueue.isEmpty seedQueue then
-    if n % 10 = 0 && opt.Verbosity >= 2 then log "Seed queue empty, waiting..."
-    System.Threading.Thread.Sleep(1000)
+    waitSeed opt n
     fuzzLoop opt seedQueue (n + 1)
   else
     let priority, seed, seedQueue = SeedQueue.dequeue seedQueue
-    if opt.Verbosity >= 2 then log "Fuzzing with: %s" (Seed.toString seed)
-    let newItems = GreyConcolic.run seed opt
-    // Relocate the cursors of newly generated seeds.
-    let relocatedItems = makeRelocatedItems opt newItems
-    // Also generate seeds by just stepping the cursor of the original seed.
-    let steppedItems = makeSteppedItems priority seed
+    let newItems = fuzzOne opt priority seed
     // Add the new items to the seed queue.
-    let seedQueue = List.fold SeedQueue.enqueue seedQueue relocatedItems
-    let seedQueue = List.fold SeedQueue.enqueue seedQueue steppedItems
+    let seedQueue = List.fold SeedQueue.enqueue seedQueue newItems
     fuzzLoop opt seedQueue (n + 1)
 
+(*** Parallel mode ***)
+
+// The seeds being fuzzed by the workers are included in checkpoints as well.
+let private saveParallelCheckpoint opt wsQueue =
+  saveCheckpoint opt (WorkStealingQueue.toList wsQueue)
+
+// Only worker 0 schedules the resource and synchronizes with AFL instances and
+// the other Eclipser instances, on behalf of the whole process. Imported seeds
+// go to the queue of worker 0.
+let private coordinateWithAFL opt wsQueue id n =
+  if id = 0 then
+    if Checkpoint.isDue () then saveParallelCheckpoint opt wsQueue
+    scheduleWithAFL opt
+    if opt.SyncDir <> "" && n % SYNC_N = 0 then
+      let synced = Stats.measure Stats.Sync (fun () ->
+        Sync.run opt SeedQueue.empty)
+      WorkStealingQueue.merge wsQueue id synced
+    WorkStealingQueue.enqueue wsQueue id (syncWithPeers opt n)
+    FuzzerStats.updateQueueSizes (WorkStealingQueue.getSizes wsQueue)
+
+let rec private parallelFuzzLoop opt wsQueue id n =
+  coordinateWithAFL opt wsQueue id n
+  match WorkStealingQueue.tryDequeue wsQueue id with
+  | None -> waitSeed opt n
+  | Some (priority, seed) ->
+    let newItems = fuzzOne opt priority seed
+    WorkStealingQueue.complete wsQueue id newItems
+  parallelFuzzLoop opt wsQueue id (n + 1)
+
+let private runWorker opt wsQueue id () =
+  Executor.initializeWorker opt id
+  parallelFuzzLoop opt wsQueue id 1
+
+// Run 'opt.Jobs' workers, which share the edge coverage bitmap and steal seeds
+// from each other's queues.
+let private parallelFuzz opt initQueue =
+  log "[*] Start %d fuzzing workers" opt.Jobs
+  let wsQueue = WorkStealingQueue.create opt.Jobs initQueue
+  let startWorker id =
+    let thread = System.Threading.Thread(runWorker opt wsQueue id)
+    thread.Start()
+    thread
+  let threads = List.map startWorker [0 .. opt.Jobs - 1]
+  List.iter (fun (t: System.Threading.Thread) -> t.Join()) threads
+
 let private terminator timelimitSec = async {
   let timespan = System.TimeSpan(0, 0, 0, timelimitSec)
   System.Threading.Thread.Sleep(timespan)
   log "[*] Fuzzing timeout expired."
   log "===== Statistics ====="
   TestCase.printStatistics ()
+  log "Crash suspects left untriaged : %d" (TestCase.getPendingTriageCount ())
+  FuzzerStats.update ()
   log "Done, clean up and exit..."
+  Executor.stopRecording ()
   Executor.cleanup ()
   exit (0)
 }
@@ -126,8 +269,7 @@ let private setTimer opt =
   else
     log "[*] No time limit given, run infinitely"
 
-[<EntryPoint>]
-let main args =
+let private fuzz args =
   let opt = parseFuzzOption args
   validateFuzzOption opt
   assertFileExists opt.TargetProg
@@ -135,12 +277,41 @@ let main args =
   createDirectoryIfNotExists opt.OutDir
   TestCase.initialize opt.OutDir
   Executor.initialize opt
-  let initialSeeds = initializeSeeds opt
-  log "[*] Total %d initial seeds" (List.length initialSeeds)
-  let initQueue = initializeQueue opt initialSeeds
-  let opt = updateExecTimeout opt initialSeeds
+  if opt.RecordLog <> "" then
+    log "[*] Record executions to %s" opt.RecordLog
+    Executor.startRecording opt opt.RecordLog
+  Coordinator.initialize opt (Executor.getBitmapLog ())
+  FuzzerStats.initialize opt (Executor.getBitmapLog ())
+  let opt, initQueue =
+    if opt.Resume && Checkpoint.exists opt then resumeQueue opt
+    else
+      if opt.Resume then log "[Warning] No checkpoint found, start from seeds"
+      let initialSeeds = initializeSeeds opt
+      log "[*] Total %d initial seeds" (List.length initialSeeds)
+      initializeQueue opt initialSeeds
   setTimer opt
   Scheduler.initialize () // Should be called after preprocessing initial seeds.
   log "[*] Start fuzzing"
-  fuzzLoop opt initQueue 1 // Start from 1, to slightly defer the first sync.
+  // Start from 1, to slightly defer the first sync.
+  if opt.Jobs > 1 then parallelFuzz opt initQueue else fuzzLoop opt initQueue 1
   0 // Unreachable
+
+[<EntryPoint>]
+let main args =
+  match List.ofArray args with
+  | "coordinator" :: restArgs ->
+    Coordinator.run (parseCoordinatorOption (Array.ofList restArgs))
+    0
+  | "cmin" :: restArgs ->
+    Minimize.runCmin (parseMinimizeOption "cmin" (Array.ofList restArgs))
+    0
+  | "tmin" :: restArgs ->
+    Minimize.runTmin (parseMinimizeOption "tmin" (Array.ofList restArgs))
+    0
+  | "profile" :: restArgs ->
+    Profile.run (parseProfileOption (Array.ofList restArgs))
+    0
+  | "replay" :: restArgs ->
+    Replay.run (parseReplayOption (Array.ofList restArgs))
+    0
+  | _ -> fuzz args
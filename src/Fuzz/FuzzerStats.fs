@@ -0,0 +1,151 @@
+/// Periodically report the statistics of fuzzing to 'fuzzer_stats' and
+/// 'plot_data' files in the output directory, in a format similar to AFL.
+module Eclipser.FuzzerStats
+
+open System
+open System.Diagnostics
+open System.IO
+open System.Threading
+open Config
+open Utils
+open Options
+
+let mutable private statsPath = ""
+let mutable private plotPath = ""
+let mutable private startTime = 0L
+let mutable private bitmap : Bitmap.SharedBitmap option = None
+let mutable private timer : Timer = null
+let mutable private queueSizes = (0, 0)
+let mutable private prevExecs = 0L
+let mutable private prevTick = 0L
+let private updateLock = obj ()
+
+/// Update the number of favored and normal seeds in the seed queue.
+let updateQueueSizes sizes = queueSizes <- sizes
+
+let private getBitmapCoverage () =
+  match bitmap with
+  | None -> 0.0
+  | Some bm ->
+    let edgeCount = Bitmap.popCount (Bitmap.read bm)
+    float edgeCount * 100.0 / float (BITMAP_SIZE * 8L)
+
+let private getElapsedSec () =
+  float (DateTimeOffset.UtcNow.ToUnixTimeSeconds() - startTime)
+
+// Counters of the tracers, to tell whether the target is translation-bound or
+// execution-bound. Unlike the fork server, the number of executions is always
+// counted on our side, so use it to average the counters of the children.
+let private tracerEntries (tracer, name, modes) =
+  let st = Executor.getTracerStats tracer
+  let execs = max 1L (List.sumBy Stats.getExecCount modes)
+  let forkedExecs = max 1UL st.ForkedExecs
+  let perExec (n: uint64) = sprintf "%.2f" (float n / float execs)
+  let avgMicrosecs (ns: uint64) =
+    sprintf "%.1f" (float ns / 1000.0 / float forkedExecs)
+  [ (sprintf "tracer_%s_fork_us" name, avgMicrosecs st.ForkNanosecs)
+    (sprintf "tracer_%s_exec_us" name, avgMicrosecs st.ExecNanosecs)
+    (sprintf "tracer_%s_tb_per_exec" name, perExec st.TBTranslated)
+    (sprintf "tracer_%s_tsl_requests" name, string st.TSLRequests)
+    (sprintf "tracer_%s_tsl_mirrored" name, string st.TSLMirrored)
+    (sprintf "tracer_%s_cmp_per_exec" name, perExec st.CmpLogged)
+    (sprintf "tracer_%s_trace_aborts" name, string st.TraceAborts) ]
+
+// Execution timeouts of each mode, if they adapt to the latency of the target.
+let private timeoutEntries () =
+  let toEntry (mode, timeout) =
+    (sprintf "exec_timeout_%s" (Stats.ExecMode.toString mode), string timeout)
+  List.map toEntry (ExecTimeout.getAdaptiveTimeouts ())
+
+let private tracers =
+  [ (Executor.Coverage, "coverage", [ Stats.CoverageExec ])
+    (Executor.Branch, "branch", [ Stats.BranchTraceExec; Stats.BranchInfoExec ]) ]
+
+// Note that 'paths_found' field is not written, so that Scheduler of another
+// Eclipser instance does not consider this directory as an AFL instance.
+let private writeFuzzerStats now bitmapCvg =
+  let elapsed = max 1.0 (getElapsedSec ())
+  let favoreds, normals = queueSizes
+  let execEntries mode =
+    let execs = Stats.getExecCount mode
+    let name = Stats.ExecMode.toString mode
+    let execsPerSec = float execs / elapsed
+    [ (sprintf "execs_%s" name, string execs)
+      (sprintf "execs_per_sec_%s" name, sprintf "%.2f" execsPerSec) ]
+  let phaseEntry phase =
+    let name = Stats.Phase.toString phase
+    (sprintf "time_%s_sec" name, sprintf "%.1f" (Stats.getPhaseSeconds phase))
+  let totalExecs = Stats.getTotalExecCount ()
+  let entries =
+    [ ("start_time", string startTime)
+      ("last_update", string now)
+      ("fuzzer_pid", string (Process.GetCurrentProcess().Id))
+      ("execs_done", string totalExecs)
+      ("execs_per_sec", sprintf "%.2f" (float totalExecs / elapsed)) ]
+    @ List.collect execEntries Stats.allExecModes
+    @ [ ("paths_total", string (TestCase.getTestCaseCount ()))
+        ("unique_crashes", string (TestCase.getCrashCount ()))
+        ("pending_triage", string (TestCase.getPendingTriageCount ()))
+        ("queue_favored", string favoreds)
+        ("queue_normal", string normals)
+        ("bitmap_cvg", sprintf "%.2f%%" bitmapCvg) ]
+    @ List.map phaseEntry Stats.allPhases
+    @ [ ("solution_cache_hit_rate",
+         sprintf "%.2f%%" (Stats.getCacheHitRate ()))
+        ("skipped_offsets", string (Stats.getCursorSkipCount ())) ]
+    @ timeoutEntries ()
+    @ List.collect tracerEntries tracers
+  let lines = List.map (fun (k, v) -> sprintf "%-24s: %s" k v) entries
+  File.WriteAllLines(statsPath, lines)
+
+let private plotHeader =
+  let phaseCols = List.map (Stats.Phase.toString >> sprintf "%s_sec")
+                    Stats.allPhases
+  [ "# unix_time"; "execs_done"; "execs_per_sec"; "paths_total";
+    "unique_crashes"; "queue_favored"; "queue_normal"; "bitmap_cvg" ]
+  @ phaseCols
+  |> String.concat ", "
+
+// Append a line to 'plot_data'. Unlike 'fuzzer_stats', the execution speed is
+// measured for the interval since the previous update.
+let private appendPlotData now bitmapCvg =
+  let totalExecs = Stats.getTotalExecCount ()
+  let curTick = Stopwatch.GetTimestamp()
+  let interval = float (curTick - prevTick) / float Stopwatch.Frequency
+  let execsPerSec = float (totalExecs - prevExecs) / max interval 0.001
+  prevExecs <- totalExecs
+  prevTick <- curTick
+  let favoreds, normals = queueSizes
+  let phaseCols =
+    List.map (Stats.getPhaseSeconds >> sprintf "%.1f") Stats.allPhases
+  let cols =
+    [ string now; string totalExecs; sprintf "%.2f" execsPerSec
+      string (TestCase.getTestCaseCount ()); string (TestCase.getCrashCount ())
+      string favoreds; string normals; sprintf "%.2f%%" bitmapCvg ]
+    @ phaseCols
+  File.AppendAllText(plotPath, String.concat ", " cols + "\n")
+
+/// Write the current statistics to 'fuzzer_stats' and 'plot_data'.
+let update () =
+  lock updateLock (fun () ->
+    let now = DateTimeOffset.UtcNow.ToUnixTimeSeconds()
+    let bitmapCvg = getBitmapCoverage ()
+    writeFuzzerStats now bitmapCvg
+    appendPlotData now bitmapCvg)
+
+let private onTimer _ =
+  try update () with
+  | e -> log "[Warning] Failed to update fuzzer stats : %s" e.Message
+
+/// Start updating the statistics files every STATS_UPDATE_SEC. Should be called
+/// after the bitmap file is created (cf. Executor.initialize()).
+let initialize opt bitmapPath =
+  statsPath <- Path.Combine(opt.OutDir, "fuzzer_stats")
+  plotPath <- Path.Combine(opt.OutDir, "plot_data")
+  startTime <- DateTimeOffset.UtcNow.ToUnixTimeSeconds()
+  prevTick <- Stopwatch.GetTimestamp()
+  bitmap <- Some (Bitmap.openShared bitmapPath)
+  if not (File.Exists(plotPath)) then
+    File.WriteAllText(plotPath, plotHeader + "\n")
+  let period = STATS_UPDATE_SEC * 1000
+  timer <- new Timer(TimerCallback(onTimer), null, period, period)
@@ -0,0 +1,167 @@
+/// Corpus minimization ('cmin') and input trimming ('tmin'). Both commands run
+/// the coverage tracer with a private edge bitmap per worker, to find the edges
+/// covered by each input. 'cmin' selects a small subset of the inputs that
+/// covers all the edges of the corpus, and 'tmin' removes the chunks of each
+/// input that do not affect the covered edges.
+module Eclipser.Minimize
+
+open System.Collections.Generic
+open System.IO
+open System.Threading
+open Config
+open Utils
+open Options
+
+type private Entry = {
+  Name : string
+  Data : byte array
+  ExitSig : Signal
+  Edges : int array // Indices of the bits set in the edge bitmap, in order.
+}
+
+(*** Execution ***)
+
+// Run 'f' on each of 'items' with 'opt.Jobs' workers, where each worker owns
+// an execution instance (cf. Executor.initializeWorker).
+let private parallelMap opt (f: 'a -> 'b) (items: 'a array) =
+  let results = Array.zeroCreate items.Length
+  let next = ref -1
+  let rec work () =
+    let i = Interlocked.Increment(next)
+    if i < items.Length then
+      results.[i] <- f items.[i]
+      work ()
+  let runWorker id () =
+    Executor.initializeWorker opt id
+    work ()
+  let startWorker id =
+    let thread = Thread(runWorker id)
+    thread.Start()
+    thread
+  let threads = List.map startWorker [0 .. opt.Jobs - 1]
+  List.iter (fun (t: Thread) -> t.Join()) threads
+  results
+
+let private toEdges (bitmap: byte array) =
+  [| for i in 0 .. bitmap.Length - 1 do
+       if bitmap.[i] <> 0uy then
+         for bit in 0 .. 7 do
+           if (bitmap.[i] >>> bit) &&& 1uy = 1uy then yield i * 8 + bit |]
+
+let private execute opt data =
+  let seed = Seed.makeWith opt.FuzzSource data
+  let exitSig, bitmap = Executor.getEdgeBitmap opt seed
+  (exitSig, toEdges bitmap)
+
+let private loadEntry opt path =
+  let data = File.ReadAllBytes(path)
+  let exitSig, edges = execute opt data
+  { Name = Path.GetFileName(path); Data = data; ExitSig = exitSig
+    Edges = edges }
+
+let private loadEntries opt =
+  let paths = Directory.EnumerateFiles(opt.InputDir) |> Seq.sort |> Array.ofSeq
+  log "[*] Total %d inputs" paths.Length
+  parallelMap opt (loadEntry opt) paths
+
+(*** Trimming ***)
+
+let private nextPow2 n =
+  let rec loop p = if p >= n then p else loop (p * 2)
+  loop 1
+
+// Check if 'data' still covers the same edges as the entry, with the same
+// crash status.
+let private isEquivalent opt entry data =
+  let exitSig, edges = execute opt data
+  not (Signal.isTimeout exitSig) &&
+  Signal.isCrash exitSig = Signal.isCrash entry.ExitSig && edges = entry.Edges
+
+let rec private removeChunks opt entry chunkLen pos (data: byte array) =
+  if pos >= data.Length then data
+  else
+    let len = min chunkLen (data.Length - pos)
+    let trimmed = Array.append data.[.. pos - 1] data.[pos + len ..]
+    if trimmed.Length > 0 && isEquivalent opt entry trimmed then
+      removeChunks opt entry chunkLen pos trimmed
+    else removeChunks opt entry chunkLen (pos + len) data
+
+// Remove the chunks of the input that do not affect the covered edges, starting
+// from large chunks (cf. trim_case() of AFL).
+let private trim opt entry =
+  let lenPow2 = nextPow2 entry.Data.Length
+  let minChunkLen = max (lenPow2 / TRIM_END_STEPS) TRIM_MIN_BYTES
+  let rec loop chunkLen data =
+    if chunkLen < minChunkLen then data
+    else loop (chunkLen / 2) (removeChunks opt entry chunkLen 0 data)
+  let startChunkLen = max (lenPow2 / TRIM_START_STEPS) TRIM_MIN_BYTES
+  let data = loop startChunkLen entry.Data
+  if opt.Verbosity >= 2 then
+    log "Trimmed %s: %d -> %d bytes" entry.Name entry.Data.Length data.Length
+  { entry with Data = data }
+
+// Inputs that timed out are kept as they are, since their edges are not exact.
+let private trimEntries opt entries =
+  let trimIfValid entry =
+    if Signal.isTimeout entry.ExitSig then entry else trim opt entry
+  let trimmed = parallelMap opt trimIfValid entries
+  let sumLen = Array.sumBy (fun e -> int64 e.Data.Length)
+  log "[*] Trimmed %d bytes into %d bytes" (sumLen entries) (sumLen trimmed)
+  trimmed
+
+(*** Corpus minimization ***)
+
+// Select a covering subset in the manner of afl-cmin: find the smallest input
+// for each edge, and then select the input for each edge not covered yet.
+let private selectCover (entries: Entry array) =
+  let smallest = Dictionary<int, Entry>()
+  for entry in entries do
+    for edge in entry.Edges do
+      match smallest.TryGetValue(edge) with
+      | true, e when e.Data.Length <= entry.Data.Length -> ()
+      | _ -> smallest.[edge] <- entry
+  let covered = HashSet<int>()
+  [| for edge in Seq.sort smallest.Keys do
+       if not (covered.Contains(edge)) then
+         let entry = smallest.[edge]
+         covered.UnionWith(entry.Edges)
+         yield entry |]
+
+(*** Commands ***)
+
+let private initialize opt =
+  validateMinimizeOption opt
+  let opt = opt.ExecOpt
+  assertFileExists opt.TargetProg
+  log "[*] Target : %s" opt.TargetProg
+  createDirectoryIfNotExists opt.OutDir
+  Executor.usePrivateBitmaps ()
+  Executor.initialize opt
+  opt
+
+let private store opt entries =
+  for entry in entries do
+    writeFile (Path.Combine(opt.OutDir, entry.Name)) entry.Data
+  log "[*] Stored %d inputs in %s" (Array.length entries) opt.OutDir
+  Executor.cleanup ()
+
+/// Select a subset of the inputs that covers the same edges as the whole set.
+/// Crashing inputs and the inputs that timed out are excluded, as in afl-cmin.
+let runCmin minOpt =
+  let opt = initialize minOpt
+  let entries = loadEntries opt
+  let isNormal e = not (Signal.isCrash e.ExitSig || Signal.isTimeout e.ExitSig)
+  let normals = Array.filter isNormal entries
+  if normals.Length < entries.Length then
+    log "[Warning] Excluded %d crashing or hanging inputs"
+      (entries.Length - normals.Length)
+  let selected = selectCover normals
+  log "[*] Selected %d inputs out of %d" selected.Length normals.Length
+  let selected = if minOpt.Trim then trimEntries opt selected else selected
+  store opt selected
+
+/// Trim each of the inputs, while preserving the covered edges.
+let runTmin minOpt =
+  let opt = initialize minOpt
+  let entries = loadEntries opt
+  store opt (trimEntries opt entries)
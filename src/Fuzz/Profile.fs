@@ -0,0 +1,50 @@
+/// Profile the execution of the target program with an input, by running the
+/// BBCount tracer ('profile' command). Reports the hottest basic blocks and
+/// loops, which helps to find the loops that fill up the branch trace (cf.
+/// MAX_TRACE_LEN) or slow down the executions.
+module Eclipser.Profile
+
+open System.IO
+open Config
+open Utils
+open Options
+
+let private printBlocks profOpt (profile: Executor.BlockProfile) =
+  let total = max 1UL profile.ExecutedBlocks
+  let hotBlocks = Array.sortByDescending snd profile.Blocks
+                  |> Array.truncate profOpt.TopN
+  log "[*] Hottest blocks (out of %d blocks):" profile.Blocks.Length
+  for addr, count in hotBlocks do
+    let ratio = float count * 100.0 / float total
+    log "  0x%016x : %d (%.2f%%)" addr count ratio
+
+let private printLoops profOpt (profile: Executor.BlockProfile) =
+  let hotLoops = Array.sortByDescending (fun (_, _, count) -> count)
+                   profile.Loops
+                 |> Array.truncate profOpt.TopN
+  log "[*] Hottest loops (out of %d back edges):" profile.Loops.Length
+  for head, tail, count in hotLoops do
+    // Each iteration may log a comparison, so such loops can fill up the
+    // branch trace by themselves.
+    let mark = if count >= uint64 MAX_TRACE_LEN then " (>= MAX_TRACE_LEN)"
+               else ""
+    log "  0x%016x <- 0x%016x : %d iterations%s" head tail count mark
+
+let run profOpt =
+  let opt = profOpt.ExecOpt
+  assertFileExists opt.TargetProg
+  assertFileExists profOpt.InputFile
+  createDirectoryIfNotExists opt.OutDir
+  Executor.initialize opt
+  let input = File.ReadAllBytes(profOpt.InputFile)
+  let seed = Seed.makeWith opt.FuzzSource input
+  let exitSig, profile = Executor.getBlockProfile opt seed
+  log "[*] Exit signal : %A" exitSig
+  log "[*] Executed %d blocks" profile.ExecutedBlocks
+  if profile.DroppedBlocks > 0UL then
+    log "[Warning] %d blocks or back edges were not recorded"
+      profile.DroppedBlocks
+  printBlocks profOpt profile
+  printLoops profOpt profile
+  Executor.cleanup ()
+  Directory.Delete(opt.OutDir, true)
@@ -0,0 +1,51 @@
+/// Replay the rounds of grey-box concolic testing recorded with '--record'
+/// option ('replay' command). The executions are answered from the log instead
+/// of running the tracers, so the inference and the solving of each round can
+/// be benchmarked and profiled deterministically, without the noise of QEMU.
+module Eclipser.Replay
+
+open System.Diagnostics
+open Utils
+open Options
+
+let private printPhases () =
+  let phases = [ Stats.Spawn; Stats.Inference; Stats.Solve
+                 Stats.CoverageCheck ]
+  for phase in phases do
+    log "  %s : %.3f sec" (Stats.Phase.toString phase)
+      (Stats.getPhaseSeconds phase)
+
+// Replay a round, and return the number of the new seeds. A round that asks for
+// an execution not in the log is abandoned, which means that the solver is not
+// in sync with the log anymore (e.g. the log was recorded with another build).
+let private replayRound opt (seed: Seed) =
+  try List.length (GreyConcolic.run seed opt) |> Some
+  with Executor.ReplayMissException ->
+    if opt.Verbosity >= 1 then
+      log "[Warning] Execution not in the log, with: %s" (Seed.toString seed)
+    None
+
+let run replayOpt =
+  assertFileExists replayOpt.LogFile
+  let nSpawn, nSolve, searchArity = Executor.startReplay replayOpt.LogFile
+  let opt = { replayOpt.FuzzOpt with
+                NSpawn = nSpawn; NSolve = nSolve; SearchArity = searchArity }
+  log "[*] Replay %s (N_spawn = %d, N_solve = %d, search arity = %d)"
+    replayOpt.LogFile nSpawn nSolve searchArity
+  let stopWatch = Stopwatch.StartNew()
+  let rec loop rounds misses newSeeds =
+    match Executor.nextReplayRound () with
+    | None -> (rounds, misses, newSeeds)
+    | Some seed ->
+      if opt.Verbosity >= 2 then log "Replaying with: %s" (Seed.toString seed)
+      match replayRound opt seed with
+      | None -> loop (rounds + 1) (misses + 1) newSeeds
+      | Some n -> loop (rounds + 1) misses (newSeeds + n)
+  let rounds, misses, newSeeds = loop 0 0 0
+  let elapsed = stopWatch.Elapsed.TotalSeconds
+  log "[*] Replayed %d rounds in %.3f sec (%d rounds abandoned)" rounds elapsed
+    misses
+  log "[*] Answered %d executions, generated %d seeds"
+    (Executor.getReplayedExecs ()) newSeeds
+  log "[*] Time spent in each phase:"
+  printPhases ()
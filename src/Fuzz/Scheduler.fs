@@ -1,32 +1,109 @@
 module Eclipser.Scheduler
 
+open System
+open System.IO
+open System.Collections.Generic
 open Config
 open Utils
 open Options
 
 let private timer = new System.Diagnostics.Stopwatch()
 
-// Tentative efficiency of random fuzzing. TODO: Communicate with AFL for this.
-let private RAND_FUZZ_EFFICIENCY = 0.0005
+(*** Efficiency of AFL instances ***)
 
-// Decides sleep factor 'f', which will be used to sleep for 'f * elapsed time'.
-// This means we will utilize 1 / (2 * (f + 1)) of the system resource.
+/// Statistics of an AFL instance, obtained from its 'fuzzer_stats' file.
+type private AFLStats = {
+  LastUpdate : int64
+  ExecsDone : int64
+  PathsFound : int64
+}
+
+// Map from the output directory of each AFL instance to its statistics that we
+// observed at the end of the previous round.
+let private prevAFLStats = new Dictionary<string,AFLStats> ()
+
+let private parseStatLine (dict: Dictionary<string,string>) (line: string) =
+  match line.Split([| ':' |], 2) with
+  | [| key; value |] -> dict.[key.Trim()] <- value.Trim()
+  | _ -> ()
+
+let private tryReadAFLStats dir =
+  let statPath = Path.Combine(dir, "fuzzer_stats")
+  let dict = new Dictionary<string,string> ()
+  try
+    Array.iter (parseStatLine dict) (File.ReadAllLines(statPath))
+    Some { LastUpdate = int64 dict.["last_update"]
+           ExecsDone = int64 dict.["execs_done"]
+           PathsFound = int64 dict.["paths_found"] }
+  with _ -> None
+
+let private isAlive now stats = now - stats.LastUpdate <= AFL_STATS_STALE_SEC
+
+// Collect the number of executions and found paths of running AFL instances,
+// since the previous round. Returns None if there is no AFL instance running.
+let private collectAFLProgress opt =
+  let outDir = Path.GetFullPath(opt.OutDir)
+  let now = DateTimeOffset.UtcNow.ToUnixTimeSeconds()
+  let aliveStats =
+    Directory.EnumerateDirectories(opt.SyncDir)
+    |> Seq.map Path.GetFullPath
+    |> Seq.filter (fun d -> d <> outDir) // Exclude our own output.
+    |> Seq.choose (fun d -> Option.map (fun s -> (d, s)) (tryReadAFLStats d))
+    |> Seq.filter (snd >> isAlive now)
+    |> List.ofSeq
+  let folder (accExecs, accPaths) (dir, stats) =
+    let accExecs, accPaths =
+      if not (prevAFLStats.ContainsKey(dir)) then (accExecs, accPaths)
+      else let prevStats = prevAFLStats.[dir]
+           (accExecs + stats.ExecsDone - prevStats.ExecsDone,
+            accPaths + stats.PathsFound - prevStats.PathsFound)
+    prevAFLStats.[dir] <- stats
+    (accExecs, accPaths)
+  let execs, paths = List.fold folder (0L, 0L) aliveStats
+  if List.isEmpty aliveStats then None else Some (execs, paths)
+
+// Decide the efficiency of AFL instances, or return None if there is no AFL
+// instance running. If AFL instances did not make progress since the previous
+// round yet, use a tentative efficiency value.
+let private decideRandFuzzEfficiency opt =
+  try
+    match collectAFLProgress opt with
+    | None -> None
+    | Some (execs, _) when execs <= 0L -> Some DEFAULT_RAND_FUZZ_EFFICIENCY
+    | Some (execs, paths) -> Some (float paths / float execs)
+  with _ -> Some DEFAULT_RAND_FUZZ_EFFICIENCY
+
+(*** Resource scheduling ***)
+
+// Decides sleep factor 'f', which will be used to sleep for 'f * elapsed time'
+// after each execution. This means we will utilize 1 / (f + 1) of the time.
 let private decideSleepFactor opt roundExecs roundTCs =
   let greyConcEfficiency = float (roundTCs) / float (roundExecs)
   if opt.Verbosity >= 1 then log "[*] Efficiency = %.4f" greyConcEfficiency
-  // GREY_CONC_EFF : RAND_FUZZ_EFF = 1 : 2 * factor + 1
-  let factor = if greyConcEfficiency = 0.0 then SLEEP_FACTOR_MAX
-               else (RAND_FUZZ_EFFICIENCY / greyConcEfficiency - 1.0) / 2.0
-  // Bound the factor between minimum and maximum value allowed.
-  max SLEEP_FACTOR_MIN (min SLEEP_FACTOR_MAX factor)
+  match decideRandFuzzEfficiency opt with
+  | None -> // No AFL instance is running, so do not yield resource at all.
+    if opt.Verbosity >= 1 then log "[*] No running AFL instance found"
+    SLEEP_FACTOR_MIN
+  | Some randFuzzEfficiency ->
+    if opt.Verbosity >= 1 then
+      log "[*] AFL Efficiency = %.4f" randFuzzEfficiency
+    // Each execution is followed by a sleep of 'factor' times its duration, so
+    // the time used by Eclipser and the time left to AFL (the whole time on a
+    // shared core) are in the ratio of 1 : factor + 1. Make it match the ratio
+    // of the efficiencies, GREY_CONC_EFF : RAND_FUZZ_EFF = 1 : factor + 1.
+    let factor = if greyConcEfficiency = 0.0 then SLEEP_FACTOR_MAX
+                 else randFuzzEfficiency / greyConcEfficiency - 1.0
+    // Bound the factor between minimum and maximum value allowed.
+    max SLEEP_FACTOR_MIN (min SLEEP_FACTOR_MAX factor)
 
 let initialize () =
   Executor.enableRoundStatistics()
   TestCase.enableRoundStatistics()
   timer.Start()
 
-// Check the efficiency of the system and sleep for a while to adjust the weight
-// of resource use with AFL.
+// Check the efficiency of the system at the end of each round, and update the
+// sleep factor that throttles each execution, to adjust the weight of resource
+// use with AFL.
 let checkAndReserveTime opt =
   let roundExecs = Executor.getRoundExecs ()
   if roundExecs > ROUND_SIZE then
@@ -34,11 +111,9 @@ let checkAndReserveTime opt =
     Executor.resetRoundExecs()
     TestCase.resetRoundTestCaseCount()
     let sleepFactor = decideSleepFactor opt roundExecs roundTCs
-    let roundElapsed = timer.ElapsedMilliseconds
-    let sleepTime = int (float (roundElapsed) * sleepFactor)
+    Executor.setSleepFactor sleepFactor
     if opt.Verbosity >= 1 then
-      log "[*] Elapsed round time: %d sec." (roundElapsed / 1000L)
-      log "[*] Decided sleep time: %d sec."  (sleepTime / 1000)
-    System.Threading.Thread.Sleep(sleepTime)
+      log "[*] Elapsed round time: %d sec." (timer.ElapsedMilliseconds / 1000L)
+      log "[*] Decided sleep factor: %.2f" sleepFactor
     timer.Reset()
     timer.Start()
@@ -0,0 +1,71 @@
+/// Estimate the cost of fuzzing a seed, so that the seed queue can schedule the
+/// seeds that are likely to find more new edges per CPU time first (cf.
+/// SeedQueue.fs). The estimation is based on the history of the seed's lineage
+/// (cf. Seed.Lineage): the time spent per execution, the length of the fuzzed
+/// inputs and the number of new edges found per execution.
+module Eclipser.SeedCost
+
+open System
+open System.Collections.Concurrent
+open System.Diagnostics
+open System.Threading
+open Config
+
+type private LineageStat = {
+  mutable Execs : int64
+  mutable Ticks : int64
+  mutable NewEdges : int64
+  mutable Fuzzed : int64 // Number of seeds fuzzed.
+  mutable TotalLen : int64 // Sum of the input lengths of the fuzzed seeds.
+}
+
+let private lineageStats = ConcurrentDictionary<int, LineageStat>()
+let private totalExecs = ref 0L
+let private totalTicks = ref 0L
+
+let private newLineageStat _ =
+  { Execs = 0L; Ticks = 0L; NewEdges = 0L; Fuzzed = 0L; TotalLen = 0L }
+
+let private toMillisecs ticks = float ticks * 1000.0 / float Stopwatch.Frequency
+
+/// Record the result of fuzzing 'seed', which took 'ticks' for 'execs'
+/// executions and found 'newEdges' seeds with new edges.
+let record (seed: Seed) execs ticks newEdges =
+  let stat = lineageStats.GetOrAdd(seed.Lineage, newLineageStat)
+  lock stat (fun () ->
+    stat.Execs <- stat.Execs + execs
+    stat.Ticks <- stat.Ticks + ticks
+    stat.NewEdges <- stat.NewEdges + int64 newEdges
+    stat.Fuzzed <- stat.Fuzzed + 1L
+    stat.TotalLen <- stat.TotalLen + int64 (Seed.getCurLength seed))
+  Interlocked.Add(totalExecs, execs) |> ignore
+  Interlocked.Add(totalTicks, ticks) |> ignore
+
+// Average time of an execution over all the lineages, for the lineages that
+// are not fuzzed yet.
+let private getGlobalExecMs () =
+  let execs = !totalExecs
+  if execs = 0L then 1.0 else toMillisecs !totalTicks / float execs
+
+/// Return the expected time (ms) to find a new edge by fuzzing 'seed'.
+let estimate (seed: Seed) =
+  let len = Seed.getCurLength seed
+  let execMs, yieldRate =
+    match lineageStats.TryGetValue(seed.Lineage) with
+    | true, stat when stat.Execs > 0L ->
+      lock stat (fun () ->
+        // Execution time tends to grow with the input length, so scale the
+        // average time of the lineage with the length of this seed.
+        let avgLen = float stat.TotalLen / float stat.Fuzzed
+        let lenRatio = float len / max 1.0 avgLen
+        let execMs = toMillisecs stat.Ticks / float stat.Execs
+        // Smooth the yield, so that a lineage is not judged by a few runs.
+        let yieldRate = (float stat.NewEdges + 1.0) /
+                        (float stat.Execs + SEED_YIELD_PRIOR_EXECS)
+        (execMs * Math.Sqrt(lenRatio), yieldRate))
+    | _ -> (getGlobalExecMs (), 1.0 / SEED_YIELD_PRIOR_EXECS)
+  // Seeds with mostly fixed bytes have less room left to find new edges.
+  let unfixedCnt = Array.sumBy (fun b -> if ByteVal.isUnfixed b then 1 else 0)
+                     seed.ByteVals
+  let roomFactor = 0.5 + 0.5 * float unfixedCnt / float (max 1 len)
+  execMs / (yieldRate * roomFactor)
@@ -1,67 +1,92 @@
 namespace Eclipser
 
-/// A simple, purely functional queue.
-type Queue<'a > = {
-  Enqueued : 'a list
-  ToDequeue : 'a list
+/// A simple, purely functional priority queue. Elements with smaller keys are
+/// dequeued first, and elements with the same key are dequeued in FIFO order.
+type PriorityQueue<'a> = {
+  Elems : Map<float * int64, 'a>
+  NextSeq : int64
 }
 
-module Queue =
+module PriorityQueue =
 
   exception EmptyException
 
-  let empty = { Enqueued = []; ToDequeue = [] }
+  let empty = { Elems = Map.empty; NextSeq = 0L }
 
-  let isEmpty q = List.isEmpty q.Enqueued && List.isEmpty q.ToDequeue
+  let isEmpty q = Map.isEmpty q.Elems
 
-  /// Enqueue an element to a queue.
-  let enqueue q elem = { q with Enqueued = elem :: q.Enqueued }
+  let length q = q.Elems.Count
 
-  /// Dequeue an element from a queue. Raises Queue.EmptyException if the
-  /// queue is empty.
+  /// Return the elements in the order of dequeue.
+  let toList q = List.map snd (Map.toList q.Elems)
+
+  /// Enqueue an element to a queue with the given key.
+  let enqueue q key elem =
+    { Elems = Map.add (key, q.NextSeq) elem q.Elems; NextSeq = q.NextSeq + 1L }
+
+  /// Dequeue the element with the smallest key, along with the key. Raises
+  /// PriorityQueue.EmptyException if the queue is empty.
   let dequeue q =
-    match q.Enqueued, q.ToDequeue with
-    | [], [] -> raise EmptyException
-    | enq, [] ->
-      let enqRev = List.rev enq
-      let elem, toDequeue = List.head enqRev, List.tail enqRev
-      (elem, { Enqueued = []; ToDequeue = toDequeue })
-    | enq, deqHd :: deqTail ->
-      (deqHd, { Enqueued = enq; ToDequeue = deqTail })
-
-  let toString stringfy q =
-    let elems = q.ToDequeue @ (List.rev q.Enqueued)
-    let elemStrs = List.map stringfy elems
-    String.concat "\n" elemStrs
-
-/// Queue of seeds with 'favored' priority and 'normal' priority.
+    if isEmpty q then raise EmptyException
+    let entry = Seq.head q.Elems
+    let key, _ = entry.Key
+    (key, entry.Value, { q with Elems = Map.remove entry.Key q.Elems })
+
+/// Queue of seeds with 'favored' priority and 'normal' priority. Favored seeds
+/// are always dequeued first. Within each priority, seeds are ordered by their
+/// estimated cost to find a new edge (cf. SeedCost.fs), in the manner of fair
+/// queueing: a seed is keyed by the virtual clock of its priority plus its
+/// cost, and the clock advances to the key of the dequeued seed. Thus, cheap
+/// seeds go first, while costly seeds are still fuzzed eventually.
 type SeedQueue = {
-  Favoreds : Queue<Seed>
-  Normals : Queue<Seed>
+  Favoreds : PriorityQueue<Seed>
+  Normals : PriorityQueue<Seed>
+  FavoredClock : float
+  NormalClock : float
 }
 
 module SeedQueue =
 
   let empty =
-    { Favoreds = Queue.empty
-      Normals = Queue.empty }
+    { Favoreds = PriorityQueue.empty
+      Normals = PriorityQueue.empty
+      FavoredClock = 0.0
+      NormalClock = 0.0 }
 
   let isEmpty queue =
-    Queue.isEmpty queue.Favoreds && Queue.isEmpty queue.Normals
+    PriorityQueue.isEmpty queue.Favoreds && PriorityQueue.isEmpty queue.Normals
+
+  /// Return the number of favored seeds and normal seeds.
+  let getSizes queue =
+    (PriorityQueue.length queue.Favoreds, PriorityQueue.length queue.Normals)
 
   let enqueue queue (priority, seed) =
+    let cost = SeedCost.estimate seed
     match priority with
-    | Favored -> { queue with Favoreds = Queue.enqueue queue.Favoreds seed }
-    | Normal -> { queue with Normals = Queue.enqueue queue.Normals seed }
+    | Favored ->
+      let key = queue.FavoredClock + cost
+      { queue with Favoreds = PriorityQueue.enqueue queue.Favoreds key seed }
+    | Normal ->
+      let key = queue.NormalClock + cost
+      { queue with Normals = PriorityQueue.enqueue queue.Normals key seed }
+
+  /// Return the seeds in the queue along with their priorities, without
+  /// dequeueing them.
+  let toList queue =
+    let favoreds = PriorityQueue.toList queue.Favoreds
+    let normals = PriorityQueue.toList queue.Normals
+    List.map (fun s -> (Favored, s)) favoreds @
+    List.map (fun s -> (Normal, s)) normals
 
   let dequeue queue =
-    let priority = if Queue.isEmpty queue.Favoreds then Normal else Favored
+    let priority =
+      if PriorityQueue.isEmpty queue.Favoreds then Normal else Favored
     match priority with
     | Favored ->
-      let seed, newFavoreds = Queue.dequeue queue.Favoreds
-      let newQueue = { queue with Favoreds = newFavoreds }
+      let key, seed, newFavoreds = PriorityQueue.dequeue queue.Favoreds
+      let newQueue = { queue with Favoreds = newFavoreds; FavoredClock = key }
       (Favored, seed, newQueue)
     | Normal ->
-      let seed, newNormals = Queue.dequeue queue.Normals
-      let newQueue = { queue with Normals = newNormals }
+      let key, seed, newNormals = PriorityQueue.dequeue queue.Normals
+      let newQueue = { queue with Normals = newNormals; NormalClock = key }
       (Normal, seed, newQueue)
@@ -8,6 +8,14 @@ open Options
 (*** Map of the maximum ID of the already imported test cases. ***)
 let private maxImports = new Dictionary<string,int> ()
 
+/// Return the maximum ID of the imported test cases for each directory.
+let getMaxImports () =
+  List.ofSeq (Seq.map (fun (KeyValue(dir, n)) -> (dir, n)) maxImports)
+
+/// Restore the maximum IDs obtained from getMaxImports() before a restart.
+let restoreMaxImports entries =
+  for dir, maxImport in entries do maxImports.[dir] <- maxImport
+
 let private tryParseTCNum (tcPath: string) =
   let tcName = Path.GetFileName(tcPath)
   if not(tcName.StartsWith("id:")) then None
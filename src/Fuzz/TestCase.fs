@@ -1,6 +1,10 @@
 module Eclipser.TestCase
 
+open System.Collections.Generic
+open System.Collections.Concurrent
+open System.Threading
 open Utils
+open BytesUtils
 open Options
 
 (*** Directory paths ***)
@@ -8,7 +12,7 @@ open Options
 let mutable testcaseDir = ""
 let mutable crashDir = ""
 
-let initialize outDir =
+let private initializeDirs outDir =
   testcaseDir <- System.IO.Path.Combine(outDir, "queue")
   System.IO.Directory.CreateDirectory(testcaseDir) |> ignore
   crashDir <- System.IO.Path.Combine(outDir, "crashes")
@@ -25,6 +29,10 @@ let mutable private totalTestCases = 0
 let mutable private roundStatisticsOn = false
 let mutable private roundTestCases = 0
 
+// Test cases are dumped by the fuzzing workers and the crash triage thread, so
+// synchronize.
+let private dumpLock = obj ()
+
 let printStatistics () =
   log "Testcases : %d" totalTestCases
   log "Crashes : %d" totalCrashes
@@ -42,6 +50,28 @@ let private incrCrashCount exitSig =
   | _ -> failwith "updateCrashCount() called with a non-crashing exit signal"
   totalCrashes <- totalCrashes + 1
 
+let getTestCaseCount () = totalTestCases
+
+let getCrashCount () = totalCrashes
+
+/// Return the counters of the stored test cases and crashes, to save them in
+/// a checkpoint.
+let getCounters () =
+  [| totalTestCases; totalCrashes; totalSegfaults; totalIllegals; totalFPEs
+     totalAborts |]
+
+/// Restore the counters obtained from getCounters() before a restart. The
+/// counters do not go below the number of files stored, so that the test cases
+/// stored after the checkpoint are not overwritten.
+let restoreCounters (counters: int array) =
+  let countFiles dir = Seq.length (System.IO.Directory.EnumerateFiles(dir))
+  totalTestCases <- max counters.[0] (countFiles testcaseDir)
+  totalCrashes <- max counters.[1] (countFiles crashDir)
+  totalSegfaults <- counters.[2]
+  totalIllegals <- counters.[3]
+  totalFPEs <- counters.[4]
+  totalAborts <- counters.[5]
+
 let enableRoundStatistics () = roundStatisticsOn <- true
 
 let disableRoundStatistics () = roundStatisticsOn <- false
@@ -52,32 +82,76 @@ let incrTestCaseCount () =
   totalTestCases <- totalTestCases + 1
   if roundStatisticsOn then roundTestCases <- roundTestCases + 1
 
-let resetRoundTestCaseCount () = roundTestCases <- 0
+let resetRoundTestCaseCount () = lock dumpLock (fun () -> roundTestCases <- 0)
 
 (*** Test case storing functions ***)
 
 let private dumpCrash opt seed exitSig =
-  if opt.Verbosity >= 1 then log "[*] Save crash seed : %s" (Seed.toString seed)
-  let crashName = sprintf "id:%06d" totalCrashes
-  let crashPath = System.IO.Path.Combine(crashDir, crashName)
-  System.IO.File.WriteAllBytes(crashPath, Seed.concretize seed)
-  incrCrashCount exitSig
+  lock dumpLock (fun () ->
+    if opt.Verbosity >= 1 then
+      log "[*] Save crash seed : %s" (Seed.toString seed)
+    let crashName = sprintf "id:%06d" totalCrashes
+    let crashPath = System.IO.Path.Combine(crashDir, crashName)
+    System.IO.File.WriteAllBytes(crashPath, Seed.concretize seed)
+    incrCrashCount exitSig)
 
 let private dumpTestCase seed =
-  let tcName = sprintf "id:%06d" totalTestCases
-  let tcPath = System.IO.Path.Combine(testcaseDir, tcName)
-  System.IO.File.WriteAllBytes(tcPath, Seed.concretize seed)
-  incrTestCaseCount ()
-
-let private checkCrash opt seed exitSig covGain =
-  if Signal.isCrash exitSig && covGain = NewEdge then (true, exitSig)
-  elif Signal.isTimeout exitSig then // Check again with native execution
-    let exitSig' = Executor.nativeExecute opt seed
-    if Signal.isCrash exitSig' && covGain = NewEdge then (true, exitSig')
-    else (false, exitSig')
-  else (false, exitSig)
+  lock dumpLock (fun () ->
+    let tcName = sprintf "id:%06d" totalTestCases
+    let tcPath = System.IO.Path.Combine(testcaseDir, tcName)
+    let tcBytes = Seed.concretize seed
+    System.IO.File.WriteAllBytes(tcPath, tcBytes)
+    Coordinator.recordSeed tcBytes
+    incrTestCaseCount ())
+
+(*** Crash triage ***)
+
+// Timed out seeds that may be crashes, which will be confirmed with native
+// execution in a separate thread.
+let private triageQueue = new BlockingCollection<FuzzOption * Seed>()
+
+// Pairs of input hash and exit signal, which are already classified.
+let private classified = new HashSet<Hash * Signal>()
+
+// Return true if the input is not classified with the exit signal before.
+let private markClassified seed exitSig =
+  let hash = hashBytes (Seed.concretize seed)
+  lock classified (fun () -> classified.Add((hash, exitSig)))
+
+let private triage (opt, seed) =
+  let exitSig = Executor.nativeExecuteTriage opt seed
+  if Signal.isCrash exitSig && markClassified seed exitSig then
+    dumpCrash opt seed exitSig
+
+let private runTriage () =
+  for suspect in triageQueue.GetConsumingEnumerable() do
+    try triage suspect with
+    | e -> log "[Warning] Crash triage failed : %s" e.Message
+
+let private startTriageThread () =
+  let thread = new Thread(ThreadStart(runTriage))
+  thread.IsBackground <- true
+  thread.Start()
+
+let getPendingTriageCount () = triageQueue.Count
+
+// Timed out seeds are re-executed natively, to check if they crash when they
+// are not run on QEMU. If possible, this is deferred to the triage thread.
+let private handleTimeout opt seed =
+  if markClassified seed Signal.SIGALRM then
+    if Executor.canExecuteTriage opt seed then triageQueue.Add((opt, seed))
+    else
+      let exitSig = Executor.nativeExecute opt seed
+      if Signal.isCrash exitSig && markClassified seed exitSig then
+        dumpCrash opt seed exitSig
 
 let save opt seed exitSig covGain =
-  let isNewCrash, exitSig' = checkCrash opt seed exitSig covGain
-  if isNewCrash then dumpCrash opt seed exitSig'
-  if covGain = NewEdge then dumpTestCase seed
+  if covGain = NewEdge then
+    if Signal.isCrash exitSig then
+      if markClassified seed exitSig then dumpCrash opt seed exitSig
+    elif Signal.isTimeout exitSig then handleTimeout opt seed
+    dumpTestCase seed
+
+let initialize outDir =
+  initializeDirs outDir
+  startTriageThread ()
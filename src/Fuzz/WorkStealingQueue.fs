@@ -0,0 +1,80 @@
+namespace Eclipser
+
+/// Seed queues of the fuzzing workers in parallel mode. Each worker adds new
+/// seeds to its own queue, and steals a seed from the queues of the other
+/// workers when its own queue is empty. The seed being fuzzed by each worker is
+/// kept as well, so that a checkpoint does not miss it.
+type WorkStealingQueue = {
+  Queues : SeedQueue array
+  Locks : obj array
+  InFlights : (Priority * Seed) option array
+}
+
+module WorkStealingQueue =
+
+  /// Create queues for 'n' workers. Initial seeds are given to worker 0, and
+  /// the other workers will steal them.
+  let create n initQueue =
+    let queues = Array.create n SeedQueue.empty
+    queues.[0] <- initQueue
+    { Queues = queues; Locks = Array.init n (fun _ -> obj ())
+      InFlights = Array.create n None }
+
+  /// Enqueue items to the queue of worker 'id'.
+  let enqueue wsQueue id items =
+    lock wsQueue.Locks.[id] (fun () ->
+      let queue = List.fold SeedQueue.enqueue wsQueue.Queues.[id] items
+      wsQueue.Queues.[id] <- queue)
+
+  /// Move every item in 'seedQueue' to the queue of worker 'id'.
+  let merge wsQueue id seedQueue =
+    let rec collect acc queue =
+      if SeedQueue.isEmpty queue then List.rev acc
+      else let priority, seed, queue = SeedQueue.dequeue queue
+           collect ((priority, seed) :: acc) queue
+    enqueue wsQueue id (collect [] seedQueue)
+
+  /// Return the seeds in all the queues and the seeds being fuzzed, without
+  /// dequeueing them. Every queue is locked at once (in the order of the IDs),
+  /// so that a seed moving between a queue and a worker is returned once.
+  let toList wsQueue =
+    let rec collect i =
+      if i = wsQueue.Queues.Length then
+        let inFlights = List.choose id (List.ofArray wsQueue.InFlights)
+        inFlights @ List.collect SeedQueue.toList (List.ofArray wsQueue.Queues)
+      else lock wsQueue.Locks.[i] (fun () -> collect (i + 1))
+    collect 0
+
+  /// Return the number of favored seeds and normal seeds in all the queues.
+  let getSizes wsQueue =
+    let getSize id = lock wsQueue.Locks.[id] (fun () ->
+      SeedQueue.getSizes wsQueue.Queues.[id])
+    let sizes = List.map getSize [0 .. wsQueue.Queues.Length - 1]
+    (List.sumBy fst sizes, List.sumBy snd sizes)
+
+  // Dequeue an item from the queue of 'victim', and record it as the seed being
+  // fuzzed by worker 'id' under the same lock.
+  let private tryDequeueFrom wsQueue id victim =
+    lock wsQueue.Locks.[victim] (fun () ->
+      let queue = wsQueue.Queues.[victim]
+      if SeedQueue.isEmpty queue then None
+      else let priority, seed, queue = SeedQueue.dequeue queue
+           wsQueue.Queues.[victim] <- queue
+           wsQueue.InFlights.[id] <- Some (priority, seed)
+           Some (priority, seed))
+
+  /// Dequeue an item for worker 'id'. If its own queue is empty, try to steal
+  /// from the other workers' queues, starting from the next worker. The item
+  /// is kept as the seed being fuzzed by the worker until 'complete' is called.
+  let tryDequeue wsQueue id =
+    let n = wsQueue.Queues.Length
+    let tryVictim i = tryDequeueFrom wsQueue id ((id + i) % n)
+    List.tryPick tryVictim [0 .. n - 1]
+
+  /// Enqueue the items generated from the seed being fuzzed by worker 'id', and
+  /// clear the seed at once.
+  let complete wsQueue id items =
+    lock wsQueue.Locks.[id] (fun () ->
+      let queue = List.fold SeedQueue.enqueue wsQueue.Queues.[id] items
+      wsQueue.Queues.[id] <- queue
+      wsQueue.InFlights.[id] <- None)
@@ -1,5 +1,6 @@
 namespace Eclipser
 
+open System.Collections.Generic
 open Utils
 open Options
 
@@ -7,22 +8,60 @@ type BranchTrace = BranchInfo list
 
 module BranchTrace =
 
-  let collectAux opt seed acc tryVal =
-    let accTraces, accCandidates = acc
+  let collectAux seed getTrace acc tryVal =
+    let accTraces, accStrTraces, accCandidates = acc
     let tryByteVal = Sampled (byte tryVal)
     let trySeed = Seed.updateCurByte seed tryByteVal
-    let exitSig, covGain, trace = Executor.getBranchTrace opt trySeed tryVal
+    let exitSig, covGain, trace, strCmps = getTrace trySeed tryVal
     let accTraces = trace :: accTraces
+    let accStrTraces = strCmps :: accStrTraces
     let accCandidates = if covGain = NewEdge || Signal.isCrash exitSig
                         then seed :: accCandidates
                         else accCandidates
-    (accTraces, accCandidates)
+    (accTraces, accStrTraces, accCandidates)
 
+  // Since the traces differ only in the comparisons that depend on the cursor
+  // byte, collect the first trace in full, and the others as the difference
+  // from the first one (cf. Executor.getBranchTraceDiff()). The calls to the
+  // string comparison functions in each execution are collected as well. Many
+  // of the executions take the same path, whose traces are identical except
+  // for 'tryVal', so such traces are parsed only once.
   let collect seed opt minVal maxVal =
     let nSpawn = opt.NSpawn
-    let tryVals = sampleInt minVal maxVal nSpawn
-    let traces, candidates = List.fold(collectAux opt seed) ([], []) tryVals
-    List.rev traces, List.rev candidates // To preserver order.
+    match sampleInt minVal maxVal nSpawn with
+    | [] -> ([], [], [])
+    | refVal :: tryVals ->
+      let getRefTrace = Executor.getReferenceTrace opt
+      let acc = collectAux seed getRefTrace ([], [], []) refVal
+      let traces, strTraces, _ = acc
+      let refTrace = Array.ofList (List.head traces)
+      let knownTraces = Dictionary<uint64, BranchTrace * StringCompare list>()
+      let refHash = Executor.getPathHash ()
+      if refHash <> 0UL then
+        knownTraces.[refHash] <- (List.head traces, List.head strTraces)
+      let getDiffTrace s v =
+        Executor.getBranchTraceDiff opt s v refTrace knownTraces
+      let collector = collectAux seed getDiffTrace
+      let traces, strTraces, candidates = List.fold collector acc tryVals
+      // To preserve order.
+      List.rev traces, List.rev strTraces, List.rev candidates
+
+  /// Check if the traces collected with different values of the cursor byte
+  /// differ in any comparison or in the buffers of any string comparison, i.e.
+  /// if the byte is relevant to comparisons. A single trace is not enough to
+  /// tell, so consider it relevant.
+  let isByteRelevant (traces: BranchTrace list) strTraces =
+    let strip (brInfo: BranchInfo) =
+      (brInfo.InstAddr, brInfo.Oprnd1, brInfo.Oprnd2)
+    let stripStr (strCmp: StringCompare) =
+      (strCmp.CallSite, strCmp.Buf1, strCmp.Buf2)
+    let differ = function
+      | [] -> false
+      | headTrace :: tailTraces -> List.exists ((<>) headTrace) tailTraces
+    match traces with
+    | [] | [ _ ] -> true
+    | _ -> differ (List.map (List.map strip) traces) ||
+           differ (List.map (List.map stripStr) strTraces)
 
   let getHeadAddr (brTrace: BranchTrace) =
     match brTrace with
@@ -14,13 +14,25 @@ let run seed opt =
     let seedStr = Seed.toString seed
     failwithf "Cursor pointing to Fixed ByteVal %s" seedStr
   let minVal, maxVal = bigint (int minByte), bigint (int maxByte)
-  let branchTraces, candidates = BranchTrace.collect seed opt minVal maxVal
+  Seed.consumeCursorSkips seed
+  let branchTraces, strTraces, candidates =
+    Stats.measure Stats.Spawn (fun () ->
+      BranchTrace.collect seed opt minVal maxVal)
+  let isRelevant = BranchTrace.isByteRelevant branchTraces strTraces
+  ByteRelevance.update seed.Lineage seed.CursorPos isRelevant
   let byteDir = Seed.getByteCursorDir seed
   let bytes = Seed.queryNeighborBytes seed byteDir
   let ctx = { Bytes = bytes; ByteDir = byteDir }
-  let branchTree = BranchTree.make opt ctx branchTraces
-  let branchTree = BranchTree.selectAndRepair opt branchTree
+  let branchTree =
+    Stats.measure Stats.Inference (fun () ->
+      let branchTree = BranchTree.make opt ctx branchTraces
+      BranchTree.selectAndRepair opt branchTree)
   GreySolver.clearSolutionCache ()
-  let solutions = GreySolver.solve seed opt byteDir branchTree
-  let byProducts = reconsiderCandidates opt candidates
+  let solutions =
+    Stats.measure Stats.Solve (fun () ->
+      let strSolutions = GreySolver.solveStrings seed opt strTraces
+      strSolutions @ GreySolver.solve seed opt byteDir branchTree)
+  let byProducts =
+    Stats.measure Stats.CoverageCheck (fun () ->
+      reconsiderCandidates opt candidates)
   solutions @ byProducts
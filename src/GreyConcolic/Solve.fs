@@ -2,6 +2,7 @@ namespace Eclipser
 
 open System.Collections.Generic
 open System
+open Config
 open Utils
 open Options
 open BytesUtils
@@ -55,20 +56,24 @@ module GreySolver =
     let maxLen = Seed.queryUpdateBound seed Right
     List.fold (tryStrSol seed opt maxLen targPt) accRes initStrs
 
-  let solutionCache = new HashSet<bigint>()
+  // Each fuzzing worker thread keeps its own cache (cf. parallel mode).
+  let solutionCache =
+    new Threading.ThreadLocal<HashSet<bigint>>(fun () -> new HashSet<bigint>())
 
   let clearSolutionCache () =
-    solutionCache.Clear()
+    solutionCache.Value.Clear()
 
   let tryChunkSol seed opt dir targPt endian size accRes sol =
-    if solutionCache.Contains(sol) then accRes
+    let isCached = solutionCache.Value.Contains(sol)
+    Stats.recordCacheLookup isCached
+    if isCached then accRes
     else
       let tryBytes = bigIntToBytes endian size sol
       let trySeed = Seed.fixCurBytes seed dir tryBytes
       // Use dummy value as 'tryVal', since our interest is branch distance.
       match Executor.getBranchInfo opt trySeed 0I targPt with
       | exitSig, covGain, Some brInfo when brInfo.Distance = 0I ->
-        ignore (solutionCache.Add(sol))
+        ignore (solutionCache.Value.Add(sol))
         (trySeed, exitSig, covGain) :: accRes
       | _, _, Some _ -> accRes // Non-zero branch distance, failed.
       | _, _, None -> accRes // Target point disappeared, failed.
@@ -114,13 +119,84 @@ module GreySolver =
       else accRes
     | _, _, None -> accRes // Target point disappeared, halt.
 
+  (* k-ary search, which probes k-1 split points of the interval at each round
+   * with a batch of parallel executions (cf. Executor.runBatch). Searches in
+   * both endians proceed in the same rounds.
+   *)
+
+  let splitPoints arity mono =
+    let width = mono.UpperX - mono.LowerX
+    [ for i in 1 .. arity - 1 -> mono.LowerX + width * bigint i / bigint arity ]
+    |> List.filter (fun x -> x > mono.LowerX && x < mono.UpperX)
+    |> List.distinct
+
+  let private makeProbe seed opt targPt (dir, _, mono) tryVal =
+    let endian = if dir = Left then LE else BE
+    let tryBytes = bigIntToBytes endian mono.ByteLen tryVal
+    let trySeed = Seed.fixCurBytes seed dir tryBytes
+    let run () = Executor.getBranchInfo opt trySeed tryVal targPt
+    (dir, tryVal, trySeed, run)
+
+  // Check if the function values at the split points, along with the known
+  // values at the ends of the interval, follow the tendency of the search.
+  let private isMonotone mono coords =
+    let ys = Option.toList mono.LowerY @ List.map snd coords @
+             Option.toList mono.UpperY
+    let isOrdered (y1, y2) = if mono.Tendency = Incr then y1 <= y2 else y1 >= y2
+    List.forall isOrdered (List.pairwise ys)
+
+  // Narrow the interval of a search to the sub-interval that brackets the
+  // target value, with the results of the split points in increasing order.
+  // Halt if the results violate the monotonicity.
+  let private narrow (dir, maxLen, mono) results =
+    let coords = [ for (x, brInfoOpt) in results do
+                     yield (x, getFunctionValue mono (Option.get brInfoOpt)) ]
+    let update mono (tryVal, newY) =
+      if tryVal <= mono.LowerX || tryVal >= mono.UpperX then mono
+      else Monotonicity.updateInterval mono tryVal newY
+    if not (isMonotone mono coords) then None
+    else
+      let newMono = List.fold update mono coords |> Monotonicity.adjustByteLen
+      if newMono.ByteLen <= maxLen then Some (dir, maxLen, newMono) else None
+
+  let rec karySearch seed opt targPt accRes searches =
+    if List.isEmpty searches then accRes
+    else
+      let probesOf (_, _, mono as search) =
+        List.map (makeProbe seed opt targPt search)
+          (splitPoints opt.SearchArity mono)
+      let probes = List.collect probesOf searches
+      let runs = List.map (fun (_, _, _, run) -> run) probes |> Array.ofList
+      let outcomes = List.zip probes (List.ofArray (Executor.runBatch opt runs))
+      let sols =
+        [ for (_, _, trySeed, _), (exitSig, covGain, brInfoOpt) in outcomes do
+            match brInfoOpt with
+            | Some brInfo when brInfo.Distance = 0I ->
+              yield (trySeed, exitSig, covGain)
+            | _ -> () ]
+      if not (List.isEmpty sols) then sols @ accRes
+      else
+        let proceed (dir, _, _ as search) =
+          let results = [ for (d, x, _, _), (_, _, brInfoOpt) in outcomes do
+                            if d = dir then yield (x, brInfoOpt) ]
+          // Halt if the target point disappeared at any of the split points.
+          if List.exists (snd >> Option.isNone) results then None
+          else narrow search results
+        karySearch seed opt targPt accRes (List.choose proceed searches)
+
   let solveMonotonic seed opt accRes (targPt, mono) =
     let maxLenR = Seed.queryUpdateBound seed Right
     let maxLenL = Seed.queryUpdateBound seed Left
-    // Try big endian first, and stop if any result is found.
-    let res = binarySearch seed opt Right maxLenR targPt [] mono
-    if not (List.isEmpty res) then res @ accRes
-    else binarySearch seed opt Left maxLenL targPt accRes mono
+    if Executor.isForkServerOn () then
+      // Search in both endians at once, and stop if any result is found.
+      let searches = [ (Right, maxLenR, mono); (Left, maxLenL, mono) ]
+      karySearch seed opt targPt accRes searches
+    else
+      // Executions cannot run in parallel, so search one endian at a time. Try
+      // big endian first, and stop if any result is found.
+      let res = binarySearch seed opt Right maxLenR targPt [] mono
+      if not (List.isEmpty res) then res @ accRes
+      else binarySearch seed opt Left maxLenL targPt accRes mono
 
   (* Functions related to solving linear inequalities *)
 
@@ -165,15 +241,56 @@ module GreySolver =
       // 'Positive' is used as a dummy argument.
       generateRangesAux 0I Positive max splitPoints [] []
 
+  (* Functions related to probing multiple branch points at once *)
+
+  // Branch points of the inequalities in the branch sequence being solved. When
+  // one of them is probed, the others are probed with the same execution. The
+  // results are cached by the input, since inequalities on the same bytes (e.g.
+  // a comparison in a loop) often probe the same inputs.
+  let probeTargets =
+    new Threading.ThreadLocal<BranchPoint list>(fun () -> [])
+
+  let probeCache =
+    new Threading.ThreadLocal<Dictionary<Hash * BranchPoint, BranchInfo option>>
+      (fun () -> new Dictionary<Hash * BranchPoint, BranchInfo option>())
+
+  let clearProbeCache () =
+    probeCache.Value.Clear()
+
+  let setProbeTargets branchSeq =
+    let chooser ((cond, branchPt), _) =
+      match cond with
+      | LinIneq _ -> Some branchPt
+      | _ -> None
+    let targPts = List.choose chooser branchSeq.Branches |> List.distinct
+    probeTargets.Value <- targPts
+
+  let probeBranchInfo seed opt targPt =
+    let cache = probeCache.Value
+    let hash = hashBytes (Seed.concretize seed)
+    match cache.TryGetValue((hash, targPt)) with
+    | true, brInfoOpt -> brInfoOpt
+    | false, _ ->
+      let isPending t = t <> targPt && not (cache.ContainsKey((hash, t)))
+      let others = List.filter isPending probeTargets.Value
+      let targPts = targPt :: List.truncate (MAX_BRANCH_TARGETS - 1) others
+      // Use dummy value as 'tryVal', since our interest is in branch distance.
+      let results =
+        if List.length targPts = 1
+        then [ Executor.getBranchInfoOnly opt seed 0I targPt ]
+        else Executor.getBranchInfos opt seed 0I targPts
+      List.iter2 (fun t brInfoOpt -> cache.[(hash, t)] <- brInfoOpt)
+        targPts results
+      List.head results
+
   let checkSolutionAux seed opt dir endian size targPt accRes sol =
     let tryBytes = bigIntToBytes endian size sol
     let trySeed = Seed.fixCurBytes seed dir tryBytes
-    // Use dummy value as 'tryVal', since our interest is in branch distance.
-    match Executor.getBranchInfoOnly opt trySeed 0I targPt with
+    match probeBranchInfo trySeed opt targPt with
     | Some brInfo when brInfo.Distance = 0I ->
       let tryBytes' = bigIntToBytes endian size (sol - 1I)
       let trySeed' = Seed.fixCurBytes seed dir tryBytes'
-      match Executor.getBranchInfoOnly opt trySeed' 0I targPt with
+      match probeBranchInfo trySeed' opt targPt with
       | Some brInfo' ->
         let sign = if brInfo'.Distance > 0I then Positive else Negative
         (sol, sign) :: accRes
@@ -192,9 +309,8 @@ module GreySolver =
     let trySeed1 = Seed.fixCurBytes seed dir tryBytes1
     let tryBytes2 = bigIntToBytes endian size sol2
     let trySeed2 = Seed.fixCurBytes seed dir tryBytes2
-    // Use dummy value as 'tryVal', since our interest is in branch distance.
-    let brInfoOpt1 = Executor.getBranchInfoOnly opt trySeed1 0I targPt
-    let brInfoOpt2 = Executor.getBranchInfoOnly opt trySeed2 0I targPt
+    let brInfoOpt1 = probeBranchInfo trySeed1 opt targPt
+    let brInfoOpt2 = probeBranchInfo trySeed2 opt targPt
     match brInfoOpt1, brInfoOpt2 with
     | Some brInfo1, Some brInfo2 ->
       if sameSign brInfo1.Distance brInfo2.Distance
@@ -293,6 +409,7 @@ module GreySolver =
       (pc, items)
 
   let solveBranchSeq seed opt dir pc branchSeq =
+    setProbeTargets branchSeq
     List.fold (fun (accPc, accSeeds) branch ->
       let accPc, newSeeds = solveBranchCond seed opt dir accPc branch
       accPc, newSeeds @ accSeeds
@@ -325,6 +442,65 @@ module GreySolver =
       let subTreeSeeds = List.map (solveBranchTree seed opt dir pc) subTrees
       List.concat (newSeeds :: subTreeSeeds)
 
+  (* Functions related to string comparisons logged as a whole *)
+
+  // Number the calls at each call site, to match the calls of different traces.
+  let private indexStringCompares (strCmps: StringCompare list) =
+    let visits = Dictionary<uint64, int>()
+    [ for strCmp in strCmps do
+        let idx = match visits.TryGetValue(strCmp.CallSite) with
+                  | true, n -> n + 1
+                  | false, _ -> 1
+        visits.[strCmp.CallSite] <- idx
+        yield ((strCmp.CallSite, idx), strCmp) ]
+
+  // Find the offset of the cursor byte in an operand, i.e. the offset where the
+  // operand has the byte value tried in every trace, while the other operand
+  // stays the same. Returns the other operand and the offset.
+  let private findCursorOffset (strCmps: StringCompare list) =
+    let tryOperand getBuf getOther =
+      let other: byte array = getOther (List.head strCmps)
+      let hasTryVal k (strCmp: StringCompare) =
+        let buf: byte array = getBuf strCmp
+        k < buf.Length && bigint (int buf.[k]) = strCmp.TryVal
+      if List.exists (fun s -> getOther s <> other) strCmps then None
+      else List.tryFind (fun k -> List.forall (hasTryVal k) strCmps)
+             [ 0 .. other.Length - 1 ]
+           |> Option.map (fun k -> (other, k))
+    let getBuf1 (strCmp: StringCompare) = strCmp.Buf1
+    let getBuf2 (strCmp: StringCompare) = strCmp.Buf2
+    match tryOperand getBuf1 getBuf2 with
+    | Some res -> Some res
+    | None -> tryOperand getBuf2 getBuf1
+
+  // Write the operand around the cursor, so that the cursor byte lands on the
+  // offset 'k' of the operand. The bytes before the cursor are written only if
+  // they can be updated.
+  let private fillOperand seed (operand: byte array, k) =
+    let maxLenL = Seed.queryUpdateBound seed Left
+    let maxLenR = Seed.queryUpdateBound seed Right
+    let seed = if k < maxLenL then Seed.fixCurBytes seed Left operand.[.. k]
+               else seed
+    Seed.fixCurBytes seed Right (Array.truncate maxLenR operand.[k ..])
+
+  /// Solve the calls to the string comparison functions that compare the cursor
+  /// byte, by filling in the whole operand at once, instead of solving the
+  /// comparisons in the function byte by byte.
+  let solveStrings seed opt (strTraces: StringCompare list list) =
+    let nTraces = List.length strTraces
+    if nTraces < 2 then [] // Cannot tell which byte follows the cursor byte.
+    else
+      List.collect indexStringCompares strTraces
+      |> List.groupBy fst
+      |> List.filter (fun (_, calls) -> List.length calls = nTraces)
+      |> List.choose (snd >> List.map snd >> findCursorOffset)
+      |> List.distinct
+      |> List.map (fun sol ->
+           let trySeed = fillOperand seed sol
+           let exitSig, covGain = Executor.getCoverage opt trySeed
+           (trySeed, exitSig, covGain))
+
   let solve seed opt byteDir branchTree =
     let initPC = Constraint.top
+    clearProbeCache ()
     solveBranchTree seed opt byteDir initPC branchTree